@@ -0,0 +1,134 @@
+/**
+ * gbp-propagatord: serve the libGBP2 message API over a Unix domain socket.
+ *
+ * Usage:
+ *
+ *   gbp-propagatord [--help] [--socket PATH] [--threads N] [--stats-interval SECONDS] [--result-cache-size BYTES] [--max-request-size BYTES]
+ *
+ *     --help                     print the options and exit
+ *     --socket PATH              the socket to listen on (default /tmp/gbp-propagatord.sock)
+ *     --threads N                the number of worker threads (default: one per hardware thread)
+ *     --stats-interval SECONDS   print stats to stderr every SECONDS seconds (default: never)
+ *     --result-cache-size BYTES  cache the outputs of `run` requests, using at most BYTES bytes (default: 0, no cache)
+ *     --max-request-size BYTES   close connections that send a request larger than BYTES bytes (default: 64 MiB)
+ *
+ * Send SIGUSR1 to print stats. SIGINT or SIGTERM stop the server after the requests that
+ * have been received are finished.
+ *
+ * See libGBP2::PropagatorServer for the protocol.
+ */
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+#include <pthread.h>
+
+#include <boost/program_options.hpp>
+#include <libGBP2/MessageAPI/PropagatorServer.hpp>
+
+namespace po = boost::program_options;
+
+namespace
+{
+int usage(const char* a_name, const po::options_description& a_options)
+{
+  std::cerr << "Usage: " << a_name << " [options]\n";
+  std::cerr << a_options << std::endl;
+  return 2;
+}
+
+void print_stats(const libGBP2::PropagatorServer::Stats& a_stats)
+{
+  std::cerr << "gbp-propagatord:"
+            << " connections=" << a_stats.connections
+            << " queue_depth=" << a_stats.queue_depth
+            << " in_progress=" << a_stats.requests_in_progress
+            << " completed=" << a_stats.requests_completed
+            << " mean_latency_us=" << a_stats.mean_latency.count() / 1e3
+            << " max_latency_us=" << a_stats.max_latency.count() / 1e3
+            << " result_cache_hits=" << a_stats.result_cache.hits
+            << " result_cache_misses=" << a_stats.result_cache.misses
+            << " result_cache_evictions=" << a_stats.result_cache.evictions
+            << " result_cache_bytes=" << a_stats.result_cache.bytes << std::endl;
+}
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  std::string socket_path;
+  std::size_t threads;
+  long        stats_interval;
+  std::size_t result_cache_size;
+  std::size_t max_request_size;
+
+  po::options_description options("Options");
+  // clang-format off
+  options.add_options()
+    ("help,h", "print this message and exit")
+    ("socket", po::value<std::string>(&socket_path)->default_value("/tmp/gbp-propagatord.sock")->value_name("PATH"), "the socket to listen on")
+    ("threads", po::value<std::size_t>(&threads)->default_value(0)->value_name("N"), "the number of worker threads (0 uses one per hardware thread)")
+    ("stats-interval", po::value<long>(&stats_interval)->default_value(0)->value_name("SECONDS"), "print stats to stderr every SECONDS seconds (0 never prints them)")
+    ("result-cache-size", po::value<std::size_t>(&result_cache_size)->default_value(0)->value_name("BYTES"), "cache the outputs of `run` requests, using at most BYTES bytes")
+    ("max-request-size", po::value<std::size_t>(&max_request_size)->default_value(0)->value_name("BYTES"), "close connections that send a request larger than BYTES bytes (0 uses the default, 64 MiB)")
+    ;
+  // clang-format on
+
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, options), vm);
+    po::notify(vm);
+  } catch(po::error& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return usage(argv[0], options);
+  }
+  if(vm.count("help")) {
+    std::cout << "Usage: " << argv[0] << " [options]\n";
+    std::cout << options << std::endl;
+    return 0;
+  }
+
+  // block the signals we handle before any threads are started so that
+  // they are only received by the sigwait below.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  libGBP2::PropagatorServer server(socket_path, threads);
+  server.getPropagator().setResultCacheSize(result_cache_size);
+  if(max_request_size > 0) {
+    server.setMaxRequestSize(max_request_size);
+  }
+  try {
+    server.start();
+  } catch(std::exception& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+  std::cerr << "gbp-propagatord: listening on " << socket_path << std::endl;
+
+  for(;;) {
+    int signal;
+    if(stats_interval > 0) {
+      timespec timeout{stats_interval, 0};
+      signal = sigtimedwait(&signals, nullptr, &timeout);
+    } else {
+      signal = sigwaitinfo(&signals, nullptr);
+    }
+    if(signal == SIGINT || signal == SIGTERM) {
+      break;
+    }
+    if(signal == SIGUSR1 || (signal < 0 && errno == EAGAIN)) {
+      print_stats(server.getStats());
+    }
+  }
+
+  std::cerr << "gbp-propagatord: stopping" << std::endl;
+  server.stop();
+  print_stats(server.getStats());
+  return 0;
+}
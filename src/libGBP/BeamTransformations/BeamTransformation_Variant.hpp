@@ -0,0 +1,34 @@
+#pragma once
+
+/** @file BeamTransformation_Variant.hpp
+ * @brief Value type that holds any of the library's beam transformations.
+ */
+
+#include <variant>
+
+#include "./BeamTransformation_Interface.hpp"
+#include "./Filter.hpp"
+#include "./FlatInterface.hpp"
+#include "./SphericalInterface.hpp"
+#include "./ThinLens.hpp"
+#include "./Translation.hpp"
+
+namespace libGBP
+{
+/**
+ * Holds one of the library's beam transformations by value, or a pointer to any other
+ * implementation of BeamTransformation_Interface.
+ *
+ * GaussianBeam::transform(...) calls the methods of the library's elements directly, without
+ * going through the virtual interface. Elements held by pointer are called through the interface,
+ * so user defined elements (and classes derived from the library's elements) must be stored as a
+ * BeamTransformation_ptr to be used.
+ *
+ * An OpticalSystem<T, BeamTransformation_Variant<T> > keeps its elements inline.
+ */
+template<typename T>
+using BeamTransformation_Variant =
+    std::variant<ThinLens<T>, SphericalInterface<T>, FlatInterface<T>, Filter,
+                 Translation<T>, BeamTransformation_ptr<T> >;
+
+}  // namespace libGBP
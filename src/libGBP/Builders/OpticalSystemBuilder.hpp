@@ -27,14 +27,15 @@ void OpticalSystemBuilder<T>::configure(OpticalSystem<T>* system,
   auto elementsConfig = configTree.get_child_optional("elements");
   if (!elementsConfig) return;
 
-  OpticalElementBuilder<T> builder;
-  boost::units::quantity<T>              position;
+  OpticalElementBuilder<T>                builder;
+  typename OpticalSystem<T>::ElementsType elements;
 
   for (auto& iter : elementsConfig.value()) {
-    position = iter.second.get<double>("position", 0) * T();
-    system->addElement(BeamTransformation_ptr<T>(builder.build(iter.second)),
-                       position);
+    elements.emplace_back(iter.second.get<double>("position", 0) * T(),
+                          BeamTransformation_ptr<T>(builder.build(iter.second)));
   }
+  // sort and merge the elements once, instead of inserting them one at a time
+  system->addElements(elements.begin(), elements.end());
 }
 
 }
@@ -6,12 +6,19 @@
  * @date 07/27/16
  */
 
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <thread>
+
 #include <boost/property_tree/ptree.hpp>
 #include <boost/signals2.hpp>
 
 #include "Builders/BeamBuilder.hpp"
 #include "Builders/MediaStackBuilder.hpp"
 #include "Builders/OpticalSystemBuilder.hpp"
+#include "utils/ThreadPool.hpp"
 
 namespace libGBP {
 /** @class GBPCalc
@@ -26,6 +33,35 @@ class GBPCalc
   std::shared_ptr<MediaStack<LengthUnitType> >    media;
   std::shared_ptr<GaussianBeam>                   beam;
   std::vector<boost::units::quantity<LengthUnitType> >          evaluation_points;
+  size_t                                                        numThreads = 1;
+  // worker threads for calculate(), created when they are first needed
+  std::unique_ptr<ThreadPool>                                   pool;
+
+  /** @class BeamCursor
+   * @brief Carries the beam to increasing positions, applying only the elements
+   * and media boundaries that were crossed since the previous position.
+   *
+   * advance(z) gives the same beam as getBeam(z), as long as z is not less than
+   * the previous position. Positions before the beam's initial position are passed
+   * on to getBeam(z).
+   */
+  class BeamCursor
+  {
+    typedef boost::units::quantity<LengthUnitType> Position;
+
+    GBPCalc*     calc;
+    GaussianBeam beam;  ///< all elements up to the previous position have been applied
+    Position     start;
+    typename OpticalSystem<LengthUnitType>::ElementsType::const_iterator nextElement;
+    typename MediaStack<LengthUnitType>::BoundariesType::const_iterator  nextBoundary;
+    Media_ptr<LengthUnitType> currentMedia;
+    Position                  currentMediaStart;
+    double transmission;  ///< transmission from start to currentMediaStart
+
+   public:
+    explicit BeamCursor(GBPCalc* a_calc);
+    GaussianBeam advance(Position z);
+  };
 
  public:
   void configure(const ptree& configTree);
@@ -35,12 +71,25 @@ class GBPCalc
   GaussianBeam getBeam(V z);
   const std::vector<boost::units::quantity<LengthUnitType> >& getEvaluationPoints() const;
 
+  /** Sets the number of threads used by calculate(). If n is zero, the number of
+   * hardware threads is used. The default is 1. calculate() runs on the calling
+   * thread and n - 1 worker threads, which are kept for later calls.
+   */
+  void setNumThreads(size_t n)
+  {
+    if (n != numThreads) pool.reset();
+    numThreads = n;
+  }
+  size_t getNumThreads() const { return numThreads; }
 
   void calculate();
 
   boost::signals2::signal<void(const GaussianBeam&)>
       sig_calculatedBeam;  ///< signal that is emitted when a beam is calculated
                            ///< at a new z position
+  boost::signals2::signal<void(std::span<const GaussianBeam>)>
+      sig_calculatedBeams;  ///< signal that is emitted once with the beams at
+                            ///< all evaluation points, in order
 };
 
 /** Returns a Gaussian beam that corresponds to a given position. The current
@@ -118,13 +167,109 @@ void GBPCalc<T>::clear()
   evaluation_points.clear();
 }
 
+/** Calculates the beam at each evaluation point and emits sig_calculatedBeam
+ * for each one, in the order that the points were given. Then sig_calculatedBeams
+ * is emitted once with all of the beams.
+ *
+ * The points are evaluated in increasing order so that a single beam can be
+ * carried from point to point. With more than one thread, the sorted points are
+ * split into one contiguous range per thread, and each thread carries its own
+ * beam through its range. The worker threads are kept between calls. The beams
+ * are stored until all of them have been calculated, then the signals are
+ * emitted from the calling thread. The beams are the same for any number of
+ * threads.
+ */
 template<typename T>
 void GBPCalc<T>::calculate()
 {
-  for (size_t i = 0; i < evaluation_points.size(); i++) {
-    auto z = evaluation_points[i];
-    sig_calculatedBeam(this->getBeam(z));
+  size_t N        = evaluation_points.size();
+  size_t poolSize = numThreads > 0 ? numThreads : std::thread::hardware_concurrency();
+  size_t threads  = std::max<size_t>(1, std::min(poolSize, N));
+  bool   sorted   = std::is_sorted(evaluation_points.begin(), evaluation_points.end());
+
+  if (sorted && threads == 1 && sig_calculatedBeams.empty()) {
+    // nothing needs to be stored
+    BeamCursor cursor(this);
+    for (auto z : evaluation_points) sig_calculatedBeam(cursor.advance(z));
+    return;
+  }
+
+  std::vector<size_t> order(N);
+  std::iota(order.begin(), order.end(), 0);
+  if (!sorted)
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+      return evaluation_points[a] < evaluation_points[b];
+    });
+
+  std::vector<GaussianBeam> beams(N);
+  auto evaluate = [this, &order, &beams](size_t first, size_t last) {
+    BeamCursor cursor(this);
+    for (size_t i = first; i < last; i++)
+      beams[order[i]] = cursor.advance(evaluation_points[order[i]]);
+  };
+  if (threads == 1) {
+    evaluate(0, N);
+  } else {
+    // the calling thread runs ranges too while it waits, so it is one of the threads
+    if (!pool) pool.reset(new ThreadPool(poolSize - 1));
+    pool->parallel_for(threads, 1, [&evaluate, N, threads](size_t a, size_t b) {
+      for (size_t t = a; t < b; t++)
+        evaluate(t * N / threads, (t + 1) * N / threads);
+    });
+  }
+
+  if (!sig_calculatedBeam.empty())
+    for (const auto& beam : beams) sig_calculatedBeam(beam);
+  sig_calculatedBeams(std::span<const GaussianBeam>(beams));
+}
+
+template<typename T>
+GBPCalc<T>::BeamCursor::BeamCursor(GBPCalc* a_calc)
+    : calc(a_calc),
+      beam(*a_calc->beam),
+      start(a_calc->beam->getCurrentPosition()),
+      currentMedia(a_calc->media->getBackgroundMedia()),
+      currentMediaStart(start),
+      transmission(1)
+{
+  // elements at the initial position are applied, see OpticalSystem::transform(...)
+  const auto& elements = calc->optics->getElements();
+  nextElement          = std::partition_point(
+      elements.begin(), elements.end(),
+      [this](const auto& elem) { return elem.first < start; });
+
+  // boundaries at the initial position are crossed by the first advance, see MediaStack::getTransmission(...)
+  const auto& boundaries = calc->media->getBoundaries();
+  for (nextBoundary = boundaries.begin();
+       nextBoundary != boundaries.end() && nextBoundary->first < start;
+       nextBoundary++)
+    currentMedia = nextBoundary->second;
+}
+
+template<typename T>
+GaussianBeam GBPCalc<T>::BeamCursor::advance(Position z)
+{
+  if (z < start) return calc->getBeam(z);
+
+  const auto& elements = calc->optics->getElements();
+  for (; nextElement != elements.end() && !(z < nextElement->first);
+       nextElement++)
+    beam.transform(nextElement->second.get(), nextElement->first);
+
+  const auto& boundaries = calc->media->getBoundaries();
+  for (; nextBoundary != boundaries.end() && nextBoundary->first < z;
+       nextBoundary++) {
+    transmission *=
+        currentMedia->getTransmission(currentMediaStart, nextBoundary->first);
+    currentMediaStart = nextBoundary->first;
+    currentMedia      = nextBoundary->second;
   }
+
+  GaussianBeam result = beam;
+  result.setPower(beam.getPower() * transmission *
+                  currentMedia->getTransmission(currentMediaStart, z));
+  result.setCurrentPosition(z);
+  return result;
 }
 }
 
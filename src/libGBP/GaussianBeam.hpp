@@ -8,8 +8,9 @@
 
 #include <complex>
 #include <iostream>
+#include <type_traits>
 
-#include "./BeamTransformations/BeamTransformation_Interface.hpp"
+#include "./BeamTransformations/BeamTransformation_Variant.hpp"
 #include "./LaserBeam.hpp"
 
 namespace libGBP
@@ -246,13 +247,55 @@ class GaussianLaserBeam : public LaserBeam
 
   template<typename T, typename U>
   void transform(const BeamTransformation_Interface<T>& a_elem, U a_z)
+  {
+    this->transform(a_elem.getRTMatrix(), a_elem.getPositionShift(),
+                    a_elem.getPowerLoss(), a_elem.getWavelengthScaleFactor(),
+                    a_z);
+  }
+
+  /**
+   * Transform the beam with an element stored by value. The library's elements
+   * are called directly (the calls are qualified with the element type), so there
+   * is no virtual dispatch. Elements stored by pointer use the interface.
+   */
+  template<typename T, typename U>
+  void transform(const BeamTransformation_Variant<T>& a_elem, U a_z)
+  {
+    std::visit(
+        [this, &a_z](const auto& elem) {
+          using E = std::decay_t<decltype(elem)>;
+          if constexpr (std::is_same_v<E, BeamTransformation_ptr<T> >) {
+            this->transform(*elem, a_z);
+          } else {
+            this->transform(elem.E::getRTMatrix(),
+                            boost::units::quantity<T>(elem.E::getPositionShift()),
+                            elem.E::getPowerLoss(),
+                            elem.E::getWavelengthScaleFactor(), a_z);
+          }
+        },
+        a_elem);
+  }
+
+  template<typename T, typename U>
+  void transform(const BeamTransformation_ptr<T>& a_elem, U a_z)
+  {
+    this->transform(*a_elem, a_z);
+  }
+
+  /**
+   * Transform the beam with the ray transfer matrix, position shift, power loss and
+   * wavelength scale factor of an element at a_z.
+   */
+  template<typename T, typename U>
+  void transform(const Eigen::Matrix<double, 2, 2>& a_RTM,
+                 boost::units::quantity<T> a_positionShift, double a_powerLoss,
+                 double a_wavelengthScaleFactor, U a_z)
   {
     std::complex<double> qi  = this->getComplexBeamParameter<T>(a_z).value();
-    auto                 RTM = a_elem.getRTMatrix();
-    double               A   = RTM(0, 0);
-    double               B   = RTM(0, 1);
-    double               C   = RTM(1, 0);
-    double               D   = RTM(1, 1);
+    double               A   = a_RTM(0, 0);
+    double               B   = a_RTM(0, 1);
+    double               C   = a_RTM(1, 0);
+    double               D   = a_RTM(1, 1);
 
     std::complex<double> qf = (A * qi + B) / (C * qi + D);
 
@@ -274,10 +317,10 @@ class GaussianLaserBeam : public LaserBeam
     // CAREFUL! Make sure to get the units right.
     //
 
-    this->setWavelength(this->getWavelength() * a_elem.getWavelengthScaleFactor());
-    this->setPower(this->getPower() * (1. - a_elem.getPowerLoss()));
+    this->setWavelength(this->getWavelength() * a_wavelengthScaleFactor);
+    this->setPower(this->getPower() * (1. - a_powerLoss));
 
-    this->setWaistPosition(boost::units::quantity<T>(a_z) + a_elem.getPositionShift() - boost::units::quantity<T>::from_value(qf.real()));
+    this->setWaistPosition(boost::units::quantity<T>(a_z) + a_positionShift - boost::units::quantity<T>::from_value(qf.real()));
     //                             vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv
     //                             this calculation will give us the 1/e^2 beam
     //                             radius
@@ -6,6 +6,8 @@
  * @date 07/27/16
  */
 
+#include <atomic>
+
 #include "./BaseMedia.hpp"
 
 namespace libGBP
@@ -17,12 +19,38 @@ class LinearAbsorber : public BaseMedia<LengthUnitType>
   typedef typename boost::units::divide_typeof_helper<units::t::dimensionless, LengthUnitType>::type
       InvLengthUnitType;
   boost::units::quantity<InvLengthUnitType> absorptionCoefficient;
+  std::atomic<unsigned long>                version{0};
+
+  static std::atomic<unsigned long>& modificationCounter()
+  {
+    static std::atomic<unsigned long> counter(0);
+    return counter;
+  }
+  void modified()
+  {
+    ++version;
+    ++modificationCounter();
+  }
 
  public:
+  LinearAbsorber() = default;
+  LinearAbsorber(const LinearAbsorber& other)
+      : BaseMedia<LengthUnitType>(other),
+        absorptionCoefficient(other.absorptionCoefficient)
+  {
+  }
+  LinearAbsorber& operator=(const LinearAbsorber& other)
+  {
+    this->absorptionCoefficient = other.absorptionCoefficient;
+    this->modified();
+    return *this;
+  }
+
   template<typename U>
   void setAbsorptionCoefficient(U v)
   {
     this->absorptionCoefficient = boost::units::quantity<InvLengthUnitType>(v);
+    this->modified();
   }  ///< performs unit conversion and sets absorptionCoefficient
   template<typename U>
   boost::units::quantity<U> getAbsorptionCoefficient() const
@@ -34,6 +62,16 @@ class LinearAbsorber : public BaseMedia<LengthUnitType>
     return this->getAbsorptionCoefficient<InvLengthUnitType>();
   }  ///< returns absorptionCoefficient in internal units (InvLengthUnitType)
 
+  /** Returns the number of times the absorption coefficient of this absorber
+   * has been changed.
+   */
+  unsigned long getVersion() const { return version; }
+  /** Returns the number of times the absorption coefficient of any
+   * LinearAbsorber<LengthUnitType> has been changed. MediaStack uses this as a
+   * cheap check for changes before it compares the versions of its absorbers.
+   */
+  static unsigned long getModificationCount() { return modificationCounter(); }
+
   template<typename T, typename U>
   double getTransmission(
       T zi, U zf) const;  ///< returns percentage of power transmitted through
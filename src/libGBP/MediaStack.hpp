@@ -6,12 +6,32 @@
  * @date 07/27/16
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
 #include <queue>
+#include <typeinfo>
+#include <vector>
 
-#include "Media/MediaInterface.hpp"
+#include "Media/LinearAbsorber.hpp"
 
 namespace libGBP
 {
+/**
+ * Boundaries are kept sorted by position. Each media extends from its boundary to
+ * the next one, and the background media fills everything in front of the first boundary.
+ *
+ * If every media has a closed form transmission (BaseMedia and LinearAbsorber),
+ * the stack keeps the boundary positions with a running sum of the optical depth
+ * at each boundary, so getTransmission(zi,zf) is two binary searches. Otherwise,
+ * each media between zi and zf is asked for its transmission.
+ *
+ * The index records the version of each LinearAbsorber it read. After any
+ * LinearAbsorber is modified, the next getTransmission(...) compares those versions
+ * and rebuilds the index if one of this stack's absorbers changed. Changes to
+ * absorbers in other stacks only cost that one comparison.
+ */
 template<typename LengthUnitType>
 class MediaStack
 {
@@ -24,12 +44,49 @@ class MediaStack
   Media_ptr<LengthUnitType> backgroundMedia;
   BoundariesType            boundaries;
 
+  // optical depth index, only used if `indexed` is true. positions and depths are
+  // in LengthUnitType. attenuations[0] is the background media, attenuations[i+1]
+  // is the media that starts at positions[i]. absorbers holds the LinearAbsorber
+  // each attenuation was read from (nullptr for BaseMedia) and versions holds its
+  // version. revision is the LinearAbsorber modification count when the versions
+  // were last checked. the index is rebuilt by const methods, under indexMutex.
+  mutable bool                                               indexed = false;
+  mutable std::vector<double>                                positions;
+  mutable std::vector<double>                                attenuations;
+  mutable std::vector<const LinearAbsorber<LengthUnitType>*> absorbers;
+  mutable std::vector<unsigned long>                         versions;
+  mutable std::vector<double>                                depths;
+  mutable std::atomic<unsigned long>                         revision{0};
+  mutable std::mutex                                         indexMutex;
+
+  static bool getAttenuationCoefficient(
+      const Media_ptr<LengthUnitType>&       media,
+      double&                                mu,
+      const LinearAbsorber<LengthUnitType>*& absorber,
+      unsigned long&                         version);
+  double getOpticalDepth(double z, size_t i) const;
+  void   buildIndex() const;
+  void   checkIndex() const;
+
  public:
   MediaStack();
+  MediaStack(const MediaStack& other)
+      : backgroundMedia(other.backgroundMedia), boundaries(other.boundaries)
+  {
+    this->updateIndex();
+  }
+  MediaStack& operator=(const MediaStack& other)
+  {
+    this->backgroundMedia = other.backgroundMedia;
+    this->boundaries      = other.boundaries;
+    this->updateIndex();
+    return *this;
+  }
 
   MediaStack<LengthUnitType>& setBackgroundMedia(Media_ptr<LengthUnitType> abs)
   {
     this->backgroundMedia = abs;
+    this->updateIndex();
     return *this;
   }
   Media_ptr<LengthUnitType> getBackgroundMedia()
@@ -46,12 +103,137 @@ class MediaStack
   template<typename U, typename V>
   double getTransmission(U zi, V zf) const;
 
-  void clear() { boundaries.clear(); }
+  void clear()
+  {
+    boundaries.clear();
+    this->updateIndex();
+  }
+
+  /**
+   * Rebuild the optical depth index. This is done when boundaries are added,
+   * and by getTransmission(...) when one of the absorbers has been modified.
+   */
+  void updateIndex()
+  {
+    std::lock_guard<std::mutex> lock(indexMutex);
+    this->buildIndex();
+  }
+
+  /**
+   * Returns true if getTransmission(...) uses the optical depth index, i.e. every
+   * media has a closed form transmission. The index is brought up to date first.
+   */
+  bool isIndexed() const
+  {
+    this->checkIndex();
+    return indexed;
+  }
 };
 
 template<typename T>
 MediaStack<T>::MediaStack() : backgroundMedia(new BaseMedia<T>())
 {
+  this->updateIndex();
+}
+
+/** Gets the attenuation coefficient (in 1/LengthUnitType) of media whose
+ * transmission is exp(-mu (zf - zi)). Returns false for any other media,
+ * including classes derived from BaseMedia or LinearAbsorber, since they may
+ * override getTransmission. absorber is set to the media if it is a
+ * LinearAbsorber, and nullptr otherwise. version is set to the absorber's
+ * version, read before its coefficient.
+ */
+template<typename T>
+bool MediaStack<T>::getAttenuationCoefficient(const Media_ptr<T>&       media,
+                                              double&                   mu,
+                                              const LinearAbsorber<T>*& absorber,
+                                              unsigned long&            version)
+{
+  absorber = nullptr;
+  version  = 0;
+  if (!media) return false;
+  const auto& type = typeid(*media);
+  if (type == typeid(BaseMedia<T>)) {
+    mu = 0;
+    return true;
+  }
+  if (type == typeid(LinearAbsorber<T>)) {
+    absorber = static_cast<const LinearAbsorber<T>*>(media.get());
+    version  = absorber->getVersion();
+    mu       = absorber->getAbsorptionCoefficient().value();
+    return true;
+  }
+  return false;
+}
+
+/** Builds the index. The caller must hold indexMutex.
+ */
+template<typename T>
+void MediaStack<T>::buildIndex() const
+{
+  positions.clear();
+  attenuations.clear();
+  absorbers.clear();
+  versions.clear();
+  depths.clear();
+  // read before the coefficients, so a change while they are read is noticed.
+  // it is stored after the index is built, see checkIndex().
+  unsigned long count = LinearAbsorber<T>::getModificationCount();
+
+  double                   mu;
+  const LinearAbsorber<T>* absorber;
+  unsigned long            version;
+  indexed = getAttenuationCoefficient(backgroundMedia, mu, absorber, version);
+  if (indexed) {
+    attenuations.push_back(mu);
+    absorbers.push_back(absorber);
+    versions.push_back(version);
+  }
+  for (auto it = boundaries.begin(); indexed && it != boundaries.end(); ++it) {
+    indexed = getAttenuationCoefficient(it->second, mu, absorber, version);
+    if (!indexed) break;
+    double z = it->first.value();
+    depths.push_back(positions.empty() ? 0
+                                       : depths.back() +
+                                             attenuations.back() *
+                                                 (z - positions.back()));
+    positions.push_back(z);
+    attenuations.push_back(mu);
+    absorbers.push_back(absorber);
+    versions.push_back(version);
+  }
+  revision.store(count, std::memory_order_release);
+}
+
+/** Rebuilds the index if one of the absorbers in it has been modified. The
+ * versions are only compared if a LinearAbsorber has been modified since they
+ * were last checked, so most calls are a single comparison.
+ */
+template<typename T>
+void MediaStack<T>::checkIndex() const
+{
+  unsigned long count = LinearAbsorber<T>::getModificationCount();
+  if (revision.load(std::memory_order_acquire) == count) return;
+
+  std::lock_guard<std::mutex> lock(indexMutex);
+  if (revision.load(std::memory_order_relaxed) == count) return;
+  for (size_t k = 0; k < absorbers.size(); ++k) {
+    if (absorbers[k] && absorbers[k]->getVersion() != versions[k]) {
+      this->buildIndex();
+      return;
+    }
+  }
+  revision.store(count, std::memory_order_release);
+}
+
+/** Returns the optical depth from the first boundary to z, where i is the
+ * number of boundaries in front of z.
+ */
+template<typename T>
+double MediaStack<T>::getOpticalDepth(double z, size_t i) const
+{
+  if (i == 0) return attenuations[0] * (z - positions[0]);
+  return depths[i - 1] + attenuations[i] * (z - positions[i - 1]);
 }
 
 template<typename T>
@@ -60,6 +242,7 @@ MediaStack<T>& MediaStack<T>::addBoundary(Media_ptr<T> abs, U position)
 {
   boundaries.push_back({boost::units::quantity<T>(position), abs});
   boundaries.sort();
+  this->updateIndex();
   return *this;
 }
 
@@ -75,6 +258,20 @@ double MediaStack<T>::getTransmission(U zi, V zf) const
 {
   boost::units::quantity<T> zi_ = boost::units::quantity<T>(zi);
   boost::units::quantity<T> zf_ = boost::units::quantity<T>(zf);
+
+  this->checkIndex();
+  if (indexed) {
+    double a = zi_.value(), b = zf_.value();
+    // the media at a point on a boundary is the one in front of it
+    size_t i = std::lower_bound(positions.begin(), positions.end(), a) -
+               positions.begin();
+    size_t j = b < a ? i
+                     : std::lower_bound(positions.begin() + i, positions.end(), b) -
+                           positions.begin();
+    if (positions.empty() || b < a) return exp(-attenuations[i] * (b - a));
+    return exp(-(getOpticalDepth(b, j) - getOpticalDepth(a, i)));
+  }
+
   // . - initial point
   // x - final point
   //   . |          |   |     | x        // all boundaries are between zi and zf
@@ -88,7 +285,8 @@ double MediaStack<T>::getTransmission(U zi, V zf) const
   std::queue<decltype(boundaries.begin())> incBoundaries;
   auto                                     currentMedia = backgroundMedia;
   for(auto it = boundaries.begin(); it != boundaries.end(); it++) {
-    if(zi_ < it->first && it->first < zf_) incBoundaries.push(it);
+    // a boundary at zi is crossed, so that the media behind it is used
+    if(zi_ <= it->first && it->first < zf_) incBoundaries.push(it);
     if(zi_ > it->first) currentMedia = it->second;
   }
 
@@ -6,32 +6,59 @@
  * @date 06/30/16
  */
 
-#include <list>
+#include <algorithm>
+#include <iterator>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include "Builders/OpticalElementBuilder.hpp"
 #include "GaussianBeam.hpp"
 #include "BeamTransformations/BeamTransformation_Interface.hpp"
+#include "BeamTransformations/BeamTransformation_Variant.hpp"
 
 namespace libGBP {
 
-template<typename LengthUnitType>
+/**
+ * Elements are kept in a vector sorted by position. Elements at the same position
+ * are kept in the order they were added. Transforms binary search for the first and
+ * last element in the range, so only the elements that are applied are visited.
+ *
+ * ElementsType used to be a std::list. Code that only iterates over getElements()
+ * is unaffected, but list operations (push_front, splice, sort, ...) are not available.
+ * addElement inserts into the vector, so use addElements to add many elements at once.
+ *
+ * By default, elements are stored as shared pointers to BeamTransformation_Interface.
+ * Use OpticalSystem<LengthUnitType, BeamTransformation_Variant<LengthUnitType> > to
+ * store the library's elements by value, see BeamTransformation_Variant.hpp.
+ */
+template<typename LengthUnitType,
+         typename ElementStorageType = BeamTransformation_ptr<LengthUnitType> >
 class OpticalSystem
 {
  public:
-  typedef std::pair<boost::units::quantity<LengthUnitType>,
-                    BeamTransformation_ptr<LengthUnitType> >
-                                 ElementType;
-  typedef std::list<ElementType> ElementsType;
+  typedef std::pair<boost::units::quantity<LengthUnitType>, ElementStorageType>
+                                   ElementType;
+  typedef std::vector<ElementType> ElementsType;
 
  protected:
   ElementsType elements;
 
+  static bool comparePositions(const ElementType& a, const ElementType& b)
+  {
+    return a.first < b.first;
+  }
+
  public:
   template<typename U>
-  OpticalSystem<LengthUnitType>& addElement(
-      BeamTransformation_ptr<LengthUnitType> elem, U position);
+  OpticalSystem& addElement(ElementStorageType elem, U position);
+  /**
+   * Add many elements at once. The new elements are sorted once and merged
+   * with the existing elements, instead of being inserted one at a time.
+   * Iterators must dereference to ElementType.
+   */
+  template<typename Iterator>
+  OpticalSystem& addElements(Iterator first, Iterator last);
 
   const ElementsType& getElements() const;
 
@@ -46,25 +73,41 @@ class OpticalSystem
   void clear() { elements.clear(); }
 };
 
-template<typename T>
+template<typename T, typename S>
 template<typename U>
-OpticalSystem<T>& OpticalSystem<T>::addElement(BeamTransformation_ptr<T> elem,
-                                               U                     position)
+OpticalSystem<T, S>& OpticalSystem<T, S>::addElement(S elem, U position)
+{
+  ElementType element(boost::units::quantity<T>(position), std::move(elem));
+  elements.insert(std::upper_bound(elements.begin(), elements.end(), element,
+                                   comparePositions),
+                  element);
+  return *this;
+}
+
+template<typename T, typename S>
+template<typename Iterator>
+OpticalSystem<T, S>& OpticalSystem<T, S>::addElements(Iterator first,
+                                                      Iterator last)
 {
-  elements.push_back({boost::units::quantity<T>(position), elem});
-  elements.sort();
+  auto n = elements.size();
+  elements.insert(elements.end(), first, last);
+  auto middle = elements.begin() + n;
+  std::stable_sort(middle, elements.end(), comparePositions);
+  std::inplace_merge(elements.begin(), middle, elements.end(),
+                     comparePositions);
   return *this;
 }
 
-template<typename T>
-auto OpticalSystem<T>::getElements() const -> const ElementsType&
+template<typename T, typename S>
+auto OpticalSystem<T, S>::getElements() const -> const ElementsType&
 {
   return elements;
 }
 
-template<typename T>
+template<typename T, typename S>
 template<typename U, typename V>
-GaussianBeam OpticalSystem<T>::transform(const GaussianBeam& beam, U zi, V zf)
+GaussianBeam OpticalSystem<T, S>::transform(const GaussianBeam& beam, U zi,
+                                            V zf)
 {
   GaussianBeam beam2 = beam;
   this->transform(&beam2, zi, zf);
@@ -72,25 +115,32 @@ GaussianBeam OpticalSystem<T>::transform(const GaussianBeam& beam, U zi, V zf)
   return beam2;
 }
 
-template<typename T>
-GaussianBeam OpticalSystem<T>::transform(const GaussianBeam& beam)
+template<typename T, typename S>
+GaussianBeam OpticalSystem<T, S>::transform(const GaussianBeam& beam)
 {
   return this->transform(beam, elements.front().first, elements.back().first);
 }
 
-template<typename T>
+template<typename T, typename S>
 template<typename U, typename V>
-void OpticalSystem<T>::transform(GaussianBeam* beam, U zi, V zf)
+void OpticalSystem<T, S>::transform(GaussianBeam* beam, U zi, V zf)
 {
-  for (auto it = elements.begin(); it != elements.end(); it++) {
-    // only apply elements that are between zi and zf
-    if (it->first >= boost::units::quantity<T>(zi) && it->first <= boost::units::quantity<T>(zf))
-      beam->transform(it->second.get(), it->first);
-  }
+  // only apply elements that are between zi and zf
+  boost::units::quantity<T> begin(zi);
+  boost::units::quantity<T> end(zf);
+  if (end < begin) return;
+  auto last = std::upper_bound(
+      elements.begin(), elements.end(), end,
+      [](const auto& z, const ElementType& elem) { return z < elem.first; });
+  for (auto it = std::lower_bound(
+           elements.begin(), last, begin,
+           [](const ElementType& elem, const auto& z) { return elem.first < z; });
+       it != last; it++)
+    beam->transform(it->second, it->first);
 }
 
-template<typename T>
-void OpticalSystem<T>::transform(GaussianBeam* beam)
+template<typename T, typename S>
+void OpticalSystem<T, S>::transform(GaussianBeam* beam)
 {
   this->transform(beam, elements.front().first, elements.back().first);
 }
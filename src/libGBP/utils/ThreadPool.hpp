@@ -0,0 +1,230 @@
+#pragma once
+
+/** @file ThreadPool.hpp
+ * @brief The thread pool used by both libGBP and libGBP2.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace libGBP
+{
+
+/**
+ * A work-stealing thread pool.
+ *
+ * Each worker has its own task queue. Workers take tasks from the back of their own queue
+ * and, when it is empty, steal from the front of the other queues. This keeps all workers busy
+ * when tasks take different amounts of time (i.e. some parameter combinations hit more elements
+ * than others) without a single shared queue becoming a bottleneck.
+ *
+ * The main entry point is parallel_for(...), which blocks until all work is done. The calling
+ * thread runs tasks too while it waits.
+ */
+class ThreadPool
+{
+ private:
+  struct Queue {
+    std::mutex                        mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> m_queues;
+  std::vector<std::thread>            m_threads;
+  std::atomic<std::size_t>            m_pending = 0;
+  std::atomic<std::size_t>            m_next    = 0;
+  std::atomic<bool>                   m_stop    = false;
+  std::mutex                          m_wake_mutex;
+  std::condition_variable             m_wake;
+
+  struct Worker {
+    const ThreadPool *pool  = nullptr;
+    std::size_t       index = static_cast<std::size_t>(-1);
+  };
+  // the pool and queue that the current thread works on, if it is a worker
+  static Worker &current_worker()
+  {
+    static thread_local Worker worker;
+    return worker;
+  }
+  // index of the queue owned by the current thread in this pool, or -1 if the thread is not one of our workers
+  std::size_t queue_index() const
+  {
+    const Worker &worker = current_worker();
+    return worker.pool == this ? worker.index : static_cast<std::size_t>(-1);
+  }
+
+  bool try_pop(std::size_t a_queue, bool a_steal, std::function<void()> &a_task)
+  {
+    Queue                      &queue = *m_queues[a_queue];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if(queue.tasks.empty()) {
+      return false;
+    }
+    if(a_steal) {
+      a_task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    } else {
+      a_task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    }
+    --m_pending;
+    return true;
+  }
+
+  /**
+   * Run a single task if one is available. Returns false if there was no work.
+   */
+  bool run_one()
+  {
+    std::function<void()> task;
+    std::size_t           self  = queue_index();
+    std::size_t           N     = m_queues.size();
+    bool                  found = false;
+    if(self < N) {
+      found = this->try_pop(self, false, task);
+    }
+    for(std::size_t i = 1; !found && i <= N; ++i) {
+      found = this->try_pop((self + i) % N, true, task);
+    }
+    if(found) {
+      task();
+    }
+    return found;
+  }
+
+  void work(std::size_t a_index)
+  {
+    current_worker() = {this, a_index};
+    while(!m_stop) {
+      if(this->run_one()) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(m_wake_mutex);
+      m_wake.wait(lock, [this]() { return m_stop || m_pending > 0; });
+    }
+  }
+
+ public:
+  /**
+   * Create a pool with a_threads worker threads. If a_threads is zero, the number
+   * of hardware threads is used.
+   */
+  explicit ThreadPool(std::size_t a_threads = 0)
+  {
+    if(a_threads == 0) {
+      a_threads = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+    }
+    for(std::size_t i = 0; i < a_threads; ++i) {
+      m_queues.push_back(std::make_unique<Queue>());
+    }
+    for(std::size_t i = 0; i < a_threads; ++i) {
+      m_threads.emplace_back([this, i]() { this->work(i); });
+    }
+  }
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_wake_mutex);
+      m_stop = true;
+    }
+    m_wake.notify_all();
+    for(auto &thread : m_threads) {
+      thread.join();
+    }
+  }
+  ThreadPool(const ThreadPool &)            = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  std::size_t size() const
+  {
+    return m_threads.size();
+  }
+
+  /**
+   * Add a task to the pool. Tasks submitted from a worker go on that worker's queue,
+   * others are distributed round-robin.
+   */
+  void submit(std::function<void()> a_task)
+  {
+    std::size_t index = queue_index();
+    if(index >= m_queues.size()) {
+      index = m_next++ % m_queues.size();
+    }
+    {
+      // count the task before it can be taken, so that m_pending never drops below zero.
+      // take the lock so that a worker can't miss the notification between
+      // checking m_pending and going to sleep.
+      std::lock_guard<std::mutex> lock(m_wake_mutex);
+      ++m_pending;
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+      m_queues[index]->tasks.push_back(std::move(a_task));
+    }
+    m_wake.notify_one();
+  }
+
+  /**
+   * Call a_func(begin, end) for consecutive sub-ranges of [0, a_n) that contain at most a_grain indices
+   * and wait for all of them to finish. If any call throws, the first exception is rethrown here after all
+   * the other calls have finished.
+   */
+  template<typename F>
+  void parallel_for(std::size_t a_n, std::size_t a_grain, F &&a_func)
+  {
+    if(a_n == 0) {
+      return;
+    }
+    struct Group {
+      std::mutex              mutex;
+      std::condition_variable done;
+      std::size_t             remaining;
+      std::exception_ptr      error;
+    };
+    a_grain            = std::max<std::size_t>(1, a_grain);
+    std::size_t chunks = (a_n + a_grain - 1) / a_grain;
+    auto        group  = std::make_shared<Group>();
+    group->remaining   = chunks;
+
+    for(std::size_t c = 0; c < chunks; ++c) {
+      std::size_t begin = c * a_grain;
+      std::size_t end   = std::min(a_n, begin + a_grain);
+      this->submit([&a_func, begin, end, group]() {
+        std::exception_ptr error;
+        try {
+          a_func(begin, end);
+        } catch(...) {
+          error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(group->mutex);
+        if(error && !group->error) {
+          group->error = error;
+        }
+        if(--group->remaining == 0) {
+          group->done.notify_all();
+        }
+      });
+    }
+
+    // help with the work until the queues are empty. all of our chunks have been submitted,
+    // so after that the only thing left to do is wait for the chunks that other threads are running.
+    while(this->run_one()) {
+    }
+    std::unique_lock<std::mutex> lock(group->mutex);
+    group->done.wait(lock, [&group]() { return group->remaining == 0; });
+    if(group->error) {
+      std::rethrow_exception(group->error);
+    }
+  }
+};
+
+}  // namespace libGBP
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "./CircularGaussianLaserBeam.hpp"
+#include "./Conventions.hpp"
+#include "./OpticalElements/FreeSpace.hpp"
+#include "./OpticalSystem.hpp"
+#include "./Propagation.hpp"
+#include "./Units.hpp"
+
+namespace libGBP2
+{
+
+/**
+ * The beam in one free space segment of an optical system.
+ *
+ * All positions are in the coordinates of the optical system, including the beam waist
+ * position of the beam, so beam.getBeamWidth(z) gives the beam width at any position z in
+ * the segment.
+ *
+ * The first segment starts at -infinity and the last segment ends at +infinity.
+ */
+struct BeamSegment {
+  quantity<t::cm>           start;
+  quantity<t::cm>           end;
+  CircularGaussianLaserBeam beam;
+  // positions in the segment where the beam width equals the target width, sorted.
+  std::vector<quantity<t::cm>> crossings;
+
+  /**
+   * Return true if the beam waist is inside of this segment, i.e. the beam comes to a focus in the segment.
+   */
+  bool containsWaist() const
+  {
+    auto z = beam.getBeamWaistPosition<t::cm>();
+    return start <= z && z <= end;
+  }
+};
+
+namespace detail
+{
+/**
+ * Return the positions in [a_start, a_end] where the beam has a (second moment) width of a_width cm.
+ */
+inline std::vector<quantity<t::cm>> width_crossings(const CircularGaussianLaserBeam &a_beam, double a_width, quantity<t::cm> a_start, quantity<t::cm> a_end)
+{
+  std::vector<quantity<t::cm>> crossings;
+  double                       w0 = a_beam.getSecondMomentBeamWaistWidth<t::cm>().value();
+  if(a_width < w0) {
+    return crossings;
+  }
+  // W(z)^2 = W0^2 + theta^2 (z - z0)^2
+  double theta = a_beam.getSecondMomentDivergence<t::rad>().value();
+  double z0    = a_beam.getBeamWaistPosition<t::cm>().value();
+  double dz    = std::sqrt(a_width * a_width - w0 * w0) / theta;
+  for(double z : {z0 - dz, z0 + dz}) {
+    if(a_start.value() <= z && z <= a_end.value() && (crossings.size() == 0 || crossings.back().value() != z)) {
+      crossings.push_back(z * i::cm);
+    }
+  }
+  return crossings;
+}
+
+template<c::Length U1>
+std::vector<BeamSegment> analyze_beam_through_system(const CircularGaussianLaserBeam &a_beam, const OpticalSystem<U1> &a_system, double a_width)
+{
+  const double             inf = std::numeric_limits<double>::infinity();
+  std::vector<BeamSegment> segments;
+
+  auto add_segment = [&](const CircularGaussianLaserBeam &a_local, quantity<t::cm> a_origin, quantity<t::cm> a_start, quantity<t::cm> a_end) {
+    BeamSegment segment{a_start, a_end, a_local, {}};
+    segment.beam.setBeamWaistPosition(a_origin + a_local.getBeamWaistPosition<t::cm>());
+    if(a_width > 0) {
+      segment.crossings = width_crossings(segment.beam, a_width, a_start, a_end);
+    }
+    segments.push_back(std::move(segment));
+  };
+
+  // walk the system the same way OpticalSystem::build(...) does, starting at z = 0.
+  // the beam is in the coordinates of the current position l_z.
+  CircularGaussianLaserBeam beam  = a_beam;
+  quantity<t::cm>           l_z   = 0 * i::cm;
+  quantity<t::cm>           start = -inf * i::cm;
+  for(const auto &elem : a_system.getElements()) {
+    quantity<t::cm> z = quantity<t::cm>(elem.first);
+    if(z < l_z) {
+      continue;
+    }
+    add_segment(beam, l_z, start, z);
+    beam  = transform_beam(beam, elem.second * FreeSpace(z - l_z));
+    l_z   = z + elem.second.template getDisplacement<t::cm>();
+    start = l_z;
+  }
+  add_segment(beam, l_z, start, inf * i::cm);
+
+  return segments;
+}
+}  // namespace detail
+
+/**
+ * Compute the beam in each free space segment of an optical system.
+ *
+ * This gives the beam waist position and size in every segment of the system in closed form,
+ * so there is no need to sample the beam at many positions to find where it comes to a focus.
+ * Check BeamSegment::containsWaist() to see if the waist is actually inside of the segment.
+ *
+ * The beam is propagated from z = 0, the same as propagate_beam_through_system(...).
+ * Elements that are inside of another element (a thin lens inside of a thick lens for example) are skipped, and
+ * there is no segment for the space inside of an element with a displacement.
+ *
+ * @param a_beam : the input beam
+ * @param a_system : the optical system
+ * @return the segments, in order. There is one more segment than the number of elements used.
+ */
+template<c::Length U1>
+std::vector<BeamSegment> analyze_beam_through_system(const CircularGaussianLaserBeam &a_beam, const OpticalSystem<U1> &a_system)
+{
+  return detail::analyze_beam_through_system(a_beam, a_system, -1);
+}
+
+/**
+ * Compute the beam in each free space segment of an optical system, and the positions
+ * in each segment where the beam has a given width.
+ *
+ * The target width can be given in any convention, i.e.
+ *
+ *   auto segments = analyze_beam_through_system(beam, system, make_width<FWHMDiameter>(1 * i::mm));
+ *
+ * @param a_beam : the input beam
+ * @param a_system : the optical system
+ * @param a_width : the target beam width.
+ * @return the segments, in order. Positions where the beam width equals the target are stored in BeamSegment::crossings.
+ */
+template<c::Length U1, typename C, c::Length U2>
+std::vector<BeamSegment> analyze_beam_through_system(const CircularGaussianLaserBeam &a_beam, const OpticalSystem<U1> &a_system, GaussianBeamWidth<C, U2> a_width)
+{
+  return detail::analyze_beam_through_system(a_beam, a_system, a_width.template get<OneOverESquaredRadius, t::cm>().value());
+}
+
+}  // namespace libGBP2
@@ -0,0 +1,272 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "./CircularGaussianLaserBeam.hpp"
+#include "./Simd.hpp"
+
+namespace libGBP2
+{
+
+/**
+ * A container for a large number of circular Gaussian beams.
+ *
+ * CircularGaussianLaserBeam stores a single beam using quantities and recomputes
+ * derived parameters (divergence, Rayleigh range) on every call. For statistical studies
+ * over many beams that overhead dominates. This class stores the beam parameters as
+ * contiguous arrays of doubles (structure-of-arrays) in fixed units and caches the divergence and
+ * Rayleigh range of each beam, so the kernels below can be vectorized (see Simd.hpp).
+ *
+ * All lengths are in cm and all angles are in rad. Widths are second moment widths
+ * (1/e^2 radius).
+ */
+class CircularGaussianBeamBatch
+{
+ private:
+  std::vector<double> m_beam_waist_width;
+  std::vector<double> m_beam_waist_position;
+  std::vector<double> m_beam_quality_factor;
+  std::vector<double> m_vacuum_wavelength;
+  std::vector<double> m_refractive_index;
+  // derived parameters
+  std::vector<double> m_divergence;
+  std::vector<double> m_rayleigh_range;
+
+  void update(std::size_t a_i)
+  {
+    double wavelength     = m_vacuum_wavelength[a_i] / m_refractive_index[a_i];
+    m_divergence[a_i]     = m_beam_quality_factor[a_i] * wavelength / m_beam_waist_width[a_i] / M_PI;
+    m_rayleigh_range[a_i] = m_beam_waist_width[a_i] / m_divergence[a_i];
+  }
+
+  void check_index(std::size_t a_i) const
+  {
+    if(a_i >= this->size()) {
+      throw std::runtime_error("Beam index " + std::to_string(a_i) + " is out of range for batch of size " + std::to_string(this->size()) + ".");
+    }
+  }
+
+ public:
+  CircularGaussianBeamBatch() = default;
+  CircularGaussianBeamBatch(std::size_t a_size)
+  {
+    this->resize(a_size);
+  }
+
+  std::size_t size() const
+  {
+    return m_beam_waist_width.size();
+  }
+
+  void reserve(std::size_t a_size)
+  {
+    for(auto v : {&m_beam_waist_width, &m_beam_waist_position, &m_beam_quality_factor, &m_vacuum_wavelength, &m_refractive_index, &m_divergence, &m_rayleigh_range}) {
+      v->reserve(a_size);
+    }
+  }
+
+  /**
+   * Resize the batch. New beams are 532 nm, 1 mm diameter, diffraction limited beams
+   * with a waist at z = 0 so that all derived parameters are finite.
+   */
+  void resize(std::size_t a_size)
+  {
+    std::size_t old_size = this->size();
+    m_beam_waist_width.resize(a_size, 0.05);
+    m_beam_waist_position.resize(a_size, 0);
+    m_beam_quality_factor.resize(a_size, 1);
+    m_vacuum_wavelength.resize(a_size, 532e-7);
+    m_refractive_index.resize(a_size, 1);
+    m_divergence.resize(a_size);
+    m_rayleigh_range.resize(a_size);
+    for(std::size_t i = old_size; i < a_size; ++i) {
+      this->update(i);
+    }
+  }
+
+  /**
+   * Set the parameters for beam a_i.
+   *
+   * @param a_beam_waist_width : second moment (1/e^2 radius) waist width in cm
+   * @param a_beam_waist_position : waist position in cm
+   * @param a_beam_quality_factor : M^2
+   * @param a_vacuum_wavelength : vacuum wavelength in cm
+   * @param a_refractive_index : refractive index of the medium the beam is in
+   */
+  void setBeam(std::size_t a_i, double a_beam_waist_width, double a_beam_waist_position, double a_beam_quality_factor, double a_vacuum_wavelength, double a_refractive_index = 1)
+  {
+    this->check_index(a_i);
+    m_beam_waist_width[a_i]    = a_beam_waist_width;
+    m_beam_waist_position[a_i] = a_beam_waist_position;
+    m_beam_quality_factor[a_i] = a_beam_quality_factor;
+    m_vacuum_wavelength[a_i]   = a_vacuum_wavelength;
+    m_refractive_index[a_i]    = a_refractive_index;
+    this->update(a_i);
+  }
+
+  void setBeam(std::size_t a_i, const CircularGaussianLaserBeam& a_beam)
+  {
+    this->setBeam(a_i,
+                  a_beam.getSecondMomentBeamWaistWidth<t::cm>().value(),
+                  a_beam.getBeamWaistPosition<t::cm>().value(),
+                  a_beam.getBeamQualityFactor<t::dimensionless>().value(),
+                  a_beam.getVacuumWavelength<t::cm>().value(),
+                  a_beam.getRefractiveIndex<t::dimensionless>().value());
+  }
+
+  void push_back(const CircularGaussianLaserBeam& a_beam)
+  {
+    this->resize(this->size() + 1);
+    this->setBeam(this->size() - 1, a_beam);
+  }
+
+  /**
+   * Return beam a_i as a CircularGaussianLaserBeam.
+   */
+  CircularGaussianLaserBeam getBeam(std::size_t a_i) const
+  {
+    this->check_index(a_i);
+    CircularGaussianLaserBeam beam;
+    beam.setRefractiveIndex(m_refractive_index[a_i]);
+    beam.setVacuumWavelength(m_vacuum_wavelength[a_i] * i::cm);
+    beam.setSecondMomentBeamWaistWidth(m_beam_waist_width[a_i] * i::cm);
+    beam.setBeamWaistPosition(m_beam_waist_position[a_i] * i::cm);
+    beam.setBeamQualityFactor(m_beam_quality_factor[a_i] * i::dimensionless);
+    return beam;
+  }
+
+  std::span<const double> getBeamWaistWidths() const { return m_beam_waist_width; }
+  std::span<const double> getBeamWaistPositions() const { return m_beam_waist_position; }
+  std::span<const double> getBeamQualityFactors() const { return m_beam_quality_factor; }
+  std::span<const double> getVacuumWavelengths() const { return m_vacuum_wavelength; }
+  std::span<const double> getRefractiveIndices() const { return m_refractive_index; }
+  std::span<const double> getDivergences() const { return m_divergence; }
+  std::span<const double> getRayleighRanges() const { return m_rayleigh_range; }
+
+  /**
+   * Compute the beam width of beam a_i at each position in a_z.
+   */
+  void getBeamWidths(std::size_t a_i, std::span<const double> a_z, std::span<double> a_out) const
+  {
+    this->check_index(a_i);
+    check_sizes(a_z.size(), a_out.size());
+    simd::transform(a_z.size(), a_out.data(), width_kernel{}, a_z.data(), m_beam_waist_position[a_i], m_beam_waist_width[a_i], m_divergence[a_i]);
+  }
+  /**
+   * Compute the beam width of every beam at position a_z.
+   */
+  void getBeamWidths(double a_z, std::span<double> a_out) const
+  {
+    check_sizes(this->size(), a_out.size());
+    simd::transform(this->size(), a_out.data(), width_kernel{}, a_z, m_beam_waist_position.data(), m_beam_waist_width.data(), m_divergence.data());
+  }
+
+  /**
+   * Compute the radius of curvature of beam a_i at each position in a_z.
+   */
+  void getRadiiOfCurvature(std::size_t a_i, std::span<const double> a_z, std::span<double> a_out) const
+  {
+    this->check_index(a_i);
+    check_sizes(a_z.size(), a_out.size());
+    simd::transform(a_z.size(), a_out.data(), radius_of_curvature_kernel{}, a_z.data(), m_beam_waist_position[a_i], m_rayleigh_range[a_i]);
+  }
+  /**
+   * Compute the radius of curvature of every beam at position a_z.
+   */
+  void getRadiiOfCurvature(double a_z, std::span<double> a_out) const
+  {
+    check_sizes(this->size(), a_out.size());
+    simd::transform(this->size(), a_out.data(), radius_of_curvature_kernel{}, a_z, m_beam_waist_position.data(), m_rayleigh_range.data());
+  }
+
+  /**
+   * Compute the Gouy phase of beam a_i at each position in a_z.
+   */
+  void getGouyPhases(std::size_t a_i, std::span<const double> a_z, std::span<double> a_out) const
+  {
+    this->check_index(a_i);
+    check_sizes(a_z.size(), a_out.size());
+    simd::transform(a_z.size(), a_out.data(), gouy_phase_kernel{}, a_z.data(), m_beam_waist_position[a_i], m_rayleigh_range[a_i]);
+  }
+  /**
+   * Compute the Gouy phase of every beam at position a_z.
+   */
+  void getGouyPhases(double a_z, std::span<double> a_out) const
+  {
+    check_sizes(this->size(), a_out.size());
+    simd::transform(this->size(), a_out.data(), gouy_phase_kernel{}, a_z, m_beam_waist_position.data(), m_rayleigh_range.data());
+  }
+
+  /**
+   * Compute the complex beam parameter of beam a_i at each position in a_z.
+   * The real and imaginary parts are written to separate arrays.
+   */
+  void getComplexBeamParameters(std::size_t a_i, std::span<const double> a_z, std::span<double> a_real, std::span<double> a_imag) const
+  {
+    this->check_index(a_i);
+    check_sizes(a_z.size(), a_real.size());
+    check_sizes(a_z.size(), a_imag.size());
+    simd::transform(a_z.size(), a_real.data(), difference_kernel{}, a_z.data(), m_beam_waist_position[a_i]);
+    std::fill(a_imag.begin(), a_imag.end(), m_rayleigh_range[a_i]);
+  }
+  /**
+   * Compute the complex beam parameter of every beam at position a_z.
+   * The real and imaginary parts are written to separate arrays.
+   */
+  void getComplexBeamParameters(double a_z, std::span<double> a_real, std::span<double> a_imag) const
+  {
+    check_sizes(this->size(), a_real.size());
+    check_sizes(this->size(), a_imag.size());
+    simd::transform(this->size(), a_real.data(), difference_kernel{}, a_z, m_beam_waist_position.data());
+    std::copy(m_rayleigh_range.begin(), m_rayleigh_range.end(), a_imag.begin());
+  }
+
+ private:
+  static void check_sizes(std::size_t a_expected, std::size_t a_actual)
+  {
+    if(a_expected != a_actual) {
+      throw std::runtime_error("Output array has size " + std::to_string(a_actual) + ", but " + std::to_string(a_expected) + " values will be computed.");
+    }
+  }
+
+  // the kernels. each is called with either simd::batch or double arguments.
+  struct width_kernel {
+    template<typename V>
+    V operator()(const V& z, const V& z0, const V& w0, const V& theta) const
+    {
+      using std::sqrt;
+      V dz = z - z0;
+      return sqrt(w0 * w0 + theta * theta * dz * dz);
+    }
+  };
+  struct radius_of_curvature_kernel {
+    template<typename V>
+    V operator()(const V& z, const V& z0, const V& zR) const
+    {
+      V dz = z - z0;
+      V r  = zR / dz;
+      return dz * (1.0 + r * r);
+    }
+  };
+  struct gouy_phase_kernel {
+    template<typename V>
+    V operator()(const V& z, const V& z0, const V& zR) const
+    {
+      using std::atan;
+      return atan((z - z0) / zR);
+    }
+  };
+  struct difference_kernel {
+    template<typename V>
+    V operator()(const V& z, const V& z0) const
+    {
+      return z - z0;
+    }
+  };
+};
+
+}  // namespace libGBP2
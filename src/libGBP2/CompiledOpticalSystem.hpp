@@ -0,0 +1,208 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "./OpticalElements/FreeSpace.hpp"
+#include "./OpticalElements/OpticalElement.hpp"
+#include "./OpticalSystem.hpp"
+
+namespace libGBP2
+{
+
+/**
+ * A "compiled" view of an OpticalSystem for fast, repeated builds.
+ *
+ * OpticalSystem::build(...) composes every element between the start and end
+ * positions each time it is called. When the same system is evaluated at many
+ * positions, almost all of that work is repeated. This class walks the system once
+ * and stores the cumulative product (ray transfer matrix, displacement, and refractive
+ * index scale) at each element, so that a build starting in front of the first element
+ * only needs a binary search and a couple of 2x2 products. Builds that start inside the
+ * system are composed from stored products of 1, 2, 4, ... consecutive elements, so they
+ * need at most log2(M) products. Products are never divided out with an inverse, which
+ * loses precision for long chains of strong elements.
+ *
+ * The view is a snapshot. Elements added to the OpticalSystem after it was compiled
+ * are not seen.
+ */
+template<c::Length LengthUnit = t::cm>
+class CompiledOpticalSystem
+{
+ public:
+  using L = LengthUnit;
+
+ private:
+  static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+  // copy of the system's elements, sorted by position.
+  std::vector<quantity<L>>       m_positions;
+  std::vector<OpticalElement<L>> m_elements;
+
+  // Walking the system from the first element does not necessarily visit every element.
+  // Any element that sits inside of the displacement of a previous element (i.e. inside
+  // of a thick lens) is skipped by OpticalSystem::build. The elements that _are_ visited
+  // form a chain, and the cumulative products are stored for each link in the chain.
+  //
+  // m_link[i] is the chain index for element i, or npos if the element is not in the chain.
+  std::vector<std::size_t>       m_link;
+  std::vector<quantity<L>>       m_link_positions;
+  std::vector<quantity<L>>       m_link_exits;  // position + displacement of the link element
+  std::vector<OpticalElement<L>> m_link_elements;
+  std::vector<OpticalElement<L>> m_cumulative;  // product of links 0..k, starting at the first link
+
+  // m_jumps[j][k] propagates from the exit of link k through link k + 2^j.
+  std::vector<std::vector<OpticalElement<L>>> m_jumps;
+
+  /**
+   * Build by walking the elements, starting at element a_first. This is the
+   * same algorithm used by OpticalSystem::build and is only used when the start
+   * position falls on an element that is not in the chain.
+   */
+  template<c::Length UR>
+  OpticalElement<UR> walk(std::size_t a_first, quantity<L> a_z_start, quantity<L> a_z_end) const
+  {
+    quantity<L>        l_z = a_z_start;
+    OpticalElement<UR> system;
+    for(std::size_t i = a_first; i < m_positions.size(); ++i) {
+      if(m_positions[i] > a_z_end) {
+        break;
+      }
+      if(m_positions[i] >= l_z) {
+        system = m_elements[i] * FreeSpace(m_positions[i] - l_z) * system;
+        l_z    = m_positions[i] + m_elements[i].template getDisplacement<L>();
+      }
+    }
+    system = FreeSpace(a_z_end - l_z) * system;
+    return system;
+  }
+
+ public:
+  CompiledOpticalSystem() = default;
+
+  template<c::Length U>
+  CompiledOpticalSystem(const OpticalSystem<U> &a_system)
+  {
+    this->compile(a_system);
+  }
+
+  /**
+   * Compute the cumulative products for a system. Any previously compiled system is discarded.
+   */
+  template<c::Length U>
+  void compile(const OpticalSystem<U> &a_system)
+  {
+    m_positions.clear();
+    m_elements.clear();
+    m_link.clear();
+    m_link_positions.clear();
+    m_link_exits.clear();
+    m_link_elements.clear();
+    m_cumulative.clear();
+    m_jumps.assign(1, {});
+
+    for(const auto &elem : a_system.getElements()) {
+      m_positions.push_back(quantity<L>(elem.first));
+      m_elements.push_back(OpticalElement<L>(elem.second));
+    }
+
+    OpticalElement<L> cumulative;
+    for(std::size_t i = 0; i < m_positions.size(); ++i) {
+      if(m_link_exits.size() > 0 && m_positions[i] < m_link_exits.back()) {
+        m_link.push_back(npos);
+        continue;
+      }
+      if(m_link_exits.size() > 0) {
+        m_jumps[0].push_back(m_elements[i] * FreeSpace(m_positions[i] - m_link_exits.back()));
+        cumulative = m_jumps[0].back() * cumulative;
+      } else {
+        cumulative = m_elements[i];
+      }
+      m_link.push_back(m_cumulative.size());
+      m_link_positions.push_back(m_positions[i]);
+      m_link_exits.push_back(m_positions[i] + m_elements[i].template getDisplacement<L>());
+      m_link_elements.push_back(m_elements[i]);
+      m_cumulative.push_back(cumulative);
+    }
+
+    for(std::size_t j = 1; (std::size_t(1) << j) < m_cumulative.size(); ++j) {
+      m_jumps.emplace_back();
+      const auto &half = m_jumps[j - 1];
+      std::size_t step = std::size_t(1) << (j - 1);
+      for(std::size_t k = 0; k + 2 * step < m_cumulative.size(); ++k) {
+        m_jumps[j].push_back(half[k + step] * half[k]);
+      }
+    }
+  }
+
+  /**
+   * Return the number of elements in the compiled system.
+   */
+  std::size_t size() const
+  {
+    return m_positions.size();
+  }
+
+  /**
+   * Build an optical element that will propagate a beam
+   * from a position a_z_start to a position a_z_end in the system.
+   *
+   * Gives the same result as OpticalSystem::build(a_z_start, a_z_end).
+   */
+  template<c::Length UR = L, c::Length UA1 = L, c::Length UA2 = L>
+  OpticalElement<UR> build(quantity<UA1> a_z_start, quantity<UA2> a_z_end) const
+  {
+    quantity<L> z_start = quantity<L>(a_z_start);
+    quantity<L> z_end   = quantity<L>(a_z_end);
+
+    // first element at-or-after the start position
+    std::size_t first = std::lower_bound(m_positions.begin(), m_positions.end(), z_start) - m_positions.begin();
+    if(first == m_positions.size() || m_positions[first] > z_end) {
+      // no elements in the range, just free space
+      return FreeSpace(z_end - z_start);
+    }
+    std::size_t k = m_link[first];
+    if(k == npos) {
+      return this->walk<UR>(first, z_start, z_end);
+    }
+    // last link at-or-before the end position. there is at least one (link k).
+    std::size_t e = std::upper_bound(m_link_positions.begin() + k, m_link_positions.end(), z_end) - m_link_positions.begin() - 1;
+
+    OpticalElement<L> system;
+    if(k == 0) {
+      system = m_cumulative[e] * FreeSpace(m_link_positions[0] - z_start);
+    } else {
+      system = m_link_elements[k] * FreeSpace(m_link_positions[k] - z_start);
+      // carry the product from link k to link e in power of two jumps
+      for(std::size_t j = 0, n = e - k; n > 0; ++j, n >>= 1) {
+        if(n & 1) {
+          system = m_jumps[j][k] * system;
+          k += std::size_t(1) << j;
+        }
+      }
+    }
+    return FreeSpace(z_end - m_link_exits[e]) * system;
+  }
+  /**
+   * Build an optical element that will propagate a beam
+   * from a position of the first element in the system
+   * to a position a_z_end in the system.
+   */
+  template<c::Length UR = L, c::Length UA = L>
+  OpticalElement<UR> build(quantity<UA> a_z_end) const
+  {
+    return this->build<UR>(m_positions.size() > 0 ? m_positions[0] : 0 * i::cm, a_z_end);
+  }
+  /**
+   * Build an optical element that will propagate a beam
+   * from a position of the first element in the system
+   * to the position last element in the system.
+   */
+  template<c::Length UR = L>
+  OpticalElement<UR> build() const
+  {
+    return this->build<UR>(m_positions.size() > 0 ? m_positions[m_positions.size() - 1] : 0 * i::cm);
+  }
+};
+}  // namespace libGBP2
@@ -0,0 +1,424 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "./OpticalElements/OpticalElement.hpp"
+#include "./OpticalElements/RayTransferKernel.hpp"
+#include "./OpticalSystem.hpp"
+
+namespace libGBP2
+{
+
+/**
+ * An optical system that supports fast edits.
+ *
+ * OpticalSystem::build(...) composes every element in the system on each call, so changing
+ * one element (during an optimization for example) requires rebuilding the whole product.
+ * This class keeps the elements in a balanced binary search tree (a treap) ordered by position,
+ * and each node stores the product of the elements in its subtree. Inserting, removing,
+ * moving, or replacing an element only needs to recompute the products along one path
+ * in the tree, which is O(log M) for M elements. Building the element between two positions
+ * is also O(log M).
+ *
+ * To make products of subtrees independent of where the subtree starts, each element at position z
+ * with displacement d is stored in the fixed frame z = 0 as
+ *
+ *   T = FreeSpace(-(z + d)) * element * FreeSpace(z)
+ *
+ * so that the product of the elements between z0 and z1 is FreeSpace(z1) * T_n * ... * T_1 * FreeSpace(-z0).
+ *
+ * OpticalSystem::build(...) skips elements that sit inside of the displacement of a previous element.
+ * That can't be represented by a product, so elements are not allowed to overlap here. Inserting an element
+ * that would overlap another one throws a std::runtime_error.
+ *
+ * Elements are identified by the handle returned when they are inserted. Handles remain valid
+ * until the element is removed.
+ */
+template<c::Length LengthUnit = t::cm>
+class EditableOpticalSystem
+{
+ public:
+  using L      = LengthUnit;
+  using Handle = std::size_t;
+
+ private:
+  static constexpr std::size_t null = static_cast<std::size_t>(-1);
+
+  struct Node {
+    // key. elements at the same position are ordered by insertion
+    double        position;
+    std::uint64_t sequence;
+    // data
+    OpticalElement<L>   element;
+    kernel::RayTransfer translated;  // the element in the z = 0 frame
+    kernel::RayTransfer product;     // product of all elements in the subtree
+    // tree
+    std::uint32_t priority;
+    std::size_t   left  = null;
+    std::size_t   right = null;
+    bool          used  = false;
+  };
+
+  std::vector<Node>        m_nodes;
+  std::vector<std::size_t> m_free;
+  std::size_t              m_root     = null;
+  std::size_t              m_size     = 0;
+  std::uint64_t            m_sequence = 0;
+  std::minstd_rand         m_random;
+
+  static bool less(double a_position, std::uint64_t a_sequence, const Node& a_node)
+  {
+    return a_position < a_node.position || (a_position == a_node.position && a_sequence < a_node.sequence);
+  }
+
+  kernel::RayTransfer product(std::size_t a_node) const
+  {
+    return a_node == null ? kernel::RayTransfer{} : m_nodes[a_node].product;
+  }
+  void update(std::size_t a_node)
+  {
+    Node& node = m_nodes[a_node];
+    // elements to the right are further down the system, so they are applied last
+    node.product = kernel::compose(this->product(node.right), kernel::compose(node.translated, this->product(node.left)));
+  }
+  static kernel::RayTransfer translate(const OpticalElement<L>& a_element, double a_position)
+  {
+    const auto& k = a_element.getRayTransferKernel();
+    return kernel::compose(kernel::free_space(-(a_position + k.displacement)), kernel::compose(k, kernel::free_space(a_position)));
+  }
+
+  // split the tree into nodes that are before the key and nodes that are at-or-after it
+  void split(std::size_t a_node, double a_position, std::uint64_t a_sequence, std::size_t& a_left, std::size_t& a_right)
+  {
+    if(a_node == null) {
+      a_left = a_right = null;
+      return;
+    }
+    if(less(a_position, a_sequence, m_nodes[a_node]) || (a_position == m_nodes[a_node].position && a_sequence == m_nodes[a_node].sequence)) {
+      this->split(m_nodes[a_node].left, a_position, a_sequence, a_left, m_nodes[a_node].left);
+      a_right = a_node;
+    } else {
+      this->split(m_nodes[a_node].right, a_position, a_sequence, m_nodes[a_node].right, a_right);
+      a_left = a_node;
+    }
+    this->update(a_node);
+  }
+  std::size_t merge(std::size_t a_left, std::size_t a_right)
+  {
+    if(a_left == null) {
+      return a_right;
+    }
+    if(a_right == null) {
+      return a_left;
+    }
+    if(m_nodes[a_left].priority > m_nodes[a_right].priority) {
+      m_nodes[a_left].right = this->merge(m_nodes[a_left].right, a_right);
+      this->update(a_left);
+      return a_left;
+    }
+    m_nodes[a_right].left = this->merge(a_left, m_nodes[a_right].left);
+    this->update(a_right);
+    return a_right;
+  }
+  // recompute the products on the path to a node after it has been modified
+  void update_path(std::size_t a_node, std::size_t a_target)
+  {
+    if(a_node == a_target) {
+      this->update(a_node);
+      return;
+    }
+    const Node& target = m_nodes[a_target];
+    this->update_path(less(target.position, target.sequence, m_nodes[a_node]) ? m_nodes[a_node].left : m_nodes[a_node].right, a_target);
+    this->update(a_node);
+  }
+
+  // product of all elements in a subtree at-or-after / at-or-before a position
+  kernel::RayTransfer product_after(std::size_t a_node, double a_z) const
+  {
+    if(a_node == null) {
+      return {};
+    }
+    const Node& node = m_nodes[a_node];
+    if(node.position < a_z) {
+      return this->product_after(node.right, a_z);
+    }
+    return kernel::compose(this->product(node.right), kernel::compose(node.translated, this->product_after(node.left, a_z)));
+  }
+  kernel::RayTransfer product_before(std::size_t a_node, double a_z) const
+  {
+    if(a_node == null) {
+      return {};
+    }
+    const Node& node = m_nodes[a_node];
+    if(node.position > a_z) {
+      return this->product_before(node.left, a_z);
+    }
+    return kernel::compose(this->product_before(node.right, a_z), kernel::compose(node.translated, this->product(node.left)));
+  }
+  kernel::RayTransfer product_between(std::size_t a_node, double a_z0, double a_z1) const
+  {
+    if(a_node == null) {
+      return {};
+    }
+    const Node& node = m_nodes[a_node];
+    if(node.position < a_z0) {
+      return this->product_between(node.right, a_z0, a_z1);
+    }
+    if(node.position > a_z1) {
+      return this->product_between(node.left, a_z0, a_z1);
+    }
+    return kernel::compose(this->product_before(node.right, a_z1), kernel::compose(node.translated, this->product_after(node.left, a_z0)));
+  }
+
+  // the nearest element before/after a key, skipping over a_ignore.
+  std::size_t predecessor(double a_position, std::uint64_t a_sequence, std::size_t a_ignore) const
+  {
+    std::size_t result = null;
+    std::size_t node   = m_root;
+    while(node != null) {
+      if(less(a_position, a_sequence, m_nodes[node]) || (a_position == m_nodes[node].position && a_sequence == m_nodes[node].sequence)) {
+        node = m_nodes[node].left;
+      } else {
+        result = node;
+        node   = m_nodes[node].right;
+      }
+    }
+    if(result != null && result == a_ignore) {
+      return this->predecessor(m_nodes[result].position, m_nodes[result].sequence, null);
+    }
+    return result;
+  }
+  std::size_t successor(double a_position, std::uint64_t a_sequence, std::size_t a_ignore) const
+  {
+    std::size_t result = null;
+    std::size_t node   = m_root;
+    while(node != null) {
+      if(less(a_position, a_sequence, m_nodes[node])) {
+        result = node;
+        node   = m_nodes[node].left;
+      } else {
+        node = m_nodes[node].right;
+      }
+    }
+    if(result != null && result == a_ignore) {
+      return this->successor(m_nodes[result].position, m_nodes[result].sequence, null);
+    }
+    return result;
+  }
+
+  // throw if an element at a_position with displacement a_displacement would overlap its neighbors
+  void check_overlap(double a_position, std::uint64_t a_sequence, double a_displacement, std::size_t a_ignore) const
+  {
+    std::size_t before = this->predecessor(a_position, a_sequence, a_ignore);
+    if(before != null) {
+      double end = m_nodes[before].position + m_nodes[before].element.getRayTransferKernel().displacement;
+      if(a_position < end) {
+        throw std::runtime_error("Element at position " + std::to_string(a_position) + " cm would be inside of the element at position " + std::to_string(m_nodes[before].position) + " cm, which extends to " + std::to_string(end) + " cm. Elements in an EditableOpticalSystem cannot overlap.");
+      }
+    }
+    std::size_t after = this->successor(a_position, a_sequence, a_ignore);
+    if(after != null) {
+      if(m_nodes[after].position < a_position + a_displacement) {
+        throw std::runtime_error("Element at position " + std::to_string(a_position) + " cm extends to " + std::to_string(a_position + a_displacement) + " cm, which would contain the element at position " + std::to_string(m_nodes[after].position) + " cm. Elements in an EditableOpticalSystem cannot overlap.");
+      }
+    }
+  }
+
+  std::size_t find(Handle a_handle) const
+  {
+    if(a_handle >= m_nodes.size() || !m_nodes[a_handle].used) {
+      throw std::runtime_error("Invalid handle " + std::to_string(a_handle) + " for EditableOpticalSystem.");
+    }
+    return a_handle;
+  }
+
+  void link(std::size_t a_node)
+  {
+    Node&       node = m_nodes[a_node];
+    std::size_t left, right;
+    this->split(m_root, node.position, node.sequence, left, right);
+    m_root = this->merge(this->merge(left, a_node), right);
+  }
+  void unlink(std::size_t a_node)
+  {
+    Node&       node = m_nodes[a_node];
+    std::size_t left, middle, right;
+    this->split(m_root, node.position, node.sequence, left, middle);
+    // middle starts with the node
+    this->split(middle, node.position, node.sequence + 1, middle, right);
+    node.left  = null;
+    node.right = null;
+    m_root     = this->merge(left, right);
+  }
+
+ public:
+  EditableOpticalSystem() = default;
+
+  /**
+   * Create an editable system with the same elements as an OpticalSystem.
+   * Throws if any of the elements overlap.
+   */
+  template<c::Length U>
+  EditableOpticalSystem(const OpticalSystem<U>& a_system)
+  {
+    for(const auto& elem : a_system.getElements()) {
+      this->insert(elem.first, elem.second);
+    }
+  }
+
+  std::size_t size() const
+  {
+    return m_size;
+  }
+
+  /**
+   * Add an element to the system at a given position and return a handle to it.
+   */
+  template<c::Length U1, c::Length U2>
+  Handle insert(quantity<U1> a_z, const OpticalElement<U2>& a_element)
+  {
+    double            position = quantity<t::cm>(a_z).value();
+    OpticalElement<L> element(a_element);
+    this->check_overlap(position, m_sequence, element.getRayTransferKernel().displacement, null);
+
+    std::size_t n;
+    if(m_free.size() > 0) {
+      n = m_free.back();
+      m_free.pop_back();
+    } else {
+      n = m_nodes.size();
+      m_nodes.emplace_back();
+    }
+    Node& node      = m_nodes[n];
+    node.position   = position;
+    node.sequence   = m_sequence++;
+    node.element    = element;
+    node.translated = translate(element, position);
+    node.product    = node.translated;
+    node.priority   = static_cast<std::uint32_t>(m_random());
+    node.left       = null;
+    node.right      = null;
+    node.used       = true;
+    this->link(n);
+    ++m_size;
+    return n;
+  }
+
+  /**
+   * Remove an element from the system. The handle is invalid after this.
+   */
+  void remove(Handle a_handle)
+  {
+    std::size_t n = this->find(a_handle);
+    this->unlink(n);
+    m_nodes[n].used = false;
+    m_free.push_back(n);
+    --m_size;
+  }
+
+  /**
+   * Replace an element in the system, keeping its position.
+   */
+  template<c::Length U>
+  void replace(Handle a_handle, const OpticalElement<U>& a_element)
+  {
+    std::size_t       n = this->find(a_handle);
+    OpticalElement<L> element(a_element);
+    this->check_overlap(m_nodes[n].position, m_nodes[n].sequence, element.getRayTransferKernel().displacement, n);
+    m_nodes[n].element    = element;
+    m_nodes[n].translated = translate(element, m_nodes[n].position);
+    this->update_path(m_root, n);
+  }
+
+  /**
+   * Move an element in the system to a new position.
+   */
+  template<c::Length U>
+  void move(Handle a_handle, quantity<U> a_z)
+  {
+    std::size_t n        = this->find(a_handle);
+    double      position = quantity<t::cm>(a_z).value();
+    this->check_overlap(position, m_sequence, m_nodes[n].element.getRayTransferKernel().displacement, n);
+    this->unlink(n);
+    m_nodes[n].position   = position;
+    m_nodes[n].sequence   = m_sequence++;
+    m_nodes[n].translated = translate(m_nodes[n].element, position);
+    m_nodes[n].product    = m_nodes[n].translated;
+    this->link(n);
+  }
+
+  /**
+   * Return the element for a handle.
+   */
+  const OpticalElement<L>& getElement(Handle a_handle) const
+  {
+    return m_nodes[this->find(a_handle)].element;
+  }
+
+  /**
+   * Return the position of the element for a handle.
+   */
+  template<c::Length U = L>
+  quantity<U> getPosition(Handle a_handle) const
+  {
+    return quantity<U>(quantity<t::cm>::from_value(m_nodes[this->find(a_handle)].position));
+  }
+
+  /**
+   * Build an optical element that will propagate a beam
+   * from a position a_z_start to a position a_z_end in the system.
+   *
+   * Gives the same result as OpticalSystem::build(a_z_start, a_z_end).
+   */
+  template<c::Length UR = L, c::Length UA1 = L, c::Length UA2 = L>
+  OpticalElement<UR> build(quantity<UA1> a_z_start, quantity<UA2> a_z_end) const
+  {
+    double z0 = quantity<t::cm>(a_z_start).value();
+    double z1 = quantity<t::cm>(a_z_end).value();
+    auto system = kernel::compose(kernel::free_space(z1), kernel::compose(this->product_between(m_root, z0, z1), kernel::free_space(-z0)));
+    return OpticalElement<UR>(system);
+  }
+  /**
+   * Build an optical element that will propagate a beam
+   * from a position of the first element in the system
+   * to a position a_z_end in the system.
+   */
+  template<c::Length UR = L, c::Length UA = L>
+  OpticalElement<UR> build(quantity<UA> a_z_end) const
+  {
+    return this->build<UR>(quantity<t::cm>::from_value(this->first_position()), a_z_end);
+  }
+  /**
+   * Build an optical element that will propagate a beam
+   * from a position of the first element in the system
+   * to the position last element in the system.
+   */
+  template<c::Length UR = L>
+  OpticalElement<UR> build() const
+  {
+    return this->build<UR>(quantity<t::cm>::from_value(this->last_position()));
+  }
+
+ private:
+  double first_position() const
+  {
+    std::size_t node = m_root;
+    while(node != null && m_nodes[node].left != null) {
+      node = m_nodes[node].left;
+    }
+    return node == null ? 0 : m_nodes[node].position;
+  }
+  double last_position() const
+  {
+    std::size_t node = m_root;
+    while(node != null && m_nodes[node].right != null) {
+      node = m_nodes[node].right;
+    }
+    return node == null ? 0 : m_nodes[node].position;
+  }
+};
+}  // namespace libGBP2
@@ -6,6 +6,94 @@ namespace libGBP2
 {
 namespace msg
 {
+auto UnitScaleCache::find_or_compute(const KeyView& a_key, ComputeFunction a_compute) -> Entry
+{
+  {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    auto                                it = m_entries.find(a_key);
+    if(it != m_entries.end()) {
+      ++m_hits;
+      return it->second;
+    }
+  }
+  std::unique_lock<std::shared_mutex> lock(m_mutex);
+  ++m_misses;
+  auto it = m_entries.find(a_key);
+  if(it == m_entries.end()) {
+    it = m_entries.emplace(Key{a_key.type, a_key.type_hash, std::string(a_key.from), std::string(a_key.to)}, a_compute(a_key)).first;
+  }
+  return it->second;
+}
+
+auto UnitScaleCache::lookup(const KeyView& a_key, ComputeFunction a_compute) -> Entry
+{
+  // reading the clock costs about as much as a cache hit, so only a sample of the lookups are timed.
+  static thread_local unsigned calls = 0;
+  if(calls++ % lookup_time_sample_period != 0) {
+    return this->find_or_compute(a_key, a_compute);
+  }
+  auto  start = std::chrono::steady_clock::now();
+  Entry entry = this->find_or_compute(a_key, a_compute);
+  m_timed_lookup += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  ++m_timed;
+  return entry;
+}
+
+auto UnitScaleCache::compute_string_scale(const KeyView& a_key) -> Entry
+{
+  auto&       ureg = UnitConvert::getGlobalUnitRegistry();
+  std::string from(a_key.from), to(a_key.to);
+  return Entry{ureg.makeQuantity<double>(1, from).to(to).value(), ureg.makeQuantity<double>(0, from).to(to).value() == 0};
+}
+
+std::optional<double> UnitScaleCache::getScale(const std::string& a_from, const std::string& a_to)
+{
+  static const std::size_t type_hash = typeid(std::string).hash_code();
+  auto                     entry     = this->lookup({typeid(std::string), type_hash, a_from, a_to}, &compute_string_scale);
+  return entry.linear ? std::optional<double>(entry.scale) : std::nullopt;
+}
+
+double UnitScaleCache::convert(double a_value, const std::string& a_from, const std::string& a_to)
+{
+  if(auto scale = this->getScale(a_from, a_to)) {
+    return a_value * *scale;
+  }
+  std::unique_lock<std::shared_mutex> lock(m_mutex);
+  return UnitConvert::getGlobalUnitRegistry().makeQuantity<double>(a_value, a_from).to(a_to).value();
+}
+
+auto UnitScaleCache::getStats() const -> Stats
+{
+  Stats stats;
+  stats.hits   = m_hits;
+  stats.misses = m_misses;
+  if(std::size_t timed = m_timed; timed > 0) {
+    // scale the sampled time up to all of the lookups
+    stats.lookup_time = std::chrono::nanoseconds(static_cast<std::int64_t>(static_cast<double>(m_timed_lookup) * (stats.hits + stats.misses) / timed));
+  }
+  return stats;
+}
+
+void UnitScaleCache::resetStats()
+{
+  m_hits        = 0;
+  m_misses      = 0;
+  m_timed        = 0;
+  m_timed_lookup = 0;
+}
+
+void UnitScaleCache::clear()
+{
+  std::unique_lock<std::shared_mutex> lock(m_mutex);
+  m_entries.clear();
+}
+
+UnitScaleCache& get_unit_scale_cache()
+{
+  static UnitScaleCache cache;
+  return cache;
+}
+
 /**
  * Convert a Quantity message to a different unit.
  */
@@ -14,9 +102,7 @@ void convert(msg::Quantity& a_quantity, std::string a_unit)
   if(a_quantity.unit() == a_unit)
     return;
 
-  static auto& ureg = UnitConvert::getGlobalUnitRegistry();
-  auto         q    = ureg.makeQuantity<double>(a_quantity.value(), a_quantity.unit()).to(a_unit);
-  a_quantity.set_value(q.value());
+  a_quantity.set_value(get_unit_scale_cache().convert(a_quantity.value(), a_quantity.unit(), a_unit));
   a_quantity.set_unit(a_unit);
 }
 
@@ -1,6 +1,18 @@
+#pragma once
 #define UNITCONVERT_NO_BACKWARD_COMPATIBLE_NAMESPACE
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <exception>
+#include <functional>
+#include <optional>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
 
 #include <boost/lexical_cast.hpp>
 
@@ -33,10 +45,20 @@ std::string serialize_message(const MESSAGE_TYPE& a_protobuf_msg, serialization_
   }
   return serialized_msg;
 }
+/**
+ * Return the format of a serialized message. JSON messages start with '{', anything else is binary protobuf.
+ */
+inline serialization_format detect_serialization_format(const std::string& a_serialized_msg)
+{
+  if(a_serialized_msg.size() > 0 && a_serialized_msg[0] == '{') {
+    return serialization_format::JSON;
+  }
+  return serialization_format::PROTOBUF;
+}
 template<typename MESSAGE_TYPE>
 serialization_format deserialize_message(const std::string& a_serialized_msg, MESSAGE_TYPE& a_protobuf_msg)
 {
-  if(a_serialized_msg.size() > 0 && a_serialized_msg[0] == '{') {
+  if(detect_serialization_format(a_serialized_msg) == serialization_format::JSON) {
     google::protobuf::util::JsonParseOptions parse_options;
     auto                                     status = JsonStringToMessage(a_serialized_msg, &a_protobuf_msg, parse_options);
     if(!status.ok()) {
@@ -44,20 +66,246 @@ serialization_format deserialize_message(const std::string& a_serialized_msg, ME
     }
     return serialization_format::JSON;
   } else {
-    auto status = a_protobuf_msg.ParseFromString(a_serialized_msg);
+    if(!a_protobuf_msg.ParseFromString(a_serialized_msg)) {
+      throw std::runtime_error("Could not parse binary protobuf message.");
+    }
     return serialization_format::PROTOBUF;
   }
   return serialization_format::UNKNOWN;
 }
 
+/**
+ * Append an unsigned integer to a stream, encoded as a protobuf varint.
+ */
+inline void append_varint(std::uint64_t a_value, std::string& a_stream)
+{
+  while(a_value >= 0x80) {
+    a_stream.push_back(static_cast<char>((a_value & 0x7f) | 0x80));
+    a_value >>= 7;
+  }
+  a_stream.push_back(static_cast<char>(a_value));
+}
+/**
+ * Append a serialized message to a stream of messages, prefixed with its size as a varint.
+ * This is the same framing used by protobuf's writeDelimitedTo(...)/parseDelimitedFrom(...).
+ */
+inline void append_delimited(const std::string& a_msg, std::string& a_stream)
+{
+  append_varint(a_msg.size(), a_stream);
+  a_stream.append(a_msg);
+}
+/**
+ * Read the size prefix of a length-delimited message at the start of a_stream into a_size.
+ * Returns the number of bytes in the prefix, or 0 if a_stream ends before the end of the prefix.
+ */
+inline std::size_t read_delimited_size(std::string_view a_stream, std::size_t& a_size)
+{
+  a_size = 0;
+  for(std::size_t i = 0; i < a_stream.size(); ++i) {
+    if(i > 9) {
+      throw std::runtime_error("Invalid message size in stream.");
+    }
+    a_size |= static_cast<std::size_t>(a_stream[i] & 0x7f) << (7 * i);
+    if((a_stream[i] & 0x80) == 0) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+/**
+ * Read the next message from a stream of length-delimited messages and remove it from the stream.
+ * Returns false if the stream is empty.
+ */
+inline bool read_delimited(std::string_view& a_stream, std::string& a_msg)
+{
+  if(a_stream.size() == 0) {
+    return false;
+  }
+  std::size_t size;
+  std::size_t prefix = read_delimited_size(a_stream, size);
+  if(prefix == 0) {
+    throw std::runtime_error("Could not read message size from stream.");
+  }
+  a_stream.remove_prefix(prefix);
+  if(size > a_stream.size()) {
+    throw std::runtime_error("Stream ended in the middle of a message.");
+  }
+  a_msg.assign(a_stream.substr(0, size));
+  a_stream.remove_prefix(size);
+  return true;
+}
+
+/**
+ * A thread-safe cache of unit conversion scale factors.
+ *
+ * Parsing a unit string with the unit registry is expensive, and messages almost
+ * always use the same few units, so the factor to convert from a unit string
+ * to each target unit is only computed once. Conversions that are not a simple
+ * scale (i.e. temperatures with an offset) are not cached and fall back to the registry.
+ *
+ * The unit registry is only used while holding the cache lock, so conversions
+ * can be done from multiple threads.
+ */
+class UnitScaleCache
+{
+ public:
+  struct Stats {
+    std::size_t              hits   = 0;
+    std::size_t              misses = 0;
+    std::chrono::nanoseconds lookup_time{0};  // estimated total time spent in lookups, including computing new scale factors. only a sample of the lookups are timed.
+
+    double hitRate() const { return hits + misses > 0 ? static_cast<double>(hits) / (hits + misses) : 0; }
+  };
+
+ private:
+  struct Entry {
+    double scale  = 1;
+    bool   linear = true;
+  };
+  // entries are keyed on the target unit (a boost unit type, or a unit string stored in `to`) and the source unit string.
+  // lookups use KeyView so that nothing is allocated when the entry is found.
+  // type_hash is type.hash_code(), which hashes the (long) type name, so it is computed once per type.
+  struct KeyView {
+    std::type_index  type;
+    std::size_t      type_hash;
+    std::string_view from;
+    std::string_view to;
+  };
+  struct Key {
+    std::type_index type;
+    std::size_t     type_hash;
+    std::string     from;
+    std::string     to;
+
+    operator KeyView() const { return {type, type_hash, from, to}; }
+  };
+  struct KeyHash {
+    using is_transparent = void;
+    std::size_t operator()(const KeyView& a_key) const
+    {
+      std::size_t hash = a_key.type_hash;
+      hash ^= std::hash<std::string_view>()(a_key.from) + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+      hash ^= std::hash<std::string_view>()(a_key.to) + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+      return hash;
+    }
+    std::size_t operator()(const Key& a_key) const { return (*this)(static_cast<KeyView>(a_key)); }
+  };
+  struct KeyEqual {
+    using is_transparent = void;
+    bool operator()(const KeyView& a, const KeyView& b) const { return a.type == b.type && a.from == b.from && a.to == b.to; }
+  };
+  using ComputeFunction = Entry (*)(const KeyView&);
+
+  // one in this many lookups is timed for Stats::lookup_time
+  static constexpr unsigned lookup_time_sample_period = 64;
+
+  mutable std::shared_mutex                         m_mutex;
+  std::unordered_map<Key, Entry, KeyHash, KeyEqual> m_entries;
+  std::atomic<std::size_t>                          m_hits         = 0;
+  std::atomic<std::size_t>                          m_misses       = 0;
+  std::atomic<std::size_t>                          m_timed        = 0;  // number of lookups that were timed
+  std::atomic<std::int64_t>                         m_timed_lookup = 0;  // total time of the timed lookups
+
+  Entry lookup(const KeyView& a_key, ComputeFunction a_compute);
+  Entry find_or_compute(const KeyView& a_key, ComputeFunction a_compute);
+
+  template<typename U>
+  static Entry compute_scale(const KeyView& a_key)
+  {
+    auto&       ureg = UnitConvert::getGlobalUnitRegistry();
+    std::string unit(a_key.from);
+    return Entry{ureg.makeQuantity<double>(1, unit).template to<U>().value(), ureg.makeQuantity<double>(0, unit).template to<U>().value() == 0};
+  }
+  static Entry compute_string_scale(const KeyView& a_key);
+
+ public:
+  /**
+   * Return the factor to multiply a value in a_unit by to get a value in the boost unit U,
+   * or nothing if the conversion is not a simple scale.
+   */
+  template<typename U>
+  std::optional<double> getScale(std::string_view a_unit)
+  {
+    static const std::size_t type_hash = typeid(U).hash_code();
+    auto                     entry     = this->lookup({typeid(U), type_hash, a_unit, {}}, &compute_scale<U>);
+    return entry.linear ? std::optional<double>(entry.scale) : std::nullopt;
+  }
+  /**
+   * Return the factor to multiply a value in a_from by to get a value in a_to,
+   * or nothing if the conversion is not a simple scale.
+   */
+  std::optional<double> getScale(const std::string& a_from, const std::string& a_to);
+
+  /**
+   * Convert a value in a_unit to the boost unit U.
+   */
+  template<typename U>
+  double convert(double a_value, const std::string& a_unit)
+  {
+    if(auto scale = this->getScale<U>(a_unit)) {
+      return a_value * *scale;
+    }
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    return UnitConvert::getGlobalUnitRegistry().makeQuantity<double>(a_value, a_unit).to<U>().value();
+  }
+  /**
+   * Convert a value in a_from to a_to.
+   */
+  double convert(double a_value, const std::string& a_from, const std::string& a_to);
+
+  Stats getStats() const;
+  void  resetStats();
+  void  clear();
+};
+
+/**
+ * Return the global unit scale cache used by make_quantity(...) and convert(...).
+ */
+UnitScaleCache& get_unit_scale_cache();
+
 /**
  * Create a boost::unit::quantity from a msg::Quantity (protobuf message)
  */
 template<typename U>
 quantity<U> make_quantity(const msg::Quantity& a_Quantity)
 {
-  static auto& ureg = UnitConvert::getGlobalUnitRegistry();
-  return ureg.makeQuantity<double>(a_Quantity.value(), a_Quantity.unit()).to<U>();
+  return get_unit_scale_cache().convert<U>(a_Quantity.value(), a_Quantity.unit()) * U();
+}
+
+/**
+ * Create boost::unit::quantities from a list of msg::Quantity (protobuf messages).
+ * The scale factor is only looked up when the unit changes, so converting a list
+ * that uses one unit is a single multiply per element.
+ */
+template<typename U>
+std::vector<quantity<U>> make_quantities(const google::protobuf::RepeatedPtrField<msg::Quantity>& a_Quantities)
+{
+  std::vector<quantity<U>> quantities;
+  quantities.reserve(a_Quantities.size());
+  const std::string*    unit = nullptr;
+  std::optional<double> scale;
+  for(const auto& q : a_Quantities) {
+    if(unit == nullptr || q.unit() != *unit) {
+      unit  = &q.unit();
+      scale = get_unit_scale_cache().getScale<U>(*unit);
+    }
+    quantities.push_back((scale ? q.value() * *scale : get_unit_scale_cache().convert<U>(q.value(), *unit)) * U());
+  }
+  return quantities;
+}
+/**
+ * Create boost::unit::quantities from a msg::QuantityArray (protobuf message).
+ */
+template<typename U>
+std::vector<quantity<U>> make_quantities(const msg::QuantityArray& a_Quantities)
+{
+  std::vector<quantity<U>> quantities;
+  quantities.reserve(a_Quantities.values_size());
+  std::optional<double> scale = get_unit_scale_cache().getScale<U>(a_Quantities.unit());
+  for(double value : a_Quantities.values()) {
+    quantities.push_back((scale ? value * *scale : get_unit_scale_cache().convert<U>(value, a_Quantities.unit())) * U());
+  }
+  return quantities;
 }
 
 /**
@@ -136,11 +384,13 @@ GaussianBeamDivergence<C, U> make_beam_divergence(const msg::Quantity& a_diverge
   return divergence;
 }
 
+/**
+ * Return the width of a beam using the beam width convention a_type.
+ */
 template<typename C, typename U>
-msg::Quantity get_beam_width(const GaussianBeamWidth<C, U>& a_width, msg::BeamWidthType a_type)
+quantity<U> get_beam_width_quantity(const GaussianBeamWidth<C, U>& a_width, msg::BeamWidthType a_type)
 {
-  quantity<U>   width;
-  msg::Quantity width_msg;
+  quantity<U> width;
 
   switch(a_type) {
     case msg::BEAM_WIDTH_TYPE_ONE_OVER_E_SQUARED_RADIUS:
@@ -168,9 +418,14 @@ msg::Quantity get_beam_width(const GaussianBeamWidth<C, U>& a_width, msg::BeamWi
       throw std::runtime_error("Unknown beam width type. Did you add an additional convention to the message without adding it to the library?");
       break;
   }
+  return width;
+}
 
-  width_msg << boost::lexical_cast<std::string>(width);
-
+template<typename C, typename U>
+msg::Quantity get_beam_width(const GaussianBeamWidth<C, U>& a_width, msg::BeamWidthType a_type)
+{
+  msg::Quantity width_msg;
+  width_msg << boost::lexical_cast<std::string>(get_beam_width_quantity(a_width, a_type));
   return width_msg;
 }
 
@@ -233,3 +488,34 @@ libgbp2_message_api::Quantity* operator<<(libgbp2_message_api::Quantity* a_quant
   *a_quantity << boost::lexical_cast<std::string>(a_quantity2);
   return a_quantity;
 }
+
+namespace libGBP2
+{
+namespace msg
+{
+/**
+ * Return the unit string that is written to a msg::Quantity for quantities with unit U.
+ * This is the same string that operator<<(msg::Quantity&, quantity<U>) writes, but it is only formatted once.
+ */
+template<typename U>
+const std::string& get_unit_string()
+{
+  static const std::string unit = []() {
+    msg::Quantity q;
+    q << boost::lexical_cast<std::string>(quantity<U>::from_value(1));
+    return q.unit();
+  }();
+  return unit;
+}
+/**
+ * Set the value and unit of a msg::Quantity from a quantity without formatting and parsing a string.
+ * Gives the same result as operator<<(msg::Quantity*, quantity<U>).
+ */
+template<typename U>
+void set_quantity(msg::Quantity* a_msg, const quantity<U>& a_quantity)
+{
+  a_msg->set_value(a_quantity.value());
+  a_msg->set_unit(get_unit_string<U>());
+}
+}  // namespace msg
+}  // namespace libGBP2
@@ -4,14 +4,35 @@
 #include "libGBP2/Conventions.hpp"
 #include "libGBP2/Propagation.hpp"
 #define UNITCONVERT_NO_BACKWARD_COMPATIBLE_NAMESPACE
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <unistd.h>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
 #include <UnitConvert.hpp>
 #include <UnitConvert/GlobalUnitRegistry.hpp>
 
 #include "../CircularGaussianLaserBeam.hpp"
+#include "../CompiledOpticalSystem.hpp"
 #include "../OpticalElements/FlatRefractiveSurface.hpp"
 #include "../OpticalElements/FreeSpace.hpp"
 #include "../OpticalElements/OpticalElement.hpp"
@@ -19,6 +40,7 @@
 #include "../OpticalElements/ThickLens.hpp"
 #include "../OpticalElements/ThinLens.hpp"
 #include "../OpticalSystem.hpp"
+#include "../ThreadPool.hpp"
 #include "./Messages.hpp"
 #include "Messages.pb.h"
 #include "libGBP2/MessageAPI/Propagator.hpp"
@@ -26,6 +48,59 @@
 namespace libGBP2
 {
 struct Propagator::imp {
+  using Clock = std::chrono::steady_clock;
+  static std::uint64_t elapsed_ns(Clock::time_point a_start)
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - a_start).count();
+  }
+  /**
+   * Measures the time spent in consecutive phases of a call for msg::Timings.
+   * If timings were not requested, the clock is never read and lap() returns zero.
+   */
+  class Stopwatch
+  {
+    bool              m_enabled;
+    Clock::time_point m_start;
+
+   public:
+    explicit Stopwatch(bool a_enabled) : m_enabled(a_enabled)
+    {
+      if(m_enabled) {
+        m_start = Clock::now();
+      }
+    }
+    bool isEnabled() const { return m_enabled; }
+    /**
+     * Return the time since the last lap (or construction) in nanoseconds and start a new lap.
+     */
+    std::uint64_t lap()
+    {
+      if(!m_enabled) {
+        return 0;
+      }
+      auto          now = Clock::now();
+      std::uint64_t ns  = std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_start).count();
+      m_start           = now;
+      return ns;
+    }
+  };
+  /**
+   * Serialize an output message with its timings. The output is serialized once to measure the serialize
+   * time, and again with the serialize and total times filled in, so the timings describe the first pass.
+   * This doubles the serialization cost, but only for callers that ask for timings.
+   */
+  template<typename OUTPUT_MSG>
+  static std::string serialize_with_timings(OUTPUT_MSG* a_output, msg::serialization_format a_format, Clock::time_point a_start, std::uint64_t a_deserialize_ns)
+  {
+    auto timings = a_output->mutable_timings();
+    timings->set_deserialize_ns(a_deserialize_ns);
+    auto serialize_start = Clock::now();
+    msg::serialize_message(*a_output, a_format);
+    timings->set_serialize_ns(elapsed_ns(serialize_start));
+    timings->set_total_ns(elapsed_ns(a_start));
+    return msg::serialize_message(*a_output, a_format);
+  }
+
   CircularGaussianLaserBeam build_laser(const msg::CircularGaussianBeam& a_laser_msg) const
   {
     // validate
@@ -78,44 +153,470 @@ struct Propagator::imp {
 
     return system;
   }
-  void run(const msg::Propagator_run_Input& a_input, msg::Propagator_run_Output* a_output) const
+  /**
+   * Return the factor to multiply a length in cm by to get a length in a_unit.
+   */
+  static double length_scale(const std::string& a_unit)
+  {
+    auto scale = msg::get_unit_scale_cache().getScale("cm", a_unit);
+    if(!scale) {
+      throw std::runtime_error("Could not convert cm to " + a_unit + ".");
+    }
+    return *scale;
+  }
+  /**
+   * Return the output beam width type and unit. These default to the type and unit of the input beam waist width.
+   */
+  template<typename INPUT_MSG>
+  std::pair<msg::BeamWidthType, std::string> output_beam_width_config(const msg::CircularGaussianBeam& a_laser_msg, const INPUT_MSG& a_input) const
+  {
+    std::pair<msg::BeamWidthType, std::string> config(a_laser_msg.beam_waist_width_type(), a_laser_msg.beam_waist_width().unit());
+    if(a_input.has_output_beam_width_type()) {
+      config.first = a_input.output_beam_width_type();
+    }
+    if(a_input.has_output_beam_width_unit()) {
+      config.second = a_input.output_beam_width_unit();
+    }
+    return config;
+  }
+  /**
+   * Return the positions of a propagation input. They can be given as a list of quantities
+   * or as a quantity array, but not both.
+   */
+  template<typename INPUT_MSG>
+  static std::vector<quantity<t::cm>> make_positions(const INPUT_MSG& a_input)
+  {
+    if(a_input.has_positions_array()) {
+      if(a_input.positions_size() > 0) {
+        throw std::runtime_error("Both positions and positions_array were given. Only one or the other can be set.");
+      }
+      return msg::make_quantities<t::cm>(a_input.positions_array());
+    }
+    return msg::make_quantities<t::cm>(a_input.positions());
+  }
+  /**
+   * Write propagated beams to an output message. Widths are converted from cm to a_width_unit with a_width_scale,
+   * which does not use the unit registry, so this can be called from multiple threads.
+   *
+   * If a_array is true, the widths are written to beam_widths_array instead of beam_widths.
+   *
+   * Values are written directly instead of going through a quantity string, and the repeated fields
+   * are reserved up front, so the only allocations are the submessages themselves (which are on
+   * the output message's arena if it has one).
+   */
+  template<typename OUTPUT_MSG>
+  void write_beams(const std::vector<CircularGaussianLaserBeam>& a_beams, msg::BeamWidthType a_width_type, const std::string& a_width_unit, double a_width_scale, bool a_full, bool a_array, OUTPUT_MSG* a_output) const
+  {
+    msg::QuantityArray* widths_array = nullptr;
+    if(a_array) {
+      widths_array = a_output->mutable_beam_widths_array();
+      widths_array->set_unit(a_width_unit);
+      widths_array->mutable_values()->Reserve(widths_array->values_size() + a_beams.size());
+    } else {
+      a_output->mutable_beam_widths()->Reserve(a_output->beam_widths_size() + a_beams.size());
+    }
+    if(a_full) {
+      a_output->mutable_beams()->Reserve(a_output->beams_size() + a_beams.size());
+    }
+    for(auto& new_beam : a_beams) {
+      // extract the width using the specified beam width convention and convert it to the specified units
+      double width = msg::get_beam_width_quantity(new_beam.getBeamWidth(), a_width_type).value() * a_width_scale;
+      if(widths_array) {
+        widths_array->add_values(width);
+      } else {
+        auto width_msg = a_output->add_beam_widths();
+        width_msg->set_value(width);
+        width_msg->set_unit(a_width_unit);
+      }
+
+      if(a_full) {
+        auto ptr = a_output->add_beams();
+        msg::set_quantity(ptr->mutable_beam_waist_width(), msg::get_beam_width_quantity(new_beam.getBeamWaistWidth(), a_width_type));
+        ptr->set_beam_waist_width_type(a_width_type);
+        msg::set_quantity(ptr->mutable_beam_quality_factor(), new_beam.getBeamQualityFactor());
+        msg::set_quantity(ptr->mutable_beam_waist_position(), new_beam.getBeamWaistPosition());
+        msg::set_quantity(ptr->mutable_wavelength(), new_beam.getWavelength());
+      }
+    }
+  }
+  /**
+   * Run a propagation in chunks of a_chunk_size positions. Each chunk is written to a_chunk, and then a_emit is called.
+   * Everything that can fail is done before the first chunk is emitted, and at least one chunk is always emitted.
+   */
+  void run(const msg::Propagator_run_Input& a_input, std::size_t a_chunk_size, msg::Propagator_run_Output* a_chunk, const std::function<void(msg::Propagator_run_Output&)>& a_emit) const
   {
+    Stopwatch    stopwatch(a_input.return_timings());
+    msg::Timings timings;
     // build the laser
     auto beam = this->build_laser(a_input.beam());
+    timings.set_build_laser_ns(stopwatch.lap());
     // build the system
     auto optical_system = this->build_optical_system(a_input.optical_system());
+    timings.set_build_optical_system_ns(stopwatch.lap());
     // configure output
-    msg::BeamWidthType output_beam_width_type = a_input.beam().beam_waist_width_type();
-    std::string        output_beam_width_unit = a_input.beam().beam_waist_width().unit();
+    auto [output_beam_width_type, output_beam_width_unit] = this->output_beam_width_config(a_input.beam(), a_input);
+    auto output_beam_width_scale                          = length_scale(output_beam_width_unit);
+    auto positions                                        = make_positions(a_input);
+    timings.set_convert_ns(stopwatch.lap());
+
+    std::size_t first = 0;
+    do {
+      std::size_t count = std::min(a_chunk_size, positions.size() - first);
+      a_chunk->Clear();
+      a_chunk->mutable_return_status();
+      // propagate through system to all positions in the chunk in one pass
+      auto new_beams = propagate_beam_through_system(beam, optical_system, std::span(positions).subspan(first, count));
+      timings.set_propagate_ns(stopwatch.lap());
+      this->write_beams(new_beams, output_beam_width_type, output_beam_width_unit, output_beam_width_scale, a_input.return_full_beam_characterizations(), a_input.has_positions_array(), a_chunk);
+      timings.set_write_output_ns(stopwatch.lap());
+      if(stopwatch.isEnabled()) {
+        // the setup phases are only included in the first chunk
+        *a_chunk->mutable_timings() = timings;
+        timings.Clear();
+      }
+      a_emit(*a_chunk);
+      first += count;
+    } while(first < positions.size());
+  }
+  void run(const msg::Propagator_run_Input& a_input, msg::Propagator_run_Output* a_output) const
+  {
+    // one chunk with every position, written straight to the output
+    this->run(a_input, std::numeric_limits<std::size_t>::max(), a_output, [](msg::Propagator_run_Output&) {});
+  }
+
+  /**
+   * Options for the arena that the input and output messages of a call are allocated on.
+   * Large outputs have a submessage for every position, so blocks are allowed to grow
+   * much larger than the default to keep the number of block allocations small.
+   */
+  static google::protobuf::ArenaOptions arena_options(const std::string& a_input_str)
+  {
+    google::protobuf::ArenaOptions options;
+    options.start_block_size = std::clamp<std::size_t>(a_input_str.size(), 1024, 64 * 1024);
+    options.max_block_size   = 4 * 1024 * 1024;
+    return options;
+  }
+
+  Propagator::OutputFormat output_format = Propagator::OutputFormat::SAME_AS_INPUT;
 
+  msg::serialization_format get_output_format(const std::string& a_input_str) const
+  {
+    switch(output_format) {
+      case Propagator::OutputFormat::JSON:
+        return msg::serialization_format::JSON;
+      case Propagator::OutputFormat::PROTOBUF:
+        return msg::serialization_format::PROTOBUF;
+      default:
+        return msg::detect_serialization_format(a_input_str);
+    }
+  }
+
+  std::unique_ptr<ThreadPool> pool;
+  std::once_flag              pool_flag;
+
+  void batch(const msg::Propagator_batch_Input& a_input, msg::Propagator_batch_Output* a_output)
+  {
+    Stopwatch stopwatch(a_input.return_timings());
+    std::size_t num_beams   = a_input.beams_size();
+    std::size_t num_systems = std::max(1, a_input.optical_systems_size());
+    bool        zip         = a_input.pairing() == msg::BATCH_PAIRING_ZIP;
+    if(zip && num_beams != num_systems && num_beams != 1 && num_systems != 1) {
+      throw std::runtime_error("Cannot zip " + std::to_string(num_beams) + " beams with " + std::to_string(num_systems) + " optical systems. The number of beams and systems must be the same, or one of them must be 1.");
+    }
+    std::size_t num_entries = zip ? (num_beams == 0 ? 0 : std::max(num_beams, num_systems)) : num_beams * num_systems;
+
+    // everything that needs the unit registry is done up front, on this thread.
+    // a bad beam or system is only an error for the entries that use it.
+    struct Beam {
+      CircularGaussianLaserBeam beam;
+      msg::BeamWidthType        width_type;
+      std::string               width_unit;
+      double                    width_scale = 1;
+      std::string               error;
+    };
+    std::vector<Beam> beams(num_beams);
+    for(std::size_t b = 0; b < num_beams; ++b) {
+      try {
+        auto config          = this->output_beam_width_config(a_input.beams(b), a_input);
+        beams[b].beam        = this->build_laser(a_input.beams(b));
+        beams[b].width_type  = config.first;
+        beams[b].width_unit  = config.second;
+        beams[b].width_scale = length_scale(beams[b].width_unit);
+      } catch(std::runtime_error& err) {
+        beams[b].error = "There was an error building beam " + std::to_string(b) + ": " + err.what();
+      }
+    }
+    auto build_laser_ns = stopwatch.lap();
+    std::vector<OpticalSystem<t::cm>> systems(num_systems);
+    std::vector<std::string>          system_errors(num_systems);
+    for(int s = 0; s < a_input.optical_systems_size(); ++s) {
+      try {
+        systems[s] = this->build_optical_system(a_input.optical_systems(s));
+      } catch(std::runtime_error& err) {
+        system_errors[s] = "There was an error building optical system " + std::to_string(s) + ": " + err.what();
+      }
+    }
+    auto build_optical_system_ns = stopwatch.lap();
+    auto positions               = make_positions(a_input);
+    auto convert_ns              = stopwatch.lap();
+
+    a_output->mutable_results()->Reserve(num_entries);
+    for(std::size_t e = 0; e < num_entries; ++e) {
+      a_output->add_results()->mutable_return_status();
+    }
+
+    std::call_once(pool_flag, [this]() { pool = std::make_unique<ThreadPool>(); });
+    std::size_t grain = std::max<std::size_t>(1, num_entries / (8 * pool->size()));
+    pool->parallel_for(num_entries, grain, [&](std::size_t a_begin, std::size_t a_end) {
+      for(std::size_t e = a_begin; e < a_end; ++e) {
+        std::size_t b      = zip ? (num_beams == 1 ? 0 : e) : e / num_systems;
+        std::size_t s      = zip ? (num_systems == 1 ? 0 : e) : e % num_systems;
+        auto        result = a_output->mutable_results(e);
+        if(beams[b].error.size() > 0) {
+          result->mutable_return_status()->set_error_message(beams[b].error);
+          continue;
+        }
+        if(system_errors[s].size() > 0) {
+          result->mutable_return_status()->set_error_message(system_errors[s]);
+          continue;
+        }
+        try {
+          auto new_beams = propagate_beam_through_system(beams[b].beam, systems[s], positions);
+          this->write_beams(new_beams, beams[b].width_type, beams[b].width_unit, beams[b].width_scale, a_input.return_full_beam_characterizations(), a_input.has_positions_array(), result);
+        } catch(std::runtime_error& err) {
+          result->Clear();
+          result->mutable_return_status()->set_error_message("There was an error propagating beam " + std::to_string(b) + " through optical system " + std::to_string(s) + ": " + err.what());
+        }
+      }
+    });
+
+    if(stopwatch.isEnabled()) {
+      auto timings = a_output->mutable_timings();
+      timings->set_build_laser_ns(build_laser_ns);
+      timings->set_build_optical_system_ns(build_optical_system_ns);
+      timings->set_convert_ns(convert_ns);
+      timings->set_propagate_ns(stopwatch.lap());
+    }
+  }
+
+  struct Session {
+    CircularGaussianLaserBeam    beam;
+    CompiledOpticalSystem<t::cm> optical_system;
+    msg::BeamWidthType           beam_waist_width_type;
+    std::string                  beam_waist_width_unit;
+  };
+  // sessions are kept in least recently used order, most recent first.
+  // queries hold a shared_ptr, so a session can be released while it is being queried.
+  using SessionList = std::list<std::pair<std::uint64_t, std::shared_ptr<const Session>>>;
+  mutable std::mutex                                       session_mutex;
+  SessionList                                              sessions;
+  std::unordered_map<std::uint64_t, SessionList::iterator> session_index;
+  std::uint64_t                                            next_session_id = 1;
+  std::size_t                                              max_sessions    = 100;
+
+  void evict_sessions()
+  {
+    while(sessions.size() > max_sessions) {
+      session_index.erase(sessions.back().first);
+      sessions.pop_back();
+    }
+  }
+  std::shared_ptr<const Session> get_session(std::uint64_t a_id)
+  {
+    std::lock_guard<std::mutex> lock(session_mutex);
+    auto                        it = session_index.find(a_id);
+    if(it == session_index.end()) {
+      throw std::runtime_error("No session with id " + std::to_string(a_id) + ". It may have been released or evicted.");
+    }
+    sessions.splice(sessions.begin(), sessions, it->second);
+    return it->second->second;
+  }
+
+  void load(const msg::Propagator_load_Input& a_input, msg::Propagator_load_Output* a_output)
+  {
+    Stopwatch stopwatch(a_input.return_timings());
+    auto      session              = std::make_shared<Session>();
+    session->beam                  = this->build_laser(a_input.beam());
+    auto build_laser_ns            = stopwatch.lap();
+    session->optical_system        = CompiledOpticalSystem<t::cm>(this->build_optical_system(a_input.optical_system()));
+    auto build_optical_system_ns   = stopwatch.lap();
+    session->beam_waist_width_type = a_input.beam().beam_waist_width_type();
+    session->beam_waist_width_unit = a_input.beam().beam_waist_width().unit();
+    if(stopwatch.isEnabled()) {
+      a_output->mutable_timings()->set_build_laser_ns(build_laser_ns);
+      a_output->mutable_timings()->set_build_optical_system_ns(build_optical_system_ns);
+    }
+
+    std::lock_guard<std::mutex> lock(session_mutex);
+    std::uint64_t               id = next_session_id++;
+    sessions.emplace_front(id, std::move(session));
+    session_index[id] = sessions.begin();
+    this->evict_sessions();
+    a_output->set_session_id(id);
+  }
+  void query(const msg::Propagator_query_Input& a_input, msg::Propagator_query_Output* a_output)
+  {
+    Stopwatch    stopwatch(a_input.return_timings());
+    msg::Timings timings;
+    auto         session = this->get_session(a_input.session_id());
+    // configure output
+    msg::BeamWidthType output_beam_width_type = session->beam_waist_width_type;
+    std::string        output_beam_width_unit = session->beam_waist_width_unit;
     if(a_input.has_output_beam_width_type()) {
       output_beam_width_type = a_input.output_beam_width_type();
     }
     if(a_input.has_output_beam_width_unit()) {
       output_beam_width_unit = a_input.output_beam_width_unit();
     }
-    for(int i = 0; i < a_input.positions_size(); i++) {
-      auto z = msg::make_quantity<t::cm>(a_input.positions(i));
-      // propagate through system
-      auto new_beam = propagate_beam_through_system(beam, optical_system, z);
-      // get a beam width object for the given position
-      auto beam_width = new_beam.getBeamWidth();
-      // extract the width to msg::Quantity using the specified beam width convention
-      auto width = msg::get_beam_width(beam_width, output_beam_width_type);
-      // convert the width to the specified units
-      msg::convert(width, output_beam_width_unit);
-      // copy the width to the output message
-      *a_output->add_beam_widths() << width;
-
-      if(a_input.return_full_beam_characterizations()) {
-        auto ptr = a_output->add_beams();
-        ptr->mutable_beam_waist_width() << msg::get_beam_width(new_beam.getBeamWaistWidth(), output_beam_width_type);
-        ptr->set_beam_waist_width_type(output_beam_width_type);
-        ptr->mutable_beam_quality_factor() << new_beam.getBeamQualityFactor();
-        ptr->mutable_beam_waist_position() << new_beam.getBeamWaistPosition();
-        ptr->mutable_wavelength() << new_beam.getWavelength();
+    auto positions               = make_positions(a_input);
+    auto output_beam_width_scale = length_scale(output_beam_width_unit);
+    timings.set_convert_ns(stopwatch.lap());
+
+    // the compiled system only needs a binary search and a few products for each position.
+    std::vector<CircularGaussianLaserBeam> new_beams;
+    new_beams.reserve(positions.size());
+    for(const auto& z : positions) {
+      new_beams.push_back(propagate_beam_through_system(session->beam, session->optical_system, z));
+    }
+    timings.set_propagate_ns(stopwatch.lap());
+    this->write_beams(new_beams, output_beam_width_type, output_beam_width_unit, output_beam_width_scale, a_input.return_full_beam_characterizations(), a_input.has_positions_array(), a_output);
+    timings.set_write_output_ns(stopwatch.lap());
+    if(stopwatch.isEnabled()) {
+      *a_output->mutable_timings() = timings;
+    }
+  }
+  void release(const msg::Propagator_release_Input& a_input, msg::Propagator_release_Output*)
+  {
+    std::lock_guard<std::mutex> lock(session_mutex);
+    auto                        it = session_index.find(a_input.session_id());
+    if(it == session_index.end()) {
+      throw std::runtime_error("No session with id " + std::to_string(a_input.session_id()) + ". It may have been released or evicted.");
+    }
+    sessions.erase(it->second);
+    session_index.erase(it);
+  }
+
+  // outputs of run(...), keyed by a digest of the canonical form of their input (see result_cache_key(...)).
+  // each entry also stores the canonical input, which is compared when a digest matches, so a hash collision
+  // is a miss instead of a wrong output. only one entry is kept per digest.
+  // results are kept in least recently used order, most recent first. the index points into the list.
+  struct ResultKey {
+    std::size_t digest = 0;
+    std::string input;  // the canonical input. empty if the output should not be cached.
+  };
+  struct Result {
+    ResultKey   key;
+    std::string output;
+  };
+  using ResultList = std::list<Result>;
+  mutable std::mutex                                    result_cache_mutex;
+  ResultList                                            results;
+  std::unordered_map<std::size_t, ResultList::iterator> result_index;
+  std::atomic<std::size_t>                              result_cache_max_bytes = 0;
+  Propagator::ResultCacheStats                          result_cache_stats;
+
+  static std::size_t result_size(const Result& a_result)
+  {
+    // the strings, plus a rough estimate for the list node and index entry
+    return a_result.key.input.size() + a_result.output.size() + 2 * sizeof(Result) + 8 * sizeof(void*);
+  }
+  void erase_result(ResultList::iterator a_it)
+  {
+    result_cache_stats.bytes -= result_size(*a_it);
+    result_index.erase(a_it->key.digest);
+    results.erase(a_it);
+  }
+  void evict_results()
+  {
+    while(result_cache_stats.bytes > result_cache_max_bytes) {
+      this->erase_result(std::prev(results.end()));
+      ++result_cache_stats.evictions;
+    }
+    result_cache_stats.entries = results.size();
+  }
+  /**
+   * Return the result cache key for an input. The key's input is empty if the output should not be cached.
+   * Only the outputs of run(...) are cached, the other methods depend on (or change) the sessions.
+   */
+  template<typename INPUT_MSG>
+  ResultKey result_cache_key(INPUT_MSG*, msg::serialization_format) const
+  {
+    return ResultKey();
+  }
+  /**
+   * The canonical form of a run input is the input without its positions, serialized deterministically,
+   * followed by the positions converted to cm. So the key does not depend on how the input was formatted,
+   * on the order of map entries, or on the units the positions were given in.
+   *
+   * Whether the positions were given in positions or positions_array is part of the key, because it
+   * determines whether the output has beam_widths or beam_widths_array.
+   *
+   * The positions are moved out of the input (without copying them) while the rest of it is serialized.
+   */
+  ResultKey result_cache_key(msg::Propagator_run_Input* a_input, msg::serialization_format a_format) const
+  {
+    if(result_cache_max_bytes == 0 || a_input->return_timings()) {
+      // a stored output would have the timings of the call that stored it
+      return ResultKey();
+    }
+    auto positions = make_positions(*a_input);
+
+    static const std::vector<const google::protobuf::FieldDescriptor*> position_fields = {
+        msg::Propagator_run_Input::descriptor()->FindFieldByNumber(msg::Propagator_run_Input::kPositionsFieldNumber),
+        msg::Propagator_run_Input::descriptor()->FindFieldByNumber(msg::Propagator_run_Input::kPositionsArrayFieldNumber)};
+    // on the same arena as the input, so swapping fields only swaps pointers
+    msg::Propagator_run_Input  local;
+    msg::Propagator_run_Input* removed = a_input->GetArena() ? google::protobuf::Arena::CreateMessage<msg::Propagator_run_Input>(a_input->GetArena()) : &local;
+    a_input->GetReflection()->SwapFields(a_input, removed, position_fields);
+
+    ResultKey key;
+    {
+      google::protobuf::io::StringOutputStream stream(&key.input);
+      google::protobuf::io::CodedOutputStream  coded_stream(&stream);
+      coded_stream.SetSerializationDeterministic(true);
+      a_input->SerializeToCodedStream(&coded_stream);
+    }
+    a_input->GetReflection()->SwapFields(a_input, removed, position_fields);
+
+    key.input.reserve(key.input.size() + positions.size() * sizeof(double) + 2);
+    for(auto& z : positions) {
+      double value = z.value();
+      key.input.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    key.input += static_cast<char>(a_input->has_positions_array());
+    key.input += static_cast<char>(a_format);
+    key.digest = std::hash<std::string_view>{}(key.input);
+    return key;
+  }
+  bool find_result(const ResultKey& a_key, std::string& a_output)
+  {
+    std::lock_guard<std::mutex> lock(result_cache_mutex);
+    auto                        it = result_index.find(a_key.digest);
+    if(it == result_index.end() || it->second->key.input != a_key.input) {
+      ++result_cache_stats.misses;
+      return false;
+    }
+    ++result_cache_stats.hits;
+    results.splice(results.begin(), results, it->second);
+    a_output = it->second->output;
+    return true;
+  }
+  void store_result(ResultKey a_key, const std::string& a_output)
+  {
+    std::lock_guard<std::mutex> lock(result_cache_mutex);
+    auto                        it = result_index.find(a_key.digest);
+    if(it != result_index.end()) {
+      if(it->second->key.input == a_key.input) {
+        // another call with the same input finished first
+        return;
       }
+      // a different input with the same digest
+      this->erase_result(it->second);
     }
+    results.push_front(Result{std::move(a_key), a_output});
+    result_index[results.front().key.digest] = results.begin();
+    result_cache_stats.bytes += result_size(results.front());
+    this->evict_results();
   }
 };
 
@@ -129,6 +630,21 @@ struct Propagator::imp {
  * This method **requires** the output message to contain a return_status message.
  * This is how error/sucess is communicated to the caller.
  *
+ * The output is serialized in the same format as the input unless an output format was set,
+ * even if the input could not be parsed.
+ *
+ * The input and output messages are allocated on an arena, so building a large output
+ * (one submessage per position) does not need a heap allocation for every submessage,
+ * and it is all freed at once when the call returns.
+ *
+ * If the implementation throws, anything it wrote to the output is discarded and only the error is returned.
+ *
+ * If timings are requested in the input, they are added to the output. When they are not,
+ * the only cost is reading the clock once at the start.
+ *
+ * If the result cache is enabled and the method's output can be cached, a stored output is returned
+ * for an input that has been seen before, and new outputs are stored.
+ *
  * If implementation did not set anything in the return_status
  * we want to create an empty one to return here. That way return_status will
  * exist for the caller and they can check to see if error_message
@@ -137,26 +653,165 @@ struct Propagator::imp {
 #define DEFINE_FORWARDING_METHOD(NAME)                                                                    \
   auto Propagator::NAME(const std::string& a_input_str)->std::string                                      \
   {                                                                                                       \
-    std::string                                     output_str;                                           \
-    libgbp2_message_api::Propagator_##NAME##_Input  input_msg;                                            \
-    libgbp2_message_api::Propagator_##NAME##_Output output_msg;                                           \
+    using Input  = libgbp2_message_api::Propagator_##NAME##_Input;                                        \
+    using Output = libgbp2_message_api::Propagator_##NAME##_Output;                                       \
+    auto                    start = imp::Clock::now();                                                    \
+    google::protobuf::Arena arena(imp::arena_options(a_input_str));                                       \
+    Input*                  input_msg      = google::protobuf::Arena::CreateMessage<Input>(&arena);       \
+    Output*                 output_msg     = google::protobuf::Arena::CreateMessage<Output>(&arena);      \
+    auto                    output_format  = pImpl->get_output_format(a_input_str);                       \
+    std::uint64_t           deserialize_ns = 0;                                                           \
+    std::string             output_str;                                                                   \
+    imp::ResultKey          cache_key;                                                                    \
     try {                                                                                                 \
-      msg::deserialize_message(a_input_str, input_msg);                                                   \
-      pImpl->NAME(input_msg, &output_msg);                                                                \
+      msg::deserialize_message(a_input_str, *input_msg);                                                  \
+      if(input_msg->return_timings()) {                                                                   \
+        deserialize_ns = imp::elapsed_ns(start);                                                          \
+      }                                                                                                   \
+      cache_key = pImpl->result_cache_key(input_msg, output_format);                                      \
+      if(cache_key.input.size() > 0 && pImpl->find_result(cache_key, output_str)) {                       \
+        return output_str;                                                                                \
+      }                                                                                                   \
+      pImpl->NAME(*input_msg, output_msg);                                                                \
     } catch(std::runtime_error & err) {                                                                   \
+      output_msg->Clear();                                                                                \
       std::string error_message = "There was an error in `" #NAME "` method: " + std::string(err.what()); \
-      output_msg.mutable_return_status()->set_error_message(error_message);                               \
+      output_msg->mutable_return_status()->set_error_message(error_message);                              \
     } catch(...) {                                                                                        \
+      output_msg->Clear();                                                                                \
       std::string error_message = "There was an error in `" #NAME "` method.";                            \
-      output_msg.mutable_return_status()->set_error_message(error_message);                               \
+      output_msg->mutable_return_status()->set_error_message(error_message);                              \
     }                                                                                                     \
-    if(!output_msg.has_return_status()) {                                                                 \
-      output_msg.set_allocated_return_status(new libgbp2_message_api::ReturnStatus());                    \
+    output_msg->mutable_return_status();                                                                  \
+    if(input_msg->return_timings()) {                                                                     \
+      output_str = imp::serialize_with_timings(output_msg, output_format, start, deserialize_ns);         \
+    } else {                                                                                              \
+      output_str = msg::serialize_message(*output_msg, output_format);                                    \
+    }                                                                                                     \
+    if(cache_key.input.size() > 0 && !output_msg->return_status().has_error_message()) {                  \
+      pImpl->store_result(std::move(cache_key), output_str);                                              \
     }                                                                                                     \
-    output_str = msg::serialize_message(output_msg, msg::serialization_format::JSON);                     \
     return output_str;                                                                                    \
   }
 
+Propagator::Propagator() : pImpl(new imp) {}
+Propagator::~Propagator() { delete pImpl; }
+
+void Propagator::setOutputFormat(OutputFormat a_format) { pImpl->output_format = a_format; }
+auto Propagator::getOutputFormat() const -> OutputFormat { return pImpl->output_format; }
+
+void Propagator::setMaxNumberOfSessions(std::size_t a_max)
+{
+  if(a_max == 0) {
+    throw std::runtime_error("The maximum number of sessions must be at least 1.");
+  }
+  std::lock_guard<std::mutex> lock(pImpl->session_mutex);
+  pImpl->max_sessions = a_max;
+  pImpl->evict_sessions();
+}
+std::size_t Propagator::getMaxNumberOfSessions() const
+{
+  std::lock_guard<std::mutex> lock(pImpl->session_mutex);
+  return pImpl->max_sessions;
+}
+std::size_t Propagator::getNumberOfSessions() const
+{
+  std::lock_guard<std::mutex> lock(pImpl->session_mutex);
+  return pImpl->sessions.size();
+}
+
+void Propagator::setResultCacheSize(std::size_t a_max_bytes)
+{
+  std::lock_guard<std::mutex> lock(pImpl->result_cache_mutex);
+  pImpl->result_cache_max_bytes = a_max_bytes;
+  pImpl->evict_results();
+}
+std::size_t Propagator::getResultCacheSize() const { return pImpl->result_cache_max_bytes; }
+auto        Propagator::getResultCacheStats() const -> ResultCacheStats
+{
+  std::lock_guard<std::mutex> lock(pImpl->result_cache_mutex);
+  return pImpl->result_cache_stats;
+}
+void Propagator::clearResultCache()
+{
+  std::lock_guard<std::mutex> lock(pImpl->result_cache_mutex);
+  pImpl->results.clear();
+  pImpl->result_index.clear();
+  pImpl->result_cache_stats.bytes   = 0;
+  pImpl->result_cache_stats.entries = 0;
+}
+
 DEFINE_FORWARDING_METHOD(run)
+DEFINE_FORWARDING_METHOD(batch)
+DEFINE_FORWARDING_METHOD(load)
+DEFINE_FORWARDING_METHOD(query)
+DEFINE_FORWARDING_METHOD(release)
+
+void Propagator::run(const std::string& a_input_str, const std::function<void(const std::string&)>& a_sink, std::size_t a_chunk_size)
+{
+  // the input is on an arena, but the chunk is not. it is cleared and reused for every chunk,
+  // which keeps its submessages allocated, and an arena would keep growing.
+  auto                                       start = imp::Clock::now();
+  google::protobuf::Arena                    arena(imp::arena_options(a_input_str));
+  auto                                       input_msg = google::protobuf::Arena::CreateMessage<libgbp2_message_api::Propagator_run_Input>(&arena);
+  libgbp2_message_api::Propagator_run_Output output_msg;
+  std::string                                chunk_str;
+  bool                                       started        = false;
+  auto                                       output_format  = pImpl->get_output_format(a_input_str);
+  std::uint64_t                              deserialize_ns = 0;
+
+  auto emit = [&](libgbp2_message_api::Propagator_run_Output& a_chunk) {
+    chunk_str.clear();
+    if(input_msg->return_timings()) {
+      // the deserialize time is only included in the first chunk
+      msg::append_delimited(imp::serialize_with_timings(&a_chunk, output_format, start, started ? 0 : deserialize_ns), chunk_str);
+    } else {
+      msg::append_delimited(msg::serialize_message(a_chunk, output_format), chunk_str);
+    }
+    started = true;
+    a_sink(chunk_str);
+  };
+  try {
+    msg::deserialize_message(a_input_str, *input_msg);
+    if(input_msg->return_timings()) {
+      deserialize_ns = imp::elapsed_ns(start);
+    }
+    pImpl->run(*input_msg, std::max<std::size_t>(1, a_chunk_size), &output_msg, emit);
+  } catch(std::runtime_error& err) {
+    if(started) {
+      throw;
+    }
+    output_msg.Clear();
+    output_msg.mutable_return_status()->set_error_message("There was an error in `run` method: " + std::string(err.what()));
+  } catch(...) {
+    if(started) {
+      throw;
+    }
+    output_msg.Clear();
+    output_msg.mutable_return_status()->set_error_message("There was an error in `run` method.");
+  }
+  if(!started) {
+    emit(output_msg);
+  }
+}
+
+void Propagator::run(const std::string& a_input_str, int a_fd, std::size_t a_chunk_size)
+{
+  this->run(
+      a_input_str, [a_fd](const std::string& a_chunk) {
+        std::size_t written = 0;
+        while(written < a_chunk.size()) {
+          auto n = ::write(a_fd, a_chunk.data() + written, a_chunk.size() - written);
+          if(n < 0 && errno == EINTR) {
+            continue;
+          }
+          if(n < 0) {
+            throw std::runtime_error("Could not write output to file descriptor " + std::to_string(a_fd) + ": " + std::strerror(errno));
+          }
+          written += n;
+        }
+      },
+      a_chunk_size);
+}
 
 }  // namespace libGBP2
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+#include <functional>
 #include <string>
 
 // #include "libgbp2-message-api_export.h"
@@ -10,6 +12,10 @@ namespace libGBP2
 /**
  * A class to run propagation calculations based
  * on user configuration.
+ *
+ * Input messages can be serialized as JSON or binary protobuf. By default, output
+ * messages are serialized in the same format as the input. Binary output is much
+ * faster to write (and read) for large outputs.
  */
 class Propagator
 {
@@ -19,11 +25,98 @@ class Propagator
   imp* pImpl;
 
  public:
+  /**
+   * The serialization format of output messages.
+   */
+  enum class OutputFormat { SAME_AS_INPUT,
+                            JSON,
+                            PROTOBUF };
+
+  struct ResultCacheStats {
+    std::size_t hits      = 0;
+    std::size_t misses    = 0;
+    std::size_t evictions = 0;
+    std::size_t entries   = 0;
+    std::size_t bytes     = 0;  // approximate memory used by the cached inputs and outputs
+  };
+
+  Propagator();
+  ~Propagator();
+  Propagator(const Propagator&)            = delete;
+  Propagator& operator=(const Propagator&) = delete;
+
+  void         setOutputFormat(OutputFormat a_format);
+  OutputFormat getOutputFormat() const;
+
+  /**
+   * Set the maximum number of sessions to keep. When a new session is loaded
+   * and there are already this many, the least recently used session is released.
+   * Throws std::runtime_error if a_max is zero, since a new session would be released before it could be queried.
+   */
+  void        setMaxNumberOfSessions(std::size_t a_max);
+  std::size_t getMaxNumberOfSessions() const;
+  std::size_t getNumberOfSessions() const;
+
+  /**
+   * Set the maximum size of the result cache in bytes. The cache is disabled (the default) if this is zero.
+   *
+   * When the cache is enabled, the output of run(...) is stored with the input message as the key,
+   * and a run with the same input returns the stored output without running the propagation.
+   * Inputs are compared after parsing, with their positions converted to cm, so a JSON input matches
+   * the same input with different formatting or field order, or with its positions in different units.
+   * Outputs with an error are not cached. When the cache is full,
+   * the least recently used results are evicted.
+   */
+  void             setResultCacheSize(std::size_t a_max_bytes);
+  std::size_t      getResultCacheSize() const;
+  ResultCacheStats getResultCacheStats() const;
+  void             clearResultCache();
+
   /**
    * Run an propagation analysis based on a configuration
    * given by a serialized protobuf message.
    */
   std::string run(const std::string&);
+
+  /**
+   * Run a propagation analysis and pass the output to a_sink in chunks as it is computed,
+   * instead of returning it all at once.
+   *
+   * Each chunk is a Propagator_run_Output message with the results for (at most) a_chunk_size
+   * positions, serialized in the output format and prefixed with its size as a varint
+   * (see msg::read_delimited(...)). Chunks are in position order and every chunk has a return_status.
+   * If there is an error before the first chunk, a single chunk with the error is written.
+   */
+  void run(const std::string&, const std::function<void(const std::string&)>& a_sink, std::size_t a_chunk_size = 10000);
+
+  /**
+   * Run a propagation analysis and write the output chunks to a file descriptor.
+   */
+  void run(const std::string&, int a_fd, std::size_t a_chunk_size = 10000);
+
+  /**
+   * Run a propagation analysis for many beams and optical systems
+   * in one call. Beams, systems, and positions are only parsed once
+   * and the entries are computed in parallel.
+   */
+  std::string batch(const std::string&);
+
+  /**
+   * Build a beam and optical system and keep them in a session.
+   * The output contains the session id to use with query(...) and release(...).
+   */
+  std::string load(const std::string&);
+
+  /**
+   * Run a propagation analysis for the beam and optical system in a session.
+   * Only the positions and output options are given.
+   */
+  std::string query(const std::string&);
+
+  /**
+   * Release a session.
+   */
+  std::string release(const std::string&);
 };
 
 }  // namespace libGBP2
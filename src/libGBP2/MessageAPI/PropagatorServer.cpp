@@ -0,0 +1,479 @@
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../ThreadPool.hpp"
+#include "./Messages.hpp"
+#include "Messages.pb.h"
+#include "libGBP2/MessageAPI/PropagatorServer.hpp"
+
+namespace libGBP2
+{
+struct PropagatorServer::imp {
+  // how long stop() waits for responses to be sent after all requests are finished
+  static constexpr std::chrono::seconds stop_timeout{1};
+
+  struct Connection {
+    int                      fd;
+    std::string              buffer;           // data that has been received but not parsed yet. only used by the io thread.
+    std::atomic<bool>        reading  = true;  // false once the client has shut down its end. only set by the io thread.
+    std::atomic<std::size_t> requests = 0;     // requests that have been dispatched but not answered yet
+    std::atomic<bool>        dropped  = false;
+
+    // responses that could not be sent without blocking. they are sent by the io thread when the socket is writable.
+    std::mutex  write_mutex;
+    std::string output;
+    std::size_t output_sent = 0;
+
+    explicit Connection(int a_fd) : fd(a_fd) {}
+    ~Connection() { ::close(fd); }
+
+    /**
+     * Send as much of a_data as the socket will take without blocking. Returns false if the connection failed.
+     */
+    bool write_some(std::string_view a_data, std::size_t& a_sent)
+    {
+      while(a_sent < a_data.size()) {
+        auto n = ::send(fd, a_data.data() + a_sent, a_data.size() - a_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(n < 0 && errno == EINTR) {
+          continue;
+        }
+        if(n < 0) {
+          return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        a_sent += n;
+      }
+      return true;
+    }
+    void drop_locked()
+    {
+      dropped = true;
+      output.clear();
+      output_sent = 0;
+      ::shutdown(fd, SHUT_RDWR);
+    }
+    std::size_t pending_locked() const { return output.size() - output_sent; }
+
+    /**
+     * Send a response, or queue it if the socket is full. If more than a_max_pending bytes are already
+     * queued, the client is not reading its responses and the connection is dropped instead.
+     * Returns true if the io thread needs to look at the connection, i.e. output was queued or the connection was dropped.
+     */
+    bool send(const std::string& a_frame, std::size_t a_max_pending)
+    {
+      std::lock_guard<std::mutex> lock(write_mutex);
+      if(dropped) {
+        return false;
+      }
+      if(pending_locked() > a_max_pending) {
+        this->drop_locked();
+        return true;
+      }
+      std::size_t sent = 0;
+      if(pending_locked() == 0 && !this->write_some(a_frame, sent)) {
+        // the client is gone, there is no one to report this to.
+        this->drop_locked();
+        return true;
+      }
+      output.append(a_frame, sent);
+      return pending_locked() > 0;
+    }
+    /**
+     * Send queued output. Called by the io thread when the socket is writable.
+     */
+    void flush()
+    {
+      std::lock_guard<std::mutex> lock(write_mutex);
+      if(!this->write_some(output, output_sent)) {
+        this->drop_locked();
+        return;
+      }
+      if(output_sent == output.size() || output_sent > output.size() / 2) {
+        output.erase(0, output_sent);
+        output_sent = 0;
+      }
+    }
+    void drop()
+    {
+      std::lock_guard<std::mutex> lock(write_mutex);
+      this->drop_locked();
+    }
+    bool has_output()
+    {
+      std::lock_guard<std::mutex> lock(write_mutex);
+      return pending_locked() > 0;
+    }
+  };
+
+  std::string                 socket_path;
+  Propagator                  propagator;
+  std::unique_ptr<ThreadPool> pool;
+  int                         listen_fd  = -1;
+  int                         wake_fd[2] = {-1, -1};
+  bool                        running    = false;
+  std::thread                 io_thread;
+  std::atomic<bool>           stopping   = false;  // stop accepting connections and reading requests
+  std::atomic<bool>           finishing  = false;  // all requests are done, exit when the responses are sent
+
+  std::atomic<std::size_t> max_request_size        = std::size_t(64) << 20;
+  std::atomic<std::size_t> max_pending_output_size = std::size_t(64) << 20;
+
+  // open connections. only used by the io thread. a connection is closed when it has been removed
+  // from here and all of its requests are done. connections are kept after the client shuts down
+  // its end until their responses have been sent.
+  std::map<int, std::shared_ptr<Connection>> connections;
+
+  std::atomic<std::size_t>  num_connections = 0;
+  std::atomic<std::size_t>  queued          = 0;
+  std::atomic<std::size_t>  in_progress     = 0;
+  std::atomic<std::size_t>  completed       = 0;
+  std::atomic<std::int64_t> total_latency   = 0;
+  std::atomic<std::int64_t> max_latency     = 0;
+  std::mutex                done_mutex;
+  std::condition_variable   done;
+  bool                      reading_stopped = false;  // set by the io thread once it will not dispatch any more requests. guarded by done_mutex.
+
+  Stats get_stats() const
+  {
+    Stats stats;
+    stats.queue_depth          = queued;
+    stats.requests_in_progress = in_progress;
+    stats.requests_completed   = completed;
+    stats.connections          = num_connections;
+    stats.max_latency          = std::chrono::nanoseconds(max_latency);
+    stats.result_cache         = propagator.getResultCacheStats();
+    if(stats.requests_completed > 0) {
+      stats.mean_latency = std::chrono::nanoseconds(total_latency / static_cast<std::int64_t>(stats.requests_completed));
+    }
+    return stats;
+  }
+
+  std::string handle(const std::string& a_request_str)
+  {
+    msg::PropagatorServer_Request  request;
+    msg::PropagatorServer_Response response;
+    if(!request.ParseFromString(a_request_str)) {
+      response.mutable_return_status()->set_error_message("Could not parse request.");
+      return response.SerializeAsString();
+    }
+    response.set_request_id(request.request_id());
+
+    const auto& method = request.method();
+    if(method == "run") {
+      response.set_output(propagator.run(request.input()));
+    } else if(method == "batch") {
+      response.set_output(propagator.batch(request.input()));
+    } else if(method == "load") {
+      response.set_output(propagator.load(request.input()));
+    } else if(method == "query") {
+      response.set_output(propagator.query(request.input()));
+    } else if(method == "release") {
+      response.set_output(propagator.release(request.input()));
+    } else if(method == "stats") {
+      auto                              stats = this->get_stats();
+      msg::PropagatorServer_stats_Output output;
+      output.mutable_return_status();
+      output.set_queue_depth(stats.queue_depth);
+      output.set_requests_in_progress(stats.requests_in_progress);
+      output.set_requests_completed(stats.requests_completed);
+      output.set_connections(stats.connections);
+      output.set_mean_latency_us(stats.mean_latency.count() / 1e3);
+      output.set_max_latency_us(stats.max_latency.count() / 1e3);
+      output.set_result_cache_hits(stats.result_cache.hits);
+      output.set_result_cache_misses(stats.result_cache.misses);
+      output.set_result_cache_evictions(stats.result_cache.evictions);
+      output.set_result_cache_bytes(stats.result_cache.bytes);
+      response.set_output(output.SerializeAsString());
+    } else {
+      response.mutable_return_status()->set_error_message("Unknown method `" + method + "`.");
+    }
+    response.mutable_return_status();
+    return response.SerializeAsString();
+  }
+
+  void dispatch(const std::shared_ptr<Connection>& a_connection, std::string a_request)
+  {
+    auto received = std::chrono::steady_clock::now();
+    ++queued;
+    ++a_connection->requests;
+    pool->submit([this, a_connection, request = std::move(a_request), received]() {
+      // count the request as in progress before it leaves the queue, so that stop() never sees zero requests while one is running.
+      ++in_progress;
+      --queued;
+      std::string frame;
+      msg::append_delimited(this->handle(request), frame);
+      bool wake = a_connection->send(frame, max_pending_output_size);
+      --a_connection->requests;
+      if(wake || !a_connection->reading) {
+        this->wake();
+      }
+
+      std::int64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - received).count();
+      total_latency += latency;
+      std::int64_t max = max_latency;
+      while(latency > max && !max_latency.compare_exchange_weak(max, latency)) {
+      }
+
+      std::lock_guard<std::mutex> lock(done_mutex);
+      --in_progress;
+      ++completed;
+      done.notify_all();
+    });
+  }
+
+  /**
+   * Add data received on a connection and dispatch every complete request.
+   * Returns false if the data is not a valid request stream.
+   */
+  bool receive(const std::shared_ptr<Connection>& a_connection, const char* a_data, std::size_t a_size)
+  {
+    std::string& buffer = a_connection->buffer;
+    buffer.append(a_data, a_size);
+    std::size_t used = 0;
+    try {
+      for(;;) {
+        std::string_view rest(buffer.data() + used, buffer.size() - used);
+        std::size_t      size;
+        std::size_t      prefix = msg::read_delimited_size(rest, size);
+        if(size > max_request_size) {
+          return false;
+        }
+        if(prefix == 0 || rest.size() - prefix < size) {
+          break;
+        }
+        this->dispatch(a_connection, std::string(rest.substr(prefix, size)));
+        used += prefix + size;
+      }
+    } catch(std::runtime_error&) {
+      return false;
+    }
+    buffer.erase(0, used);
+    return true;
+  }
+
+  /**
+   * Wake the io thread up, so it checks the connections and the stopping flags.
+   */
+  void wake()
+  {
+    char c = 0;
+    // the pipe is non-blocking. if it is full the io thread is going to wake up anyway.
+    while(::write(wake_fd[1], &c, 1) < 0 && errno == EINTR) {
+    }
+  }
+
+  /**
+   * Tell stop() that the io thread has seen the stopping flag, so every request it is going to dispatch has been counted.
+   */
+  void acknowledge_stop()
+  {
+    std::lock_guard<std::mutex> lock(done_mutex);
+    reading_stopped = true;
+    done.notify_all();
+  }
+
+  void loop()
+  {
+    std::vector<pollfd>                   fds;
+    std::vector<char>                     data(64 * 1024);
+    bool                                  draining = false;
+    std::chrono::steady_clock::time_point deadline;
+    for(;;) {
+      if(stopping && listen_fd >= 0) {
+        ::close(listen_fd);
+        listen_fd = -1;
+      }
+      if(stopping && !reading_stopped) {
+        // requests are not read after this, and the ones read before have already been dispatched.
+        this->acknowledge_stop();
+      }
+      if(finishing && !draining) {
+        draining = true;
+        deadline = std::chrono::steady_clock::now() + stop_timeout;
+      }
+      fds.clear();
+      fds.push_back({wake_fd[0], POLLIN, 0});
+      fds.push_back({listen_fd, POLLIN, 0});  // ignored by poll once it is closed
+      bool output = false;
+      for(auto it = connections.begin(); it != connections.end();) {
+        auto& connection    = it->second;
+        bool  has_output    = connection->has_output();
+        bool  read_requests = connection->reading && !stopping;
+        if(connection->dropped || (!connection->reading && connection->requests == 0 && !has_output)) {
+          // any requests that are still running will find the connection dropped, or send their response before it is closed.
+          it = connections.erase(it);
+          --num_connections;
+          continue;
+        }
+        output = output || has_output;
+        fds.push_back({it->first, static_cast<short>((read_requests ? POLLIN : 0) | (has_output ? POLLOUT : 0)), 0});
+        ++it;
+      }
+      int timeout = -1;
+      if(draining) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if(!output || left <= 0) {
+          break;
+        }
+        timeout = static_cast<int>(left);
+      }
+      if(::poll(fds.data(), fds.size(), timeout) < 0) {
+        if(errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+      if(fds[0].revents != 0) {
+        while(::read(wake_fd[0], data.data(), data.size()) > 0) {
+        }
+      }
+      if(fds[1].revents & POLLIN) {
+        int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if(fd >= 0) {
+          connections[fd] = std::make_shared<Connection>(fd);
+          ++num_connections;
+        }
+      }
+      for(std::size_t i = 2; i < fds.size(); ++i) {
+        if(fds[i].revents == 0) {
+          continue;
+        }
+        auto& connection = connections.find(fds[i].fd)->second;
+        if(fds[i].revents & POLLOUT) {
+          connection->flush();
+        }
+        if(fds[i].revents & POLLIN) {
+          auto n = ::read(fds[i].fd, data.data(), data.size());
+          if(n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+          }
+          if(n == 0) {
+            // the client has shut down its end. the connection is closed when the responses to its requests are sent.
+            connection->reading = false;
+          } else if(n < 0 || !this->receive(connection, data.data(), n)) {
+            connection->drop();
+          }
+        } else if(fds[i].revents & (POLLHUP | POLLERR)) {
+          // the client has closed the connection, there is no one to send the responses to.
+          connection->drop();
+        }
+      }
+    }
+    if(!reading_stopped) {
+      this->acknowledge_stop();
+    }
+    connections.clear();
+    num_connections = 0;
+  }
+
+  void close_fds()
+  {
+    for(int* fd : {&listen_fd, &wake_fd[0], &wake_fd[1]}) {
+      if(*fd >= 0) {
+        ::close(*fd);
+        *fd = -1;
+      }
+    }
+  }
+  void start()
+  {
+    sockaddr_un address{};
+    if(socket_path.size() >= sizeof(address.sun_path)) {
+      throw std::runtime_error("Socket path is too long: " + socket_path);
+    }
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    auto fail = [this](const std::string& a_what) {
+      std::string error = a_what + ": " + std::strerror(errno);
+      this->close_fds();
+      throw std::runtime_error(error);
+    };
+    if(::pipe2(wake_fd, O_CLOEXEC | O_NONBLOCK) < 0) {
+      fail("Could not create pipe");
+    }
+    listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listen_fd < 0) {
+      fail("Could not create socket");
+    }
+    ::unlink(socket_path.c_str());
+    if(::bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+      fail("Could not bind socket to " + socket_path);
+    }
+    if(::listen(listen_fd, SOMAXCONN) < 0) {
+      fail("Could not listen on " + socket_path);
+    }
+    running         = true;
+    stopping        = false;
+    finishing       = false;
+    reading_stopped = false;
+    io_thread = std::thread([this]() { this->loop(); });
+  }
+  void stop()
+  {
+    stopping = true;
+    this->wake();
+    {
+      std::unique_lock<std::mutex> lock(done_mutex);
+      done.wait(lock, [this]() { return reading_stopped && queued == 0 && in_progress == 0; });
+    }
+    finishing = true;
+    this->wake();
+    io_thread.join();
+    this->close_fds();
+    ::unlink(socket_path.c_str());
+    running = false;
+  }
+};
+
+PropagatorServer::PropagatorServer(const std::string& a_socket_path, std::size_t a_threads) : pImpl(new imp)
+{
+  pImpl->socket_path = a_socket_path;
+  pImpl->pool        = std::make_unique<ThreadPool>(a_threads);
+}
+PropagatorServer::~PropagatorServer()
+{
+  this->stop();
+  delete pImpl;
+}
+
+void PropagatorServer::start()
+{
+  if(!pImpl->running) {
+    pImpl->start();
+  }
+}
+void PropagatorServer::stop()
+{
+  if(pImpl->running) {
+    pImpl->stop();
+  }
+}
+bool PropagatorServer::isRunning() const { return pImpl->running; }
+
+void        PropagatorServer::setMaxRequestSize(std::size_t a_bytes) { pImpl->max_request_size = a_bytes; }
+std::size_t PropagatorServer::getMaxRequestSize() const { return pImpl->max_request_size; }
+void        PropagatorServer::setMaxPendingOutputSize(std::size_t a_bytes) { pImpl->max_pending_output_size = a_bytes; }
+std::size_t PropagatorServer::getMaxPendingOutputSize() const { return pImpl->max_pending_output_size; }
+
+auto PropagatorServer::getStats() const -> Stats { return pImpl->get_stats(); }
+Propagator& PropagatorServer::getPropagator() { return pImpl->propagator; }
+
+}  // namespace libGBP2
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+#include "./Propagator.hpp"
+
+namespace libGBP2
+{
+
+/**
+ * A server that runs Propagator requests sent over a Unix domain socket.
+ *
+ * This is what gbp-propagatord runs. Clients send PropagatorServer_Request messages
+ * that name a Propagator method and contain its serialized input. Each request
+ * is run on a fixed pool of worker threads, and the output is sent back in a
+ * PropagatorServer_Response with the same request_id. Requests and responses are binary
+ * protobuf messages prefixed with their size as a varint (see msg::append_delimited(...)).
+ *
+ * Clients can pipeline requests, i.e. send many requests before reading any responses.
+ * Responses are sent as soon as they are ready, so they are not necessarily in request order.
+ * Responses that a client is not reading yet are queued, so workers never wait on a client.
+ * A client that falls too far behind is disconnected (see setMaxPendingOutputSize(...)).
+ * All connections share one Propagator, so sessions created with `load` can be queried from any connection.
+ */
+class PropagatorServer
+{
+ public:
+  struct Stats {
+    std::size_t                  queue_depth          = 0;  // requests that are waiting for a worker
+    std::size_t                  requests_in_progress = 0;
+    std::size_t                  requests_completed   = 0;
+    std::size_t                  connections          = 0;
+    std::chrono::nanoseconds     mean_latency{0};  // time from receiving a request to sending the response
+    std::chrono::nanoseconds     max_latency{0};
+    Propagator::ResultCacheStats result_cache;
+  };
+
+ private:
+  // using the PImple Pattern
+  struct imp;
+  imp* pImpl;
+
+ public:
+  /**
+   * Create a server that will listen on a_socket_path and run requests with a_threads
+   * worker threads. If a_threads is zero, the number of hardware threads is used.
+   */
+  PropagatorServer(const std::string& a_socket_path, std::size_t a_threads = 0);
+  ~PropagatorServer();
+  PropagatorServer(const PropagatorServer&)            = delete;
+  PropagatorServer& operator=(const PropagatorServer&) = delete;
+
+  /**
+   * Create the socket and start accepting connections in a background thread.
+   * Any existing file at the socket path is removed.
+   */
+  void start();
+  /**
+   * Stop accepting connections and reading requests. Requests that were already received
+   * are finished and their responses are sent before the connections are closed.
+   * Responses that can not be sent within a second, because a client is not reading them,
+   * are discarded. The socket file is removed.
+   */
+  void stop();
+  bool isRunning() const;
+
+  /**
+   * Set the size of the largest request that will be read (64 MiB by default).
+   * A connection that sends a larger request is closed.
+   */
+  void        setMaxRequestSize(std::size_t a_bytes);
+  std::size_t getMaxRequestSize() const;
+  /**
+   * Set how much response data can be waiting to be sent on a connection (64 MiB by default).
+   * If a response is ready when more than this is waiting, the client is not reading its
+   * responses and the connection is closed.
+   */
+  void        setMaxPendingOutputSize(std::size_t a_bytes);
+  std::size_t getMaxPendingOutputSize() const;
+
+  Stats       getStats() const;
+  Propagator& getPropagator();
+};
+
+}  // namespace libGBP2
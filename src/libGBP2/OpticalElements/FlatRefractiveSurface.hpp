@@ -9,18 +9,18 @@ template<c::Length LengthUnit = t::cm>
 class FlatRefractiveSurface : public OpticalElement<LengthUnit>
 {
  public:
-  using L                 = LengthUnit;
-  FlatRefractiveSurface() = default;
+  using L                           = LengthUnit;
+  constexpr FlatRefractiveSurface() = default;
   template<c::Dimensionless U>
-  FlatRefractiveSurface(quantity<U> a_scale)
+  constexpr FlatRefractiveSurface(quantity<U> a_scale)
   {
     this->setRefractiveIndexScaleFactor(a_scale);
   }
   template<c::Dimensionless U>
-  void setRefractiveIndexScaleFactor(quantity<U> a_scale)
+  constexpr void setRefractiveIndexScaleFactor(quantity<U> a_scale)
   {
     OpticalElement<LengthUnit>::setRefractiveIndexScale(a_scale);
-    this->setD(1 / a_scale);
+    this->setD(1. / a_scale);
   }
 };
 }  // namespace libGBP2
@@ -1,5 +1,10 @@
 #pragma once
+#include <complex>
 #include <iostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 
 #include <boost/units/lambda.hpp>
 #include <boost/units/quantity.hpp>
@@ -7,10 +12,23 @@
 #include <Eigen/Dense>
 
 #include "../Units.hpp"
+#include "./RayTransferKernel.hpp"
 
 namespace libGBP2
 {
 
+/**
+ * An optical element described by a ray transfer (ABCD) matrix.
+ *
+ * The element data is stored in a kernel::RayTransfer, which uses plain
+ * doubles in a fixed unit (cm). This class is the unit-safe interface to it, LengthUnit
+ * only sets the default unit used by the getters.
+ *
+ * Everything except the Eigen matrix interface is constexpr, so elements (and products
+ * of elements) that are known at compile time can be evaluated at compile time:
+ *
+ * constexpr auto system = ThinLens(5. * i::cm) * FreeSpace(10. * i::cm) * ThinLens(5. * i::cm);
+ */
 template<c::Length LengthUnit = t::cm>
 class OpticalElement
 {
@@ -21,51 +39,56 @@ class OpticalElement
   using MatrixType = Eigen::Matrix<double, 2, 2>;
 
  private:
-  // we need to track these so we can figure out
-  // what the wavelength and beam waist position of
+  // the canonical units that element data is stored in
+  using CL = t::cm;
+  using CK = typename boost::units::divide_typeof_helper<t::dimensionless, CL>::type;
+
+  // we need to track the displacement and refractive index scale so we can
+  // figure out what the wavelength and beam waist position of
   // the beam emerging from the element are.
-  quantity<t::dimensionless> m_refractive_index_scale = 1 * i::dimensionless;
-  quantity<L>                m_displacement           = quantity<L>::from_value(0);
-  // store the matrix elements
-  quantity<t::dimensionless> m_A = 1 * i::dimensionless;
-  quantity<L>                m_B = quantity<L>::from_value(0);
-  quantity<K>                m_C = quantity<K>::from_value(0);
-  quantity<t::dimensionless> m_D = 1 * i::dimensionless;
+  kernel::RayTransfer m_kernel;
 
  public:
-  OpticalElement() = default;
+  constexpr OpticalElement() = default;
   // copy constructor  from element using same unit
-  OpticalElement(const OpticalElement &a_other) = default;
+  constexpr OpticalElement(const OpticalElement &a_other) = default;
   // copy constructor from element using different unit
   template<typename U>
-  OpticalElement(const OpticalElement<U> &a_other)
+  constexpr OpticalElement(const OpticalElement<U> &a_other)
+      : m_kernel(a_other.getRayTransferKernel())
   {
-    *this = a_other;
   }
   // assignment from an element using the same unti for length
-  OpticalElement &operator=(const OpticalElement &a_other) = default;
+  constexpr OpticalElement &operator=(const OpticalElement &a_other) = default;
   // assignment from an element using a different unit for length
   template<typename U>
-  OpticalElement &operator=(const OpticalElement<U> &a_other)
-  {
-    m_displacement           = a_other.template getDisplacement<L>();
-    m_refractive_index_scale = a_other.template getRefractiveIndexScale<t::dimensionless>();
-    m_A                      = a_other.template getA<t::dimensionless>();
-    m_B                      = a_other.template getB<L>();
-    m_C                      = a_other.template getC<K>();
-    m_D                      = a_other.template getD<t::dimensionless>();
+  constexpr OpticalElement &operator=(const OpticalElement<U> &a_other)
+  {
+    m_kernel = a_other.getRayTransferKernel();
     return *this;
   }
   OpticalElement(quantity<L>                a_dispalcement,
                  quantity<t::dimensionless> a_refractive_index_scale,
                  MatrixType                 a_mat)
-      : m_displacement(a_dispalcement),
-        m_refractive_index_scale(a_refractive_index_scale)
   {
-    m_A = quantity<t::dimensionless>::from_value(a_mat(0, 0));
-    m_B = quantity<L>::from_value(a_mat(0, 1));
-    m_C = quantity<K>::from_value(a_mat(1, 0));
-    m_D = quantity<t::dimensionless>::from_value(a_mat(1, 1));
+    this->setDisplacement(a_dispalcement);
+    this->setRefractiveIndexScale(a_refractive_index_scale);
+    this->setA(quantity<t::dimensionless>::from_value(a_mat(0, 0)));
+    this->setB(quantity<L>::from_value(a_mat(0, 1)));
+    this->setC(quantity<K>::from_value(a_mat(1, 0)));
+    this->setD(quantity<t::dimensionless>::from_value(a_mat(1, 1)));
+  }
+  constexpr explicit OpticalElement(const kernel::RayTransfer &a_kernel) noexcept
+      : m_kernel(a_kernel)
+  {
+  }
+
+  /**
+   * Return the unit-free element data. Lengths are in cm.
+   */
+  constexpr const kernel::RayTransfer &getRayTransferKernel() const noexcept
+  {
+    return m_kernel;
   }
 
   /**
@@ -75,15 +98,15 @@ class OpticalElement
    * position that the q-parameter going in did.
    */
   template<c::Length U>
-  void setDisplacement(quantity<U> a_displacement)
+  constexpr void setDisplacement(quantity<U> a_displacement)
   {
-    m_displacement = quantity<L>(a_displacement);
+    m_kernel.displacement = quantity<CL>(a_displacement).value();
   }
 
   template<c::Length U = L>
-  quantity<U> getDisplacement() const
+  constexpr quantity<U> getDisplacement() const
   {
-    return quantity<U>(m_displacement);
+    return quantity<U>(quantity<CL>::from_value(m_kernel.displacement));
   }
   /**
    * Set the refractive index scale induced by the element. i.e.
@@ -93,57 +116,56 @@ class OpticalElement
    * q-parameter going in did.
    */
   template<c::Dimensionless U>
-  void setRefractiveIndexScale(quantity<U> a_refractive_index_scale)
+  constexpr void setRefractiveIndexScale(quantity<U> a_refractive_index_scale)
   {
-    m_refractive_index_scale =
-        quantity<t::dimensionless>(a_refractive_index_scale);
+    m_kernel.refractive_index_scale = quantity<t::dimensionless>(a_refractive_index_scale).value();
   }
 
   template<c::Dimensionless U = t::dimensionless>
-  quantity<U> getRefractiveIndexScale() const
+  constexpr quantity<U> getRefractiveIndexScale() const
   {
-    return quantity<U>(m_refractive_index_scale);
+    return quantity<U>(quantity<t::dimensionless>::from_value(m_kernel.refractive_index_scale));
   }
 
   template<c::Dimensionless U>
-  void setA(quantity<U> a_A)
+  constexpr void setA(quantity<U> a_A)
   {
-    m_A = quantity<t::dimensionless>(a_A);
+    m_kernel.A = quantity<t::dimensionless>(a_A).value();
   }
   template<c::Length U>
-  void setB(quantity<U> a_B)
+  constexpr void setB(quantity<U> a_B)
   {
-    m_B = quantity<L>(a_B);
+    m_kernel.B = quantity<CL>(a_B).value();
   }
   template<c::InverseLength U>
-  void setC(quantity<U> a_C)
+  constexpr void setC(quantity<U> a_C)
   {
-    m_C = quantity<K>(a_C);
+    m_kernel.C = quantity<CK>(a_C).value();
   }
   template<c::Dimensionless U>
-  void setD(quantity<U> a_D)
+  constexpr void setD(quantity<U> a_D)
   {
-    m_D = quantity<t::dimensionless>(a_D);
+    m_kernel.D = quantity<t::dimensionless>(a_D).value();
   }
   template<c::Dimensionless U = t::dimensionless>
-  quantity<U> getA() const
+  constexpr quantity<U> getA() const
   {
-    return quantity<U>(m_A);
+    return quantity<U>(quantity<t::dimensionless>::from_value(m_kernel.A));
   }
   template<c::Length U = L>
-  quantity<U> getB() const
+  constexpr quantity<U> getB() const
   {
-    return quantity<U>(m_B);
+    return quantity<U>(quantity<CL>::from_value(m_kernel.B));
   }
   template<c::InverseLength U = K>
-  quantity<U> getC() const
+  constexpr quantity<U> getC() const
   {
-    return quantity<U>(m_C);
+    return quantity<U>(quantity<CK>::from_value(m_kernel.C));
   }
   template<c::Dimensionless U = t::dimensionless>
-  quantity<U> getD() const
+  constexpr quantity<U> getD() const
   {
-    return quantity<U>(m_D);
+    return quantity<U>(quantity<t::dimensionless>::from_value(m_kernel.D));
   }
   /**
    * Return the Ray Transfer Matrix for the element expressed in a given length
@@ -155,33 +177,53 @@ class OpticalElement
     using INVU =
         typename boost::units::divide_typeof_helper<t::dimensionless, U>::type;
     MatrixType mat;
-    mat << m_A.value(), quantity<U>(m_B).value(), quantity<INVU>(m_C).value(),
-        m_D.value();
+    mat << m_kernel.A, this->getB<U>().value(), this->getC<INVU>().value(),
+        m_kernel.D;
     return mat;
   }
 
   template<c::Length U>
-  OpticalElement<L> operator*(const OpticalElement<U> &a_right) const
+  constexpr OpticalElement<L> operator*(const OpticalElement<U> &a_right) const
   {
-    quantity<L> D =
-        this->getDisplacement() + a_right.template getDisplacement<L>();
-    quantity<t::dimensionless> N =
-        this->getRefractiveIndexScale() * a_right.getRefractiveIndexScale();
-    auto mat = this->getRayTransferMatrix<L>() *
-               a_right.template getRayTransferMatrix<L>();
-
-    return OpticalElement<L>(D, N, mat);
+    return OpticalElement<L>(kernel::compose(m_kernel, a_right.getRayTransferKernel()));
   }
 
   template<c::Length U>
-  quantity<U, std::complex<double>> operator*(quantity<U, std::complex<double>> &a_q) const
+  constexpr quantity<U, std::complex<double>> operator*(const quantity<U, std::complex<double>> &a_q) const
   {
-    auto                 mat         = this->getRayTransferMatrix<U>();
-    std::complex<double> numerator   = a_q.value() * mat(0, 0) + mat(0, 1);
-    std::complex<double> denominator = a_q.value() * mat(1, 0) + mat(1, 1);
-    std::complex<double> q_prime     = numerator / denominator;
+    if constexpr(std::is_same_v<U, CL>) {
+      return quantity<U, std::complex<double>>::from_value(kernel::apply(m_kernel, a_q.value()));
+    } else {
+      // scale q to canonical units and back
+      double scale = quantity<CL>(quantity<U>::from_value(1)).value();
+      return quantity<U, std::complex<double>>::from_value(kernel::apply(m_kernel, a_q.value() * scale) / scale);
+    }
+  }
 
-    return quantity<U, std::complex<double>>::from_value(q_prime);
+  /**
+   * Transform many complex beam parameters at once.
+   *
+   * The real and imaginary parts of each q (in units of U) are given in separate arrays,
+   * and the results are written to a_out_re and a_out_im, which can be the same arrays as the inputs.
+   * This computes the same thing as operator*(q) for each q, but the loop is vectorized and
+   * units are only handled once. To transform through a system, build it first (e.g. with
+   * CompiledOpticalSystem::build(...)) and call this on the result.
+   */
+  template<c::Length U = L>
+  void transformBeamParameters(std::span<const double> a_re, std::span<const double> a_im, std::span<double> a_out_re, std::span<double> a_out_im) const
+  {
+    if(a_im.size() != a_re.size() || a_out_re.size() != a_re.size() || a_out_im.size() != a_re.size()) {
+      throw std::runtime_error("Beam parameter arrays must all have the same size. Got " + std::to_string(a_re.size()) + ", " + std::to_string(a_im.size()) + ", " + std::to_string(a_out_re.size()) + ", and " + std::to_string(a_out_im.size()) + ".");
+    }
+    kernel::RayTransfer element = m_kernel;
+    if constexpr(!std::is_same_v<U, CL>) {
+      // q' = (A q + B) / (C q + D) with q in cm. writing q = s q_U gives
+      // q'_U = (A q_U + B / s) / (C s q_U + D), so scale B and C instead of every q.
+      double scale = quantity<CL>(quantity<U>::from_value(1)).value();
+      element.B /= scale;
+      element.C *= scale;
+    }
+    kernel::apply(element, a_re.size(), a_re.data(), a_im.data(), a_out_re.data(), a_out_im.data());
   }
 };
 }  // namespace libGBP2
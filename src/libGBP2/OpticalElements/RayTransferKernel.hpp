@@ -0,0 +1,101 @@
+#pragma once
+#include <complex>
+#include <cstddef>
+#include <utility>
+
+#include "../Simd.hpp"
+
+namespace libGBP2
+{
+/**
+ * Unit-free representation of an optical element that OpticalElement is built on.
+ *
+ * All lengths are in cm (the canonical unit) and stored as plain doubles, so composing
+ * two elements or transforming a q-parameter is just a handful of multiply-adds with
+ * no unit conversions. Code that needs units should go through OpticalElement.
+ */
+namespace kernel
+{
+struct RayTransfer {
+  double A                      = 1;
+  double B                      = 0;  // cm
+  double C                      = 0;  // 1/cm
+  double D                      = 1;
+  double displacement           = 0;  // cm
+  double refractive_index_scale = 1;
+};
+
+/**
+ * Return the element equivalent to a_right followed by a_left
+ * (i.e. the matrix product a_left * a_right).
+ */
+constexpr RayTransfer compose(const RayTransfer& a_left, const RayTransfer& a_right) noexcept
+{
+  return RayTransfer{a_left.A * a_right.A + a_left.B * a_right.C,
+                     a_left.A * a_right.B + a_left.B * a_right.D,
+                     a_left.C * a_right.A + a_left.D * a_right.C,
+                     a_left.C * a_right.B + a_left.D * a_right.D,
+                     a_left.displacement + a_right.displacement,
+                     a_left.refractive_index_scale * a_right.refractive_index_scale};
+}
+
+/**
+ * Transform a complex beam parameter (in cm): q' = (A q + B) / (C q + D).
+ */
+constexpr std::complex<double> apply(const RayTransfer& a_element, const std::complex<double>& a_q) noexcept
+{
+  // do the complex division by hand, std::complex division checks for inf/nan
+  // and is not inlined.
+  double nr  = a_q.real() * a_element.A + a_element.B;
+  double ni  = a_q.imag() * a_element.A;
+  double dr  = a_q.real() * a_element.C + a_element.D;
+  double di  = a_q.imag() * a_element.C;
+  double den = dr * dr + di * di;
+  return std::complex<double>((nr * dr + ni * di) / den, (ni * dr - nr * di) / den);
+}
+
+/**
+ * Transform a_n complex beam parameters (in cm) stored as separate real and imaginary arrays.
+ *
+ * This is the vectorized version of apply(...) for pushing many beams through
+ * the same element. The outputs can be the same arrays as the inputs.
+ */
+inline void apply(const RayTransfer& a_element, std::size_t a_n, const double* a_re, const double* a_im, double* a_out_re, double* a_out_im) noexcept
+{
+  simd::transform2(
+      a_n, a_out_re, a_out_im,
+      [&a_element](auto re, auto im) {
+        auto nr  = re * a_element.A + a_element.B;
+        auto ni  = im * a_element.A;
+        auto dr  = re * a_element.C + a_element.D;
+        auto di  = im * a_element.C;
+        auto den = dr * dr + di * di;
+        return std::make_pair((nr * dr + ni * di) / den, (ni * dr - nr * di) / den);
+      },
+      a_re, a_im);
+}
+
+/**
+ * Return the element that undoes a_element, i.e. compose(invert(a), a) is the identity.
+ */
+constexpr RayTransfer invert(const RayTransfer& a_element) noexcept
+{
+  double det = a_element.A * a_element.D - a_element.B * a_element.C;
+  return RayTransfer{a_element.D / det,
+                     -a_element.B / det,
+                     -a_element.C / det,
+                     a_element.A / det,
+                     -a_element.displacement,
+                     1 / a_element.refractive_index_scale};
+}
+
+/**
+ * Return the element for free space propagation over a_length cm.
+ */
+constexpr RayTransfer free_space(double a_length) noexcept
+{
+  return RayTransfer{1, a_length, 0, 1, a_length, 1};
+}
+
+}  // namespace kernel
+}  // namespace libGBP2
@@ -9,23 +9,23 @@ template<c::Length LengthUnit = t::cm>
 class ThinLens : public OpticalElement<LengthUnit>
 {
  public:
-  ThinLens() = default;
+  constexpr ThinLens() = default;
   template<c::Length U>
-  ThinLens(quantity<U> a_focal_length)
+  constexpr ThinLens(quantity<U> a_focal_length)
   {
     this->setFocalLength(a_focal_length);
   }
   using L = LengthUnit;
   template<c::Length U>
-  void setFocalLength(quantity<U> a_focal_length)
+  constexpr void setFocalLength(quantity<U> a_focal_length)
   {
-    this->setC(-1 / a_focal_length);
+    this->setC(-1. / a_focal_length);
   }
   template<c::Length U = L>
-  quantity<U>
+  constexpr quantity<U>
   getFocalLength() const
   {
-    return quantity<U>(-1 / this->getC());
+    return quantity<U>(-1. / this->getC());
   }
 };
 }  // namespace libGBP2
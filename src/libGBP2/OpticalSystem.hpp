@@ -8,6 +8,31 @@
 namespace libGBP2
 {
 
+namespace detail
+{
+/**
+ * Add an element at position a_z_elem to the product a_system, with free space
+ * propagation from the current position a_z to get to it, and move a_z past the element.
+ * Elements in front of a_z (i.e. inside the previous element) are skipped.
+ *
+ * OpticalSystem::build(...) and propagate_beam_through_system(...) both compose
+ * elements with this, so they multiply in the same order and give the same result.
+ */
+template<c::Length UR, c::Length L>
+void append_element(OpticalElement<UR> &a_system, quantity<L> &a_z, const quantity<L> &a_z_elem, const OpticalElement<L> &a_elem)
+{
+  // only add elements that are *at-or-after* current position
+  if(a_z_elem >= a_z) {
+    // add a free space propagation to get to the element
+    a_system = a_elem * FreeSpace(a_z_elem - a_z) * a_system;
+    // need to account for any displacment caused by the element itself.
+    // if the element has a 1 cm displacement for example, then we are
+    // 1 cm past the position of the element.
+    a_z = a_z_elem + a_elem.template getDisplacement<L>();
+  }
+}
+}  // namespace detail
+
 /**
  * A class for building an optical system.
  */
@@ -21,6 +46,14 @@ class OpticalSystem
   std::vector<std::pair<quantity<L>, OpticalElement<L>>> m_elements;
 
  public:
+  /**
+   * Return the (position, element) pairs in the system, sorted by position.
+   */
+  const std::vector<std::pair<quantity<L>, OpticalElement<L>>> &getElements() const
+  {
+    return m_elements;
+  }
+
   /**
    * Add an element to the system at a given position.
    */
@@ -56,15 +89,7 @@ class OpticalSystem
       if(elem.first > quantity<L>(a_z_end)) {
         break;
       }
-      // only add elements that are *at-or-after* current position
-      if(elem.first >= l_z) {
-        // add a free space propagation to get to the element
-        system = elem.second * FreeSpace(elem.first - l_z) * system;
-        // need to account for any displacment caused by the element itself.
-        // if the element has a 1 cm displacement for example, then we are
-        // 1 cm past the position of the element.
-        l_z = elem.first + elem.second.template getDisplacement<L>();
-      }
+      detail::append_element(system, l_z, elem.first, elem.second);
     }
     // add a free space propagation to the a_z_end position
     system = FreeSpace(quantity<L>(a_z_end) - l_z) * system;
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "./CircularGaussianLaserBeam.hpp"
+#include "./OpticalSystem.hpp"
+#include "./Propagation.hpp"
+#include "./ThreadPool.hpp"
+
+namespace libGBP2
+{
+
+/**
+ * Propagate a beam through an optical system for every combination of a set of parameters.
+ *
+ * A sweep has a base beam, a base optical system, a list of positions, and zero or more
+ * parameter axes. Each axis is a list of values and a function that applies a value to a
+ * copy of the beam and system. For example, to sweep the focal length of a lens at 10 cm:
+ *
+ *   ParameterSweep sweep(beam, system);
+ *   sweep.addSystemAxis(focal_lengths, [](OpticalSystem<t::cm>& system, double f) {
+ *     system.add(10 * i::cm, ThinLens(f * i::cm));
+ *   });
+ *   sweep.setPositions(positions);
+ *   auto widths = sweep.runBeamWidths();
+ *
+ * Results are stored in row-major order with the first axis varying slowest and the position
+ * varying fastest, i.e. shape() is {axis 1 size, axis 2 size, ..., number of positions}.
+ * The work is divided across a ThreadPool, but every result is computed exactly the same way it is in a serial run
+ * (see propagate_beam_through_system(...)), so the output does not depend on the number of threads.
+ */
+template<c::Length LengthUnit = t::cm>
+class ParameterSweep
+{
+ public:
+  using L                = LengthUnit;
+  using AxisFunctionType = std::function<void(CircularGaussianLaserBeam &, OpticalSystem<L> &, double)>;
+
+ private:
+  struct Axis {
+    std::vector<double> values;
+    AxisFunctionType    apply;
+  };
+
+  CircularGaussianLaserBeam    m_beam;
+  OpticalSystem<L>             m_system;
+  std::vector<quantity<t::cm>> m_positions;
+  std::vector<Axis>            m_axes;
+  std::size_t                  m_threads = 0;
+  std::unique_ptr<ThreadPool>  m_pool;
+
+  ThreadPool &pool()
+  {
+    if(!m_pool) {
+      m_pool = std::make_unique<ThreadPool>(m_threads);
+    }
+    return *m_pool;
+  }
+
+  /**
+   * Apply the axis values for combination a_index to copies of the base beam and system.
+   */
+  void setup(std::size_t a_index, CircularGaussianLaserBeam &a_beam, OpticalSystem<L> &a_system) const
+  {
+    a_beam   = m_beam;
+    a_system = m_system;
+    // the last axis varies fastest
+    std::vector<std::size_t> indices(m_axes.size());
+    for(std::size_t a = m_axes.size(); a > 0; --a) {
+      indices[a - 1] = a_index % m_axes[a - 1].values.size();
+      a_index /= m_axes[a - 1].values.size();
+    }
+    for(std::size_t a = 0; a < m_axes.size(); ++a) {
+      m_axes[a].apply(a_beam, a_system, m_axes[a].values[indices[a]]);
+    }
+  }
+
+  /**
+   * Run the sweep, calling a_store(output index, beam) for every result.
+   */
+  template<typename F>
+  void run(F &&a_store)
+  {
+    if(m_positions.size() == 0) {
+      throw std::runtime_error("No positions were given for the parameter sweep.");
+    }
+    std::size_t combinations = this->size() / m_positions.size();
+    std::size_t P            = m_positions.size();
+    ThreadPool &pool         = this->pool();
+
+    // split each combination into chunks of positions when there are not enough combinations
+    // to keep the pool busy. each chunk is swept independently.
+    std::size_t target         = 8 * std::max<std::size_t>(1, pool.size());
+    std::size_t chunks_per     = std::clamp<std::size_t>((target + combinations - 1) / combinations, 1, P);
+    std::size_t chunk_size     = (P + chunks_per - 1) / chunks_per;
+    chunks_per                 = (P + chunk_size - 1) / chunk_size;
+    std::size_t work_units     = combinations * chunks_per;
+    std::size_t units_per_task = std::max<std::size_t>(1, work_units / target);
+
+    pool.parallel_for(work_units, units_per_task, [&](std::size_t a_begin, std::size_t a_end) {
+      CircularGaussianLaserBeam beam;
+      OpticalSystem<L>          system;
+      std::size_t               last_combination = static_cast<std::size_t>(-1);
+      for(std::size_t u = a_begin; u < a_end; ++u) {
+        std::size_t combination = u / chunks_per;
+        std::size_t first       = (u % chunks_per) * chunk_size;
+        std::size_t last        = std::min(P, first + chunk_size);
+        if(combination != last_combination) {
+          this->setup(combination, beam, system);
+          last_combination = combination;
+        }
+        auto beams = propagate_beam_through_system(beam, system, std::span(m_positions).subspan(first, last - first));
+        for(std::size_t k = 0; k < beams.size(); ++k) {
+          a_store(combination * P + first + k, beams[k]);
+        }
+      }
+    });
+  }
+
+ public:
+  ParameterSweep(const CircularGaussianLaserBeam &a_beam, const OpticalSystem<L> &a_system)
+      : m_beam(a_beam), m_system(a_system)
+  {
+  }
+
+  /**
+   * Set the number of threads to use. Zero (the default) uses one thread per hardware thread.
+   */
+  void setNumberOfThreads(std::size_t a_threads)
+  {
+    m_threads = a_threads;
+    m_pool.reset();
+  }
+
+  /**
+   * Set the positions to compute the beam at. This is always the last (fastest varying) axis.
+   */
+  template<std::ranges::forward_range R>
+  void setPositions(const R &a_positions)
+  {
+    m_positions.clear();
+    for(const auto &z : a_positions) {
+      m_positions.push_back(quantity<t::cm>(z));
+    }
+  }
+
+  /**
+   * Add a parameter axis that modifies the beam and/or the optical system.
+   * Axes vary in the order they are added, the first axis varying slowest.
+   */
+  void addAxis(std::vector<double> a_values, AxisFunctionType a_func)
+  {
+    if(a_values.size() == 0) {
+      throw std::runtime_error("A parameter sweep axis must have at least one value.");
+    }
+    m_axes.push_back({std::move(a_values), std::move(a_func)});
+  }
+  /**
+   * Add a parameter axis that modifies the beam.
+   */
+  void addBeamAxis(std::vector<double> a_values, std::function<void(CircularGaussianLaserBeam &, double)> a_func)
+  {
+    this->addAxis(std::move(a_values), [a_func](CircularGaussianLaserBeam &a_beam, OpticalSystem<L> &, double a_val) { a_func(a_beam, a_val); });
+  }
+  /**
+   * Add a parameter axis that modifies the optical system.
+   */
+  void addSystemAxis(std::vector<double> a_values, std::function<void(OpticalSystem<L> &, double)> a_func)
+  {
+    this->addAxis(std::move(a_values), [a_func](CircularGaussianLaserBeam &, OpticalSystem<L> &a_system, double a_val) { a_func(a_system, a_val); });
+  }
+
+  /**
+   * Return the dimensions of the output.
+   */
+  std::vector<std::size_t> shape() const
+  {
+    std::vector<std::size_t> dims;
+    for(const auto &axis : m_axes) {
+      dims.push_back(axis.values.size());
+    }
+    dims.push_back(m_positions.size());
+    return dims;
+  }
+  /**
+   * Return the total number of outputs.
+   */
+  std::size_t size() const
+  {
+    std::size_t N = m_positions.size();
+    for(const auto &axis : m_axes) {
+      N *= axis.values.size();
+    }
+    return N;
+  }
+
+  /**
+   * Run the sweep and store the beam width (1/e^2 radius, in cm) for every parameter combination
+   * and position in a_output, which must have size() elements.
+   */
+  void runBeamWidths(std::span<double> a_output)
+  {
+    if(a_output.size() != this->size()) {
+      throw std::runtime_error("Output array has size " + std::to_string(a_output.size()) + ", but the parameter sweep has " + std::to_string(this->size()) + " outputs.");
+    }
+    this->run([&a_output](std::size_t a_i, const CircularGaussianLaserBeam &a_beam) {
+      a_output[a_i] = a_beam.getSecondMomentBeamWidth<t::cm>().value();
+    });
+  }
+  std::vector<double> runBeamWidths()
+  {
+    std::vector<double> output(this->size());
+    this->runBeamWidths(output);
+    return output;
+  }
+
+  /**
+   * Run the sweep and store the full beam for every parameter combination
+   * and position in a_output, which must have size() elements.
+   */
+  void runBeams(std::span<CircularGaussianLaserBeam> a_output)
+  {
+    if(a_output.size() != this->size()) {
+      throw std::runtime_error("Output array has size " + std::to_string(a_output.size()) + ", but the parameter sweep has " + std::to_string(this->size()) + " outputs.");
+    }
+    this->run([&a_output](std::size_t a_i, const CircularGaussianLaserBeam &a_beam) {
+      a_output[a_i] = a_beam;
+    });
+  }
+  std::vector<CircularGaussianLaserBeam> runBeams()
+  {
+    std::vector<CircularGaussianLaserBeam> output(this->size());
+    this->runBeams(output);
+    return output;
+  }
+};
+
+}  // namespace libGBP2
@@ -1,6 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <numeric>
+#include <ranges>
+#include <vector>
+
 #include "./CircularGaussianLaserBeam.hpp"
+#include "./CompiledOpticalSystem.hpp"
+#include "./EditableOpticalSystem.hpp"
 #include "./OpticalSystem.hpp"
 #include "./Units.hpp"
 namespace libGBP2
@@ -12,6 +19,79 @@ CircularGaussianLaserBeam propagate_beam_through_system(const CircularGaussianLa
   return transform_beam(a_beam, a_system.template build<t::cm>(0 * i::cm, a_position), a_fixed_coordinate_system);
 }
 
+/**
+ * Propagate a beam through a system to a set of positions.
+ *
+ * Gives the same result (bit-for-bit) as calling propagate_beam_through_system(...) for each position,
+ * but the system is only walked once. The element used for each position is carried forward
+ * from the previous position, so only elements crossed since the previous position (and the
+ * free space segment after them) need to be added. If the positions are not sorted, they
+ * are visited in sorted order and the beams are returned in the original order.
+ *
+ * Builds that let the compiler contract multiply-adds (e.g. -march=native with an FMA
+ * capable target) may fuse the two code paths differently. Compile with -ffp-contract=off
+ * if the results need to match exactly there.
+ *
+ * @param a_beam : the input beam
+ * @param a_system : the optical system
+ * @param a_positions : a range of positions
+ * @param a_fixed_coordinate_system : see transform_beam(...)
+ * @return a vector containing the beam at each position
+ */
+template<c::Length U1, std::ranges::forward_range R>
+  requires c::Length<typename std::ranges::range_value_t<R>::unit_type>
+std::vector<CircularGaussianLaserBeam> propagate_beam_through_system(const CircularGaussianLaserBeam& a_beam, const OpticalSystem<U1>& a_system, const R& a_positions, bool a_fixed_coordinate_system = false)
+{
+  std::vector<quantity<U1>> positions;
+  for(const auto& z : a_positions) {
+    positions.push_back(quantity<U1>(z));
+  }
+
+  std::vector<std::size_t> order(positions.size());
+  std::iota(order.begin(), order.end(), 0);
+  if(!std::is_sorted(positions.begin(), positions.end())) {
+    std::stable_sort(order.begin(), order.end(), [&positions](std::size_t a, std::size_t b) { return positions[a] < positions[b]; });
+  }
+
+  // this is the same loop that OpticalSystem::build(...) uses, but it is paused
+  // at each position so that the product up to that point can be reused. the
+  // elements and free space segments are multiplied in the same order, so the
+  // result is identical to a build(...) for each position.
+  const auto&                            elements = a_system.getElements();
+  auto                                   elem     = elements.begin();
+  quantity<U1>                           l_z      = quantity<U1>(0 * i::cm);
+  OpticalElement<t::cm>                  system;
+  std::vector<CircularGaussianLaserBeam> beams(positions.size());
+  for(std::size_t k : order) {
+    for(; elem != elements.end() && elem->first <= positions[k]; ++elem) {
+      detail::append_element(system, l_z, elem->first, elem->second);
+    }
+    beams[k] = transform_beam(a_beam, FreeSpace(positions[k] - l_z) * system, a_fixed_coordinate_system);
+  }
+
+  return beams;
+}
+
+/**
+ * Propagate a beam through a compiled optical system. Use this instead of
+ * passing an OpticalSystem directly when the same system will be evaluated
+ * at many positions.
+ */
+template<c::Length U1, c::Length U2>
+CircularGaussianLaserBeam propagate_beam_through_system(const CircularGaussianLaserBeam& a_beam, const CompiledOpticalSystem<U1>& a_system, const quantity<U2>& a_position, bool a_fixed_coordinate_system = false)
+{
+  return transform_beam(a_beam, a_system.template build<t::cm>(0 * i::cm, a_position), a_fixed_coordinate_system);
+}
+
+/**
+ * Propagate a beam through an editable optical system.
+ */
+template<c::Length U1, c::Length U2>
+CircularGaussianLaserBeam propagate_beam_through_system(const CircularGaussianLaserBeam& a_beam, const EditableOpticalSystem<U1>& a_system, const quantity<U2>& a_position, bool a_fixed_coordinate_system = false)
+{
+  return transform_beam(a_beam, a_system.template build<t::cm>(0 * i::cm, a_position), a_fixed_coordinate_system);
+}
+
 /**
  * Transform a Gaussian beam through an optical element.
  *
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <utility>
+
+#if defined(__has_include)
+#if __has_include(<experimental/simd>) && !defined(LIBGBP2_DISABLE_SIMD)
+#include <experimental/simd>
+#define LIBGBP2_HAVE_EXPERIMENTAL_SIMD 1
+#endif
+#endif
+
+namespace libGBP2
+{
+/**
+ * A thin wrapper around std::experimental::simd (the Parallelism TS v2) used by the
+ * batch kernels.
+ *
+ * The native width is picked by the compiler from the target flags (i.e. 4 doubles with -mavx2,
+ * 8 with -mavx512f). If the header is not available, or LIBGBP2_DISABLE_SIMD is defined,
+ * everything falls back to plain scalar loops.
+ */
+namespace simd
+{
+#ifdef LIBGBP2_HAVE_EXPERIMENTAL_SIMD
+using batch = std::experimental::native_simd<double>;
+#else
+using batch = double;
+#endif
+
+/**
+ * Return the number of doubles in a batch.
+ */
+constexpr std::size_t width()
+{
+#ifdef LIBGBP2_HAVE_EXPERIMENTAL_SIMD
+  return batch::size();
+#else
+  return 1;
+#endif
+}
+
+namespace detail
+{
+// kernel arguments are either an array that is indexed, or a scalar that is broadcast.
+template<typename V>
+struct access {
+  static double load(const double* a_ptr, std::size_t a_i) { return a_ptr[a_i]; }
+  static double load(double a_val, std::size_t) { return a_val; }
+  static void   store(double a_val, double* a_ptr, std::size_t a_i) { a_ptr[a_i] = a_val; }
+};
+#ifdef LIBGBP2_HAVE_EXPERIMENTAL_SIMD
+template<>
+struct access<batch> {
+  static batch load(const double* a_ptr, std::size_t a_i) { return batch(a_ptr + a_i, std::experimental::element_aligned); }
+  static batch load(double a_val, std::size_t) { return batch(a_val); }
+  static void  store(const batch& a_val, double* a_ptr, std::size_t a_i) { a_val.copy_to(a_ptr + a_i, std::experimental::element_aligned); }
+};
+#endif
+}  // namespace detail
+
+/**
+ * Evaluate a kernel element-wise and write the result to a_out[0..a_n).
+ *
+ * The kernel must be a generic callable that accepts either simd::batch or double
+ * arguments. Each input is either a pointer to an array with (at least) a_n elements, or
+ * a double that is used for every element. Math functions should be called unqualified
+ * (with `using std::sqrt;` etc. in scope) so that the simd overloads are found.
+ */
+template<typename F, typename... Args>
+void transform(std::size_t a_n, double* a_out, F&& a_kernel, const Args&... a_args)
+{
+  std::size_t i = 0;
+  if constexpr(width() > 1) {
+    for(; i + width() <= a_n; i += width()) {
+      detail::access<batch>::store(a_kernel(detail::access<batch>::load(a_args, i)...), a_out, i);
+    }
+  }
+  for(; i < a_n; ++i) {
+    a_out[i] = a_kernel(detail::access<double>::load(a_args, i)...);
+  }
+}
+
+/**
+ * Same as transform(...), but for kernels with two outputs. The kernel returns
+ * a std::pair that is written to a_out1 and a_out2.
+ */
+template<typename F, typename... Args>
+void transform2(std::size_t a_n, double* a_out1, double* a_out2, F&& a_kernel, const Args&... a_args)
+{
+  std::size_t i = 0;
+  if constexpr(width() > 1) {
+    for(; i + width() <= a_n; i += width()) {
+      auto out = a_kernel(detail::access<batch>::load(a_args, i)...);
+      detail::access<batch>::store(out.first, a_out1, i);
+      detail::access<batch>::store(out.second, a_out2, i);
+    }
+  }
+  for(; i < a_n; ++i) {
+    auto out  = a_kernel(detail::access<double>::load(a_args, i)...);
+    a_out1[i] = out.first;
+    a_out2[i] = out.second;
+  }
+}
+
+}  // namespace simd
+}  // namespace libGBP2
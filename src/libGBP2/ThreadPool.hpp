@@ -0,0 +1,8 @@
+#pragma once
+
+#include "../libGBP/utils/ThreadPool.hpp"
+
+namespace libGBP2
+{
+using libGBP::ThreadPool;
+}  // namespace libGBP2
@@ -0,0 +1,135 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <libGBP/BeamTransformations/ThinLens.hpp>
+#include <libGBP/GBPCalc.hpp>
+#include <libGBP/GaussianBeam.hpp>
+#include <libGBP/Media/LinearAbsorber.hpp>
+#include <libGBP/MediaStack.hpp>
+#include <libGBP/OpticalSystem.hpp>
+
+TEST_CASE("libGBP Benchmarks", "[benchmark][libGBP]")
+{
+  using namespace libGBP;
+
+  GaussianBeam beam;
+  beam.setWavelength(0.532 * um);
+  beam.setOneOverE2WaistDiameter(10 * um);
+  beam.setWaistPosition(-10 * cm);
+
+  BENCHMARK("GaussianBeam::transform, thin lens")
+  {
+    ThinLens<t::centimeter> lens;
+    lens.setFocalLength(10 * cm);
+    GaussianBeam beam2 = beam;
+    beam2.transform(&lens, 1 * cm);
+    return beam2;
+  };
+
+  for(int N : {10, 100, 1000}) {
+    OpticalSystem<t::centimeter> system;
+    MediaStack<t::centimeter>    stack;
+    for(int i = 0; i < N; ++i) {
+      std::shared_ptr<ThinLens<t::centimeter>> lens(new ThinLens<t::centimeter>());
+      lens->setFocalLength((10 + i) * cm);
+      system.addElement(lens, i * cm);
+
+      std::shared_ptr<LinearAbsorber<t::centimeter>> abs(new LinearAbsorber<t::centimeter>());
+      abs->setAbsorptionCoefficient((0.01 * (i % 10)) / cm);
+      stack.addBoundary(abs, i * cm);
+    }
+
+    BENCHMARK("OpticalSystem::transform, " + std::to_string(N) + " elements")
+    {
+      return system.transform(beam, 0 * cm, N * cm);
+    };
+
+    BENCHMARK("OpticalSystem::transform, " + std::to_string(N) + " elements, 2 in range")
+    {
+      return system.transform(beam, (N / 2) * cm, (N / 2 + 1) * cm);
+    };
+
+    OpticalSystem<t::centimeter, BeamTransformation_Variant<t::centimeter>> value_system;
+    for(auto& element : system.getElements()) {
+      value_system.addElement(*std::static_pointer_cast<ThinLens<t::centimeter>>(element.second), element.first);
+    }
+    BENCHMARK("OpticalSystem::transform, " + std::to_string(N) + " elements stored by value")
+    {
+      return value_system.transform(beam, 0 * cm, N * cm);
+    };
+
+    // build the same system with elements added in reverse order
+    OpticalSystem<t::centimeter>::ElementsType elements(system.getElements().rbegin(), system.getElements().rend());
+    BENCHMARK("OpticalSystem::addElement, " + std::to_string(N) + " elements")
+    {
+      OpticalSystem<t::centimeter> system2;
+      for(auto& element : elements) {
+        system2.addElement(element.second, element.first);
+      }
+      return system2.getElements().size();
+    };
+    BENCHMARK("OpticalSystem::addElements, " + std::to_string(N) + " elements")
+    {
+      OpticalSystem<t::centimeter> system2;
+      system2.addElements(elements.begin(), elements.end());
+      return system2.getElements().size();
+    };
+
+    BENCHMARK("MediaStack::getTransmission, " + std::to_string(N) + " boundaries")
+    {
+      return stack.getTransmission(-1 * cm, (N + 1) * cm);
+    };
+  }
+
+  for(int N : {10, 100, 1000}) {
+    ptree configTree;
+    configTree.put("beam.wavelength", 444);
+    configTree.put("beam.waist.position", 0);
+    configTree.put("beam.waist.diameter", 0.25);
+    configTree.put("beam.power", 0.800);
+    for(int i = 0; i < 10; ++i) {
+      configTree.put("optical_system.elements." + std::to_string(i) + ".position", 10 * (i + 1));
+      configTree.put("optical_system.elements." + std::to_string(i) + ".type", "Thin Lens");
+      configTree.put("optical_system.elements." + std::to_string(i) + ".focal_length", 12);
+      configTree.put("media_stack.media." + std::to_string(i) + ".type", "Linear Absorber");
+      configTree.put("media_stack.media." + std::to_string(i) + ".position", 10 * (i + 1));
+      configTree.put("media_stack.media." + std::to_string(i) + ".thickness", 1);
+      configTree.put("media_stack.media." + std::to_string(i) + ".absorption_coefficient", 0.1);
+    }
+    configTree.put("evaluation_points.z.min", 0);
+    configTree.put("evaluation_points.z.max", 110);
+    configTree.put("evaluation_points.z.n", N);
+
+    GBPCalc<t::centimeter> calculator;
+    calculator.configure(configTree);
+    double sum = 0;
+    calculator.sig_calculatedBeam.connect([&sum](const GaussianBeam& a_beam) { sum += a_beam.getPower().value(); });
+
+    BENCHMARK("GBPCalc::calculate, 10 elements, " + std::to_string(N) + " positions")
+    {
+      calculator.calculate();
+      return sum;
+    };
+
+    calculator.setNumThreads(0);
+    BENCHMARK("GBPCalc::calculate, 10 elements, " + std::to_string(N) + " positions, all threads")
+    {
+      calculator.calculate();
+      return sum;
+    };
+    calculator.sig_calculatedBeam.disconnect_all_slots();
+    calculator.sig_calculatedBeams.connect([&sum](std::span<const GaussianBeam> a_beams) {
+      for(const auto& beam : a_beams) {
+        sum += beam.getPower().value();
+      }
+    });
+    BENCHMARK("GBPCalc::calculate, 10 elements, " + std::to_string(N) + " positions, all threads, batch signal")
+    {
+      calculator.calculate();
+      return sum;
+    };
+  }
+}
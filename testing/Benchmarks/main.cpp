@@ -0,0 +1,255 @@
+/**
+ * Main for the libGBP_benchmarks executable.
+ *
+ * Usage:
+ *
+ *   libGBP_benchmarks [--json FILE] [Catch2 options...]
+ *
+ *     Run the benchmarks (all Catch2 options, i.e. test case filters, can be used).
+ *     If --json is given, the benchmark results are also written to FILE.
+ *
+ *   libGBP_benchmarks --compare BASELINE CURRENT [--threshold PERCENT]
+ *
+ *     Compare two result files written with --json. Benchmarks with a mean time that increased by more than
+ *     PERCENT (default 5) are reported as regressions, and the exit code is 1 if there are any regressions.
+ *
+ * Catch2's json reporter does not include benchmark results, so the results are collected
+ * from its xml reporter and converted.
+ */
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+
+#include <catch2/catch_session.hpp>
+
+namespace
+{
+struct BenchmarkResult {
+  std::string test_case;
+  std::string name;
+  double      mean_ns       = 0;
+  double      mean_lower_ns = 0;
+  double      mean_upper_ns = 0;
+  double      std_dev_ns    = 0;
+  std::size_t samples       = 0;
+  std::size_t iterations    = 0;
+
+  std::string key() const { return test_case + " / " + name; }
+};
+
+void collect_results(const boost::property_tree::ptree& a_tree, const std::string& a_test_case, std::vector<BenchmarkResult>& a_results)
+{
+  for(const auto& child : a_tree) {
+    if(child.first == "TestCase") {
+      collect_results(child.second, child.second.get<std::string>("<xmlattr>.name", ""), a_results);
+    } else if(child.first == "BenchmarkResults") {
+      BenchmarkResult result;
+      result.test_case     = a_test_case;
+      result.name          = child.second.get<std::string>("<xmlattr>.name");
+      result.samples       = child.second.get<std::size_t>("<xmlattr>.samples", 0);
+      result.iterations    = child.second.get<std::size_t>("<xmlattr>.iterations", 0);
+      result.mean_ns       = child.second.get<double>("mean.<xmlattr>.value");
+      result.mean_lower_ns = child.second.get<double>("mean.<xmlattr>.lowerBound", result.mean_ns);
+      result.mean_upper_ns = child.second.get<double>("mean.<xmlattr>.upperBound", result.mean_ns);
+      result.std_dev_ns    = child.second.get<double>("standardDeviation.<xmlattr>.value", 0);
+      a_results.push_back(result);
+    } else if(child.first != "<xmlattr>") {
+      collect_results(child.second, a_test_case, a_results);
+    }
+  }
+}
+
+std::string escape(const std::string& a_str)
+{
+  std::string out;
+  for(char c : a_str) {
+    if(c == '"' || c == '\\') {
+      out += '\\';
+    }
+    out += c;
+  }
+  return out;
+}
+
+void write_json(const std::vector<BenchmarkResult>& a_results, std::ostream& a_out)
+{
+  a_out << std::setprecision(10);
+  a_out << "{\n  \"benchmarks\": [";
+  for(std::size_t i = 0; i < a_results.size(); ++i) {
+    const auto& r = a_results[i];
+    a_out << (i > 0 ? "," : "") << "\n    {"
+          << "\"test_case\": \"" << escape(r.test_case) << "\", "
+          << "\"name\": \"" << escape(r.name) << "\", "
+          << "\"mean_ns\": " << r.mean_ns << ", "
+          << "\"mean_lower_ns\": " << r.mean_lower_ns << ", "
+          << "\"mean_upper_ns\": " << r.mean_upper_ns << ", "
+          << "\"std_dev_ns\": " << r.std_dev_ns << ", "
+          << "\"samples\": " << r.samples << ", "
+          << "\"iterations\": " << r.iterations << "}";
+  }
+  a_out << "\n  ]\n}\n";
+}
+
+std::vector<BenchmarkResult> read_json(const std::string& a_filename)
+{
+  boost::property_tree::ptree tree;
+  boost::property_tree::read_json(a_filename, tree);
+  std::vector<BenchmarkResult> results;
+  for(const auto& child : tree.get_child("benchmarks")) {
+    BenchmarkResult result;
+    result.test_case     = child.second.get<std::string>("test_case");
+    result.name          = child.second.get<std::string>("name");
+    result.mean_ns       = child.second.get<double>("mean_ns");
+    result.mean_lower_ns = child.second.get<double>("mean_lower_ns", result.mean_ns);
+    result.mean_upper_ns = child.second.get<double>("mean_upper_ns", result.mean_ns);
+    result.std_dev_ns    = child.second.get<double>("std_dev_ns", 0);
+    result.samples       = child.second.get<std::size_t>("samples", 0);
+    result.iterations    = child.second.get<std::size_t>("iterations", 0);
+    results.push_back(result);
+  }
+  return results;
+}
+
+std::string format_time(double a_ns)
+{
+  std::ostringstream out;
+  out << std::setprecision(4);
+  if(a_ns < 1e3) {
+    out << a_ns << " ns";
+  } else if(a_ns < 1e6) {
+    out << a_ns / 1e3 << " us";
+  } else if(a_ns < 1e9) {
+    out << a_ns / 1e6 << " ms";
+  } else {
+    out << a_ns / 1e9 << " s";
+  }
+  return out.str();
+}
+
+int compare(const std::string& a_baseline, const std::string& a_current, double a_threshold)
+{
+  auto baseline = read_json(a_baseline);
+  auto current  = read_json(a_current);
+
+  std::map<std::string, const BenchmarkResult*> baseline_results;
+  for(const auto& r : baseline) {
+    baseline_results[r.key()] = &r;
+  }
+
+  std::size_t width = 9;
+  for(const auto& r : current) {
+    width = std::max(width, r.key().size());
+  }
+
+  int regressions = 0;
+  std::cout << std::left << std::setw(width) << "benchmark"
+            << "  " << std::right << std::setw(12) << "baseline"
+            << "  " << std::setw(12) << "current"
+            << "  " << std::setw(9) << "change" << "\n";
+  for(const auto& r : current) {
+    auto it = baseline_results.find(r.key());
+    std::cout << std::left << std::setw(width) << r.key() << "  " << std::right;
+    if(it == baseline_results.end()) {
+      std::cout << std::setw(12) << "-"
+                << "  " << std::setw(12) << format_time(r.mean_ns) << "  " << std::setw(9) << "new" << "\n";
+      continue;
+    }
+    double             change = 100 * (r.mean_ns - it->second->mean_ns) / it->second->mean_ns;
+    std::ostringstream change_str;
+    change_str << std::fixed << std::setprecision(1) << std::showpos << change << "%";
+    std::cout << std::setw(12) << format_time(it->second->mean_ns)
+              << "  " << std::setw(12) << format_time(r.mean_ns)
+              << "  " << std::setw(9) << change_str.str();
+    if(change > a_threshold) {
+      std::cout << "  REGRESSION";
+      ++regressions;
+    }
+    std::cout << "\n";
+    baseline_results.erase(it);
+  }
+  for(const auto& r : baseline_results) {
+    std::cout << std::left << std::setw(width) << r.first << "  " << std::right
+              << std::setw(12) << format_time(r.second->mean_ns) << "  " << std::setw(12) << "-"
+              << "  " << std::setw(9) << "removed" << "\n";
+  }
+  std::cout << regressions << " regression(s) with threshold " << a_threshold << "%\n";
+  return regressions > 0 ? 1 : 0;
+}
+
+int usage(const char* a_name)
+{
+  std::cerr << "usage: " << a_name << " [--json FILE] [Catch2 options...]\n"
+            << "       " << a_name << " --compare BASELINE CURRENT [--threshold PERCENT]\n";
+  return 2;
+}
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  std::vector<std::string> args(argv, argv + argc);
+
+  if(args.size() > 1 && args[1] == "--compare") {
+    if(args.size() != 4 && !(args.size() == 6 && args[4] == "--threshold")) {
+      return usage(argv[0]);
+    }
+    try {
+      return compare(args[2], args[3], args.size() == 6 ? std::stod(args[5]) : 5.);
+    } catch(std::exception& e) {
+      std::cerr << "Error: " << e.what() << "\n";
+      return 2;
+    }
+  }
+
+  std::string json_file;
+  auto        json_arg = std::find(args.begin(), args.end(), "--json");
+  if(json_arg != args.end()) {
+    if(json_arg + 1 == args.end()) {
+      return usage(argv[0]);
+    }
+    json_file = *(json_arg + 1);
+    args.erase(json_arg, json_arg + 2);
+  }
+
+  std::string xml_file;
+  if(json_file.size() > 0) {
+    // keep the normal console output and write the xml results to a file for conversion
+    xml_file = json_file + ".xml";
+    args.push_back("--reporter");
+    args.push_back("console");
+    args.push_back("--reporter");
+    args.push_back("xml::out=" + xml_file);
+  }
+
+  std::vector<char*> catch_argv;
+  for(auto& arg : args) {
+    catch_argv.push_back(arg.data());
+  }
+  int result = Catch::Session().run(static_cast<int>(catch_argv.size()), catch_argv.data());
+
+  if(json_file.size() > 0) {
+    try {
+      boost::property_tree::ptree tree;
+      boost::property_tree::read_xml(xml_file, tree);
+      std::vector<BenchmarkResult> results;
+      collect_results(tree, "", results);
+      std::ofstream out(json_file);
+      write_json(results, out);
+      std::filesystem::remove(xml_file);
+    } catch(std::exception& e) {
+      std::cerr << "Error: could not write benchmark results to " << json_file << ": " << e.what() << "\n";
+      return 1;
+    }
+  }
+
+  return result;
+}
@@ -820,6 +820,7 @@ SCENARIO(
   }
 }
 
+#include <libGBP/BeamTransformations/BeamTransformation_Variant.hpp>
 #include <libGBP/BeamTransformations/SphericalInterface.hpp>
 #include <libGBP/BeamTransformations/ThinLens.hpp>
 #include <libGBP/Builders/BeamBuilder.hpp>
@@ -1323,6 +1324,130 @@ TEST_CASE("Optical Systems", "[OpticalSystem]")
     CHECK(beam->getOneOverE2WaistDiameter().value() ==
           Approx(beam2->getOneOverE2WaistDiameter().value()));
   }
+
+  SECTION("bulk insert and range transforms")
+  {
+    OpticalSystem<t::centimeter>               system, bulk_system;
+    OpticalSystem<t::centimeter>::ElementsType elements;
+    for (int i = 0; i < 20; ++i) {
+      std::shared_ptr<ThinLens<t::centimeter>> lens(
+          new ThinLens<t::centimeter>());
+      lens->setFocalLength((10 + i) * cm);
+      // add out of order, with two elements at each position
+      elements.push_back({((7 * i) % 20 / 2) * 1. * cm, lens});
+      system.addElement(lens, ((7 * i) % 20 / 2) * cm);
+    }
+    bulk_system.addElements(elements.begin(), elements.begin() + 10);
+    bulk_system.addElements(elements.begin() + 10, elements.end());
+
+    REQUIRE(system.getElements().size() == 20);
+    REQUIRE(bulk_system.getElements().size() == 20);
+    auto elem      = system.getElements().begin();
+    auto bulk_elem = bulk_system.getElements().begin();
+    for (int i = 0; i < 20; ++i, ++elem, ++bulk_elem) {
+      CHECK(elem->first.value() == Approx(i / 2).scale(1));
+      // elements at the same position are kept in the order they were added
+      CHECK(elem->second == bulk_elem->second);
+    }
+
+    GaussianBeam beam;
+    beam.setWavelength(0.532 * um);
+    beam.setOneOverE2WaistDiameter(10 * um);
+    beam.setWaistPosition(-10 * cm);
+
+    // only the elements at 3, 4 and 5 cm are applied
+    GaussianBeam beam2 = beam;
+    for (auto& e : system.getElements()) {
+      if (e.first >= 3. * cm && e.first <= 5. * cm)
+        beam2.transform(e.second.get(), e.first);
+    }
+    GaussianBeam beam3 = system.transform(beam, 30 * mm, 5 * cm);
+    CHECK(beam3.getWaistPosition().value() ==
+          Approx(beam2.getWaistPosition().value()));
+    CHECK(beam3.getOneOverE2WaistDiameter().value() ==
+          Approx(beam2.getOneOverE2WaistDiameter().value()));
+
+    // an empty range does not apply anything
+    beam3 = system.transform(beam, 5 * cm, 3 * cm);
+    CHECK(beam3.getWaistPosition().value() ==
+          Approx(beam.getWaistPosition().value()));
+    beam3 = system.transform(beam, 3.5 * cm, 3.9 * cm);
+    CHECK(beam3.getWaistPosition().value() ==
+          Approx(beam.getWaistPosition().value()));
+  }
+
+  SECTION("elements stored by value")
+  {
+    // a user defined element, which must be stored by pointer
+    class Expander : public ThinLens<t::centimeter>
+    {
+     public:
+      double getWavelengthScaleFactor() const { return 0.5; }
+    };
+
+    OpticalSystem<t::centimeter> system;
+    OpticalSystem<t::centimeter, BeamTransformation_Variant<t::centimeter> >
+        value_system;
+
+    ThinLens<t::centimeter> lens;
+    lens.setFocalLength(10 * cm);
+    system.addElement(std::make_shared<ThinLens<t::centimeter> >(lens), 1 * cm);
+    value_system.addElement(lens, 1 * cm);
+
+    SphericalInterface<t::centimeter> spherical;
+    spherical.setInitialRefractiveIndex(1);
+    spherical.setFinalRefractiveIndex(1.5);
+    spherical.setRadiusOfCurvature(5 * cm);
+    system.addElement(
+        std::make_shared<SphericalInterface<t::centimeter> >(spherical),
+        2 * cm);
+    value_system.addElement(spherical, 2 * cm);
+
+    FlatInterface<t::centimeter> flat;
+    flat.setInitialRefractiveIndex(1.5);
+    flat.setFinalRefractiveIndex(1);
+    system.addElement(std::make_shared<FlatInterface<t::centimeter> >(flat),
+                      3 * cm);
+    value_system.addElement(flat, 3 * cm);
+
+    Filter filter;
+    filter.setOpticalDensity(0.5);
+    system.addElement(std::make_shared<Filter>(filter), 4 * cm);
+    value_system.addElement(filter, 4 * cm);
+
+    Translation<t::centimeter> translation;
+    translation.setShift(1 * cm);
+    system.addElement(
+        std::make_shared<Translation<t::centimeter> >(translation), 5 * cm);
+    value_system.addElement(translation, 5 * cm);
+
+    auto expander = std::make_shared<Expander>();
+    expander->setFocalLength(-20 * cm);
+    system.addElement(expander, 6 * cm);
+    value_system.addElement(expander, 6 * cm);
+
+    CHECK(std::holds_alternative<ThinLens<t::centimeter> >(
+        value_system.getElements()[0].second));
+    CHECK(std::holds_alternative<BeamTransformation_ptr<t::centimeter> >(
+        value_system.getElements()[5].second));
+
+    GaussianBeam beam;
+    beam.setWavelength(0.532 * um);
+    beam.setOneOverE2WaistDiameter(10 * um);
+    beam.setWaistPosition(-10 * cm);
+    beam.setPower(1 * W);
+
+    GaussianBeam beam2 = system.transform(beam, 0 * cm, 10 * cm);
+    GaussianBeam beam3 = value_system.transform(beam, 0 * cm, 10 * cm);
+    CHECK(beam3.getWavelength().value() == beam2.getWavelength().value());
+    CHECK(beam3.getPower().value() == beam2.getPower().value());
+    CHECK(beam3.getWaistPosition().value() == beam2.getWaistPosition().value());
+    CHECK(beam3.getOneOverE2WaistDiameter().value() ==
+          beam2.getOneOverE2WaistDiameter().value());
+    CHECK(beam3.getPower().value() == Approx(pow(10, -0.5)));
+    CHECK(beam3.getWavelength().value() ==
+          Approx(beam.getWavelength().value() * 0.5));
+  }
 }
 
 #include <libGBP/Builders/MediaStackBuilder.hpp>
@@ -1463,6 +1588,90 @@ TEST_CASE("Media Stack")
     // zi and zf are both in behind the last boundary.
     CHECK(stack->getTransmission(3 * cm, 4 * cm) == Approx(1));
   }
+
+  SECTION("indexed and custom media")
+  {
+    // a custom media is not indexed, so a stack that contains one asks each media
+    // for its transmission.
+    class CustomAbsorber : public LinearAbsorber<t::centimeter>
+    {
+    };
+
+    MediaStack<t::centimeter> stack, custom_stack;
+
+    std::shared_ptr<LinearAbsorber<t::centimeter>> abs;
+    for (int i = 0; i < 5; i++) {
+      abs.reset(new LinearAbsorber<t::centimeter>());
+      abs->setAbsorptionCoefficient((i + 1) / cm);
+      stack.addBoundary(abs, i * cm);
+      custom_stack.addBoundary(abs, i * cm);
+    }
+    abs.reset(new CustomAbsorber());
+    abs->setAbsorptionCoefficient(0.5 / cm);
+    stack.addBoundary(Media_ptr<t::centimeter>(new BaseMedia<t::centimeter>()),
+                      10 * cm);
+    custom_stack.addBoundary(abs, 10 * cm);
+    abs->setAbsorptionCoefficient(0 / cm);
+
+    std::vector<double> z = {-2, 0, 0.5, 1, 2.5, 4, 4.5, 10, 12};
+    for (auto zi : z) {
+      for (auto zf : z) {
+        CHECK(stack.getTransmission(zi * cm, zf * cm) ==
+              Approx(custom_stack.getTransmission(zi * cm, zf * cm)));
+      }
+    }
+    CHECK(stack.getTransmission(-2 * cm, 12 * cm) ==
+          Approx(exp(-(1 + 2 + 3 + 4 + 5 * 6))));
+    CHECK(stack.getTransmission(0.5 * cm, 2.5 * cm) ==
+          Approx(exp(-(0.5 + 2 + 3 * 0.5))));
+
+    // media that is modified after it was added is used with its new coefficient.
+    abs.reset(new LinearAbsorber<t::centimeter>());
+    stack.setBackgroundMedia(abs);
+    abs->setAbsorptionCoefficient(1 / cm);
+    CHECK(stack.getTransmission(-2 * cm, -1 * cm) == Approx(exp(-1)));
+    CHECK(stack.getTransmission(-2 * cm, 2.5 * cm) ==
+          Approx(exp(-(2 + 1 + 2 + 3 * 0.5))));
+    stack.updateIndex();
+    CHECK(stack.getTransmission(-2 * cm, -1 * cm) == Approx(exp(-1)));
+
+    LinearAbsorber<t::centimeter> other;
+    other.setAbsorptionCoefficient(2 / cm);
+    *abs = other;
+    CHECK(stack.getTransmission(-2 * cm, -1 * cm) == Approx(exp(-2)));
+    CHECK(stack.getTransmission(0.5 * cm, 2.5 * cm) ==
+          Approx(exp(-(0.5 + 2 + 3 * 0.5))));
+    // the index is rebuilt with the new coefficient
+    CHECK(stack.isIndexed());
+    CHECK(!custom_stack.isIndexed());
+  }
+
+  SECTION("building another stack does not affect the index")
+  {
+    ptree configTree;
+    configTree.put("media.background.type", "linear absorber");
+    configTree.put("media.background.absorption_coefficient", 0.1);
+    configTree.put("media.0.type", "linear absorber");
+    configTree.put("media.0.position", 0);
+    configTree.put("media.0.absorption_coefficient", 1);
+
+    MediaStackBuilder<t::centimeter>           MSb;
+    std::shared_ptr<MediaStack<t::centimeter>> first(MSb.build(configTree));
+    REQUIRE(first->isIndexed());
+
+    // the builder sets the coefficients of the second stack's absorbers
+    configTree.put("media.0.absorption_coefficient", 2);
+    std::shared_ptr<MediaStack<t::centimeter>> second(MSb.build(configTree));
+
+    CHECK(first->isIndexed());
+    CHECK(first->getTransmission(-1 * cm, 1 * cm) == Approx(exp(-(0.1 + 1))));
+    CHECK(second->getTransmission(-1 * cm, 1 * cm) == Approx(exp(-(0.1 + 2))));
+
+    // a copy has its own index
+    MediaStack<t::centimeter> copy(*second);
+    CHECK(copy.isIndexed());
+    CHECK(copy.getTransmission(-1 * cm, 1 * cm) == Approx(exp(-(0.1 + 2))));
+  }
 }
 
 #include <libGBP/GBPCalc.hpp>
@@ -1543,6 +1752,157 @@ TEST_CASE("GBPCalc tests")
   CHECK(z_vals[4].value() == Approx(12));
 }
 
+TEST_CASE("GBPCalc calculate matches getBeam")
+{
+  ptree configTree;
+  configTree.put("beam.wavelength", 444);
+  configTree.put("beam.waist.position", 0);
+  configTree.put("beam.waist.diameter", 0.25);
+  configTree.put("beam.power", 0.800);
+
+  configTree.put("optical_system.elements.0.position", 15);
+  configTree.put("optical_system.elements.0.type", "Thin Lens");
+  configTree.put("optical_system.elements.0.focal_length", 12);
+  configTree.put("optical_system.elements.1.position", 40);
+  configTree.put("optical_system.elements.1.type", "Thin Lens");
+  configTree.put("optical_system.elements.1.focal_length", 20);
+
+  configTree.put("media_stack.media.0.type", "Linear Absorber");
+  configTree.put("media_stack.media.0.position", 15);
+  configTree.put("media_stack.media.0.thickness", 1);
+  configTree.put("media_stack.media.0.absorption_coefficient", 2);
+  configTree.put("media_stack.media.1.type", "Linear Absorber");
+  configTree.put("media_stack.media.1.position", 30);
+  configTree.put("media_stack.media.1.thickness", 20);
+  configTree.put("media_stack.media.1.absorption_coefficient", 0.1);
+
+  // unsorted, with repeats, points before the beam, and points on elements and boundaries
+  std::vector<double> points = {45, -5, 15, 16, 3, 15, 100, 0, 14.9999, 30, 40, 35, 50, 16};
+  for (size_t i = 0; i < points.size(); i++)
+    configTree.put("evaluation_points.z." + std::to_string(i), points[i]);
+
+  GBPCalc<t::centimeter> calculator;
+  calculator.configure(configTree);
+
+  std::vector<GaussianBeam> beams;
+  calculator.sig_calculatedBeam.connect(
+      [&beams](const GaussianBeam& beam) { beams.push_back(beam); });
+
+  SECTION("unsorted points")
+  {
+    calculator.calculate();
+  }
+
+  SECTION("sorted points")
+  {
+    std::sort(points.begin(), points.end());
+    for (size_t i = 0; i < points.size(); i++)
+      configTree.put("evaluation_points.z." + std::to_string(i), points[i]);
+    calculator.configure(configTree);
+    calculator.calculate();
+  }
+
+  REQUIRE(beams.size() == points.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    auto expected = calculator.getBeam(points[i] * cm);
+    CHECK(beams[i].getCurrentPosition().value() == Approx(points[i]));
+    CHECK(beams[i].getPower().value() == Approx(expected.getPower().value()));
+    CHECK(beams[i].getWaistPosition().value() ==
+          Approx(expected.getWaistPosition().value()));
+    CHECK(beams[i].getOneOverE2WaistDiameter().value() ==
+          Approx(expected.getOneOverE2WaistDiameter().value()));
+  }
+}
+
+TEST_CASE("GBPCalc parallel calculate")
+{
+  ptree configTree;
+  configTree.put("beam.wavelength", 444);
+  configTree.put("beam.waist.position", 0);
+  configTree.put("beam.waist.diameter", 0.25);
+  configTree.put("beam.power", 0.800);
+  for (int i = 0; i < 5; i++) {
+    configTree.put("optical_system.elements." + std::to_string(i) + ".position", 10 * (i + 1));
+    configTree.put("optical_system.elements." + std::to_string(i) + ".type", "Thin Lens");
+    configTree.put("optical_system.elements." + std::to_string(i) + ".focal_length", 12);
+    configTree.put("media_stack.media." + std::to_string(i) + ".type", "Linear Absorber");
+    configTree.put("media_stack.media." + std::to_string(i) + ".position", 10 * (i + 1));
+    configTree.put("media_stack.media." + std::to_string(i) + ".thickness", 1);
+    configTree.put("media_stack.media." + std::to_string(i) + ".absorption_coefficient", 0.1);
+  }
+  // unsorted points, some before the beam
+  for (int i = 0; i < 101; i++)
+    configTree.put("evaluation_points.z." + std::to_string(i), (i * 37) % 101 - 10);
+
+  GBPCalc<t::centimeter> calculator;
+  calculator.configure(configTree);
+  CHECK(calculator.getNumThreads() == 1);
+
+  std::vector<GaussianBeam> serial;
+  auto connection = calculator.sig_calculatedBeam.connect(
+      [&serial](const GaussianBeam& beam) { serial.push_back(beam); });
+  calculator.calculate();
+  connection.disconnect();
+  REQUIRE(serial.size() == 101);
+
+  for (size_t threads : {1, 3, 0}) {
+    calculator.setNumThreads(threads);
+
+    std::vector<GaussianBeam> beams, batch;
+    int                       num_batches = 0;
+    calculator.sig_calculatedBeam.connect(
+        [&beams](const GaussianBeam& beam) { beams.push_back(beam); });
+    calculator.sig_calculatedBeams.connect(
+        [&](std::span<const GaussianBeam> a_beams) {
+          num_batches++;
+          batch.assign(a_beams.begin(), a_beams.end());
+        });
+    calculator.calculate();
+    calculator.sig_calculatedBeam.disconnect_all_slots();
+    calculator.sig_calculatedBeams.disconnect_all_slots();
+
+    CHECK(num_batches == 1);
+    REQUIRE(beams.size() == serial.size());
+    REQUIRE(batch.size() == serial.size());
+    for (size_t i = 0; i < serial.size(); i++) {
+      CHECK(beams[i].getCurrentPosition() == serial[i].getCurrentPosition());
+      CHECK(beams[i].getPower() == serial[i].getPower());
+      CHECK(beams[i].getWaistPosition() == serial[i].getWaistPosition());
+      CHECK(batch[i].getOneOverE2WaistDiameter() ==
+            serial[i].getOneOverE2WaistDiameter());
+    }
+  }
+}
+
+#include <libGBP/utils/ThreadPool.hpp>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+TEST_CASE("ThreadPool")
+{
+  ThreadPool pool(3);
+  CHECK(pool.size() == 3);
+
+  // the same workers (and the calling thread) run every batch
+  std::mutex                mutex;
+  std::set<std::thread::id> ids;
+  int                       count = 0;
+  for (int batch = 0; batch < 3; batch++) {
+    pool.parallel_for(20, 1, [&](size_t, size_t) {
+      std::lock_guard<std::mutex> lock(mutex);
+      ids.insert(std::this_thread::get_id());
+      count++;
+    });
+  }
+  CHECK(count == 60);
+  CHECK(ids.size() <= 4);
+
+  CHECK_THROWS_AS(pool.parallel_for(
+                      3, 1,
+                      [](size_t, size_t) { throw std::runtime_error("failed"); }),
+                  std::runtime_error);
+}
+
 #include <libGBP/BeamTransformations/ThinLens.hpp>
 #include <libGBP/GaussianBeam.hpp>
 TEST_CASE("Gaussian Beam Examples", "[GuassianBeam,Examples]")
@@ -0,0 +1,116 @@
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <google/protobuf/arena.h>
+#include <libGBP2/MessageAPI/Messages.hpp>
+#include <libGBP2/MessageAPI/Propagator.hpp>
+
+#include "Messages.pb.h"
+
+/**
+ * Count heap allocations so that the benchmarks below can report them.
+ * This replaces the global operator new, so these benchmarks are built into their own
+ * executable (libGBP_allocation_benchmarks) and the other benchmarks use the default allocator.
+ */
+namespace
+{
+std::atomic<std::size_t> num_allocations{0};
+
+template<typename F>
+std::size_t count_allocations(F a_func)
+{
+  std::size_t before = num_allocations.load(std::memory_order_relaxed);
+  a_func();
+  return num_allocations.load(std::memory_order_relaxed) - before;
+}
+template<typename OUTPUT_MSG>
+void fill_beam_widths(OUTPUT_MSG* a_output, int a_N)
+{
+  a_output->mutable_return_status();
+  a_output->mutable_beam_widths()->Reserve(a_N);
+  for(int i = 0; i < a_N; ++i) {
+    auto width = a_output->add_beam_widths();
+    width->set_value(i);
+    width->set_unit("um");
+  }
+}
+}  // namespace
+
+void* operator new(std::size_t a_size)
+{
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  if(void* ptr = std::malloc(a_size == 0 ? 1 : a_size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+void operator delete(void* a_ptr) noexcept { std::free(a_ptr); }
+void operator delete(void* a_ptr, std::size_t) noexcept { std::free(a_ptr); }
+
+TEST_CASE("Propagator Allocation Benchmarks", "[benchmark][Propagator]")
+{
+  using namespace libGBP2;
+  Propagator propagator;
+
+  for(int N : {1000, 100000}) {
+    msg::Propagator_run_Input input_msg;
+    *input_msg.mutable_beam()->mutable_wavelength() << "532 nm";
+    *input_msg.mutable_beam()->mutable_beam_waist_width() << "10 um";
+    input_msg.mutable_beam()->set_beam_waist_width_type(msg::BEAM_WIDTH_TYPE_ONE_OVER_E_SQUARED_RADIUS);
+    *input_msg.mutable_beam()->mutable_beam_waist_position() << "0 cm";
+    *input_msg.mutable_beam()->mutable_beam_quality_factor() << "1";
+
+    for(int i = 0; i < 10; ++i) {
+      auto ptr = input_msg.mutable_optical_system()->add_elements();
+      *ptr->mutable_position() << std::to_string(1 + i) + " cm";
+      *ptr->mutable_element()->mutable_lens()->mutable_focal_length() << std::to_string(10 + i) + " cm";
+    }
+    for(int i = 0; i < N; ++i) {
+      auto ptr = input_msg.add_positions();
+      ptr->set_value(20. * i / N);
+      ptr->set_unit("cm");
+    }
+    std::string input = msg::serialize_message(input_msg, msg::serialization_format::PROTOBUF);
+    input_msg.set_return_full_beam_characterizations(true);
+    std::string full_input = msg::serialize_message(input_msg, msg::serialization_format::PROTOBUF);
+
+    // building the output on the heap (what the Propagator used to do) and on an arena (what it does now)
+    auto build_on_heap = [N]() {
+      msg::Propagator_run_Output output;
+      fill_beam_widths(&output, N);
+      return output.ByteSizeLong();
+    };
+    auto build_on_arena = [N]() {
+      google::protobuf::ArenaOptions options;
+      options.max_block_size = 4 * 1024 * 1024;
+      google::protobuf::Arena arena(options);
+      fill_beam_widths(google::protobuf::Arena::CreateMessage<msg::Propagator_run_Output>(&arena), N);
+      return arena.SpaceUsed();
+    };
+
+    std::cout << "Heap allocations for " << N << " positions:\n"
+              << std::setw(12) << count_allocations(build_on_heap) << "  build output on the heap\n"
+              << std::setw(12) << count_allocations(build_on_arena) << "  build output on an arena\n"
+              << std::setw(12) << count_allocations([&]() { propagator.run(input); }) << "  Propagator::run\n"
+              << std::setw(12) << count_allocations([&]() { propagator.run(full_input); }) << "  Propagator::run, full beams\n";
+
+    BENCHMARK("Build run output on the heap, " + std::to_string(N) + " positions")
+    {
+      return build_on_heap();
+    };
+    BENCHMARK("Build run output on an arena, " + std::to_string(N) + " positions")
+    {
+      return build_on_arena();
+    };
+    BENCHMARK("Propagator::run, binary, " + std::to_string(N) + " positions, full beams")
+    {
+      return propagator.run(full_input);
+    };
+  }
+}
@@ -0,0 +1,86 @@
+#include <complex>
+#include <vector>
+
+#include <BoostUnitDefinitions/Units.hpp>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <libGBP2/OpticalElements/FreeSpace.hpp>
+#include <libGBP2/OpticalElements/OpticalElement.hpp>
+#include <libGBP2/OpticalElements/ThinLens.hpp>
+
+TEST_CASE("OpticalElement Benchmarks", "[benchmark][OpticalElement]")
+{
+  using namespace libGBP2;
+
+  std::vector<OpticalElement<t::cm>> elements;
+  for(int i = 0; i < 100; ++i) {
+    elements.push_back(ThinLens<t::cm>((10 + i) * i::cm));
+    elements.push_back(FreeSpace<t::cm>(0.5 * i::cm));
+  }
+  std::vector<OpticalElement<t::mm>> mm_elements(elements.begin(), elements.end());
+
+  BENCHMARK("Chained operator*, 200 elements")
+  {
+    OpticalElement<t::cm> system;
+    for(const auto& elem : elements) {
+      system = elem * system;
+    }
+    return system;
+  };
+
+  BENCHMARK("Chained operator* with mixed units, 200 elements")
+  {
+    OpticalElement<t::cm> system;
+    for(const auto& elem : mm_elements) {
+      system = elem * system;
+    }
+    return system;
+  };
+
+  BENCHMARK("Chained operator*(q), 200 elements")
+  {
+    auto q = quantity<t::cm, std::complex<double>>::from_value(std::complex<double>(-10, 2));
+    for(const auto& elem : elements) {
+      q = elem * q;
+    }
+    return q;
+  };
+
+  std::vector<double> re(100000), im(100000);
+  for(std::size_t i = 0; i < re.size(); ++i) {
+    re[i] = -10 + 1e-4 * i;
+    im[i] = 2;
+  }
+  std::vector<quantity<t::cm, std::complex<double>>> qs;
+  for(std::size_t i = 0; i < re.size(); ++i) {
+    qs.push_back(quantity<t::cm, std::complex<double>>::from_value(std::complex<double>(re[i], im[i])));
+  }
+  OpticalElement<t::cm> system;
+  for(const auto& elem : elements) {
+    system = elem * system;
+  }
+
+  BENCHMARK("operator*(q), 100000 q values")
+  {
+    for(auto& q : qs) {
+      q = system * q;
+    }
+    return qs[0];
+  };
+
+  BENCHMARK("transformBeamParameters, 100000 q values")
+  {
+    system.transformBeamParameters(re, im, re, im);
+    return re[0];
+  };
+
+  BENCHMARK("Chained operator*(q) with mixed units, 200 elements")
+  {
+    auto q = quantity<t::mm, std::complex<double>>::from_value(std::complex<double>(-100, 20));
+    for(const auto& elem : elements) {
+      q = elem * q;
+    }
+    return q;
+  };
+}
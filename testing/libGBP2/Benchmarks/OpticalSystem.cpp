@@ -0,0 +1,72 @@
+#include <string>
+#include <vector>
+
+#include <BoostUnitDefinitions/Units.hpp>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <libGBP2/CircularGaussianLaserBeam.hpp>
+#include <libGBP2/OpticalElements/ThinLens.hpp>
+#include <libGBP2/OpticalSystem.hpp>
+#include <libGBP2/Propagation.hpp>
+
+TEST_CASE("OpticalSystem Benchmarks", "[benchmark][OpticalSystem]")
+{
+  using namespace libGBP2;
+
+  CircularGaussianLaserBeam beam;
+  beam.setWavelength(532 * i::nm);
+  beam.setBeamWaistWidth(make_width<OneOverESquaredRadius>(10 * i::um));
+  beam.setBeamQualityFactor(1.5 * i::dimensionless);
+
+  BENCHMARK("transform_beam, thin lens")
+  {
+    return transform_beam(beam, ThinLens(10. * i::cm));
+  };
+
+  for(int N : {10, 100, 1000}) {
+    OpticalSystem<t::cm> system;
+    for(int i = 0; i < N; ++i) {
+      system.add((1 + i) * i::cm, ThinLens((10 + i) * i::cm));
+    }
+
+    BENCHMARK("OpticalSystem::build, " + std::to_string(N) + " elements")
+    {
+      return system.build(0 * i::cm, (N + 1) * i::cm);
+    };
+
+    BENCHMARK("propagate_beam_through_system, " + std::to_string(N) + " elements, 1 position")
+    {
+      return propagate_beam_through_system(beam, system, (N + 1) * i::cm);
+    };
+
+    std::vector<quantity<t::cm>> positions;
+    for(int i = 0; i < 1000; ++i) {
+      positions.push_back(i * (N + 1) / 1000. * i::cm);
+    }
+    BENCHMARK("propagate_beam_through_system, " + std::to_string(N) + " elements, 1000 positions")
+    {
+      return propagate_beam_through_system(beam, system, positions);
+    };
+  }
+}
+
+TEST_CASE("Conventions Benchmarks", "[benchmark][Conventions]")
+{
+  using namespace libGBP2;
+
+  auto width = make_width<OneOverESquaredRadius>(10 * i::um);
+
+  BENCHMARK("GaussianBeamWidth::get, same convention and unit")
+  {
+    return width.get<OneOverESquaredRadius, t::um>();
+  };
+  BENCHMARK("GaussianBeamWidth::get, 1/e^2 radius to FWHM diameter")
+  {
+    return width.get<FWHMDiameter, t::um>();
+  };
+  BENCHMARK("GaussianBeamWidth::get, 1/e^2 radius in um to 1/e diameter in cm")
+  {
+    return width.get<OneOverEDiameter, t::cm>();
+  };
+}
@@ -0,0 +1,57 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <BoostUnitDefinitions/Units.hpp>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <libGBP2/CircularGaussianLaserBeam.hpp>
+#include <libGBP2/OpticalElements/ThickLens.hpp>
+#include <libGBP2/OpticalElements/ThinLens.hpp>
+#include <libGBP2/OpticalSystem.hpp>
+#include <libGBP2/ParameterSweep.hpp>
+
+TEST_CASE("ParameterSweep Benchmarks", "[benchmark][ParameterSweep]")
+{
+  using namespace libGBP2;
+
+  CircularGaussianLaserBeam beam;
+  beam.setWavelength(532 * i::nm);
+  beam.setBeamWaistWidth(make_width<OneOverESquaredRadius>(10 * i::um));
+
+  OpticalSystem<t::cm> system;
+  for(int i = 0; i < 20; ++i) {
+    system.add((1 + i) * i::cm, ThinLens((10 + i) * i::cm));
+  }
+
+  std::vector<quantity<t::cm>> positions;
+  for(int i = 0; i < 1000; ++i) {
+    positions.push_back(i * 0.025 * i::cm);
+  }
+  std::vector<double> focal_lengths;
+  for(int i = 0; i < 64; ++i) {
+    focal_lengths.push_back(1 + 0.1 * i);
+  }
+
+  ParameterSweep sweep(beam, system);
+  sweep.setPositions(positions);
+  sweep.addSystemAxis(focal_lengths, [](OpticalSystem<t::cm>& a_system, double a_f) {
+    a_system.add(12.5 * i::cm, ThickLens(1.5 * i::dimensionless, a_f * i::cm, 2 * i::mm, -a_f * i::cm));
+  });
+  std::vector<double> widths(sweep.size());
+
+  std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  for(std::size_t threads = 1;; threads = std::min(2 * threads, max_threads)) {
+    sweep.setNumberOfThreads(threads);
+    sweep.runBeamWidths(widths);  // start the pool outside of the benchmark
+    BENCHMARK("64 systems x 1000 positions, " + std::to_string(threads) + " threads")
+    {
+      sweep.runBeamWidths(widths);
+      return widths[0];
+    };
+    if(threads == max_threads) {
+      break;
+    }
+  }
+}
@@ -0,0 +1,175 @@
+#include <string>
+#include <vector>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <libGBP2/MessageAPI/Messages.hpp>
+#include <libGBP2/MessageAPI/Propagator.hpp>
+
+#include "Messages.pb.h"
+
+TEST_CASE("Propagator Benchmarks", "[benchmark][Propagator]")
+{
+  using namespace libGBP2;
+  Propagator propagator;
+
+  for(int N : {10, 1000, 100000}) {
+    msg::Propagator_run_Input input_msg;
+    *input_msg.mutable_beam()->mutable_wavelength() << "532 nm";
+    *input_msg.mutable_beam()->mutable_beam_waist_width() << "10 um";
+    input_msg.mutable_beam()->set_beam_waist_width_type(msg::BEAM_WIDTH_TYPE_ONE_OVER_E_SQUARED_RADIUS);
+    *input_msg.mutable_beam()->mutable_beam_waist_position() << "0 cm";
+    *input_msg.mutable_beam()->mutable_beam_quality_factor() << "1";
+
+    for(int i = 0; i < 10; ++i) {
+      auto ptr = input_msg.mutable_optical_system()->add_elements();
+      *ptr->mutable_position() << std::to_string(1 + i) + " cm";
+      *ptr->mutable_element()->mutable_lens()->mutable_focal_length() << std::to_string(10 + i) + " cm";
+    }
+    for(int i = 0; i < N; ++i) {
+      auto ptr = input_msg.add_positions();
+      ptr->set_value(20. * i / N);
+      ptr->set_unit("cm");
+    }
+    std::string input = msg::serialize_message(input_msg);
+
+    BENCHMARK("Propagator::run, 10 elements, " + std::to_string(N) + " positions")
+    {
+      return propagator.run(input);
+    };
+
+    Propagator cached_propagator;
+    cached_propagator.setResultCacheSize(64 * 1024 * 1024);
+    BENCHMARK("Propagator::run, 10 elements, " + std::to_string(N) + " positions, cached")
+    {
+      return cached_propagator.run(input);
+    };
+  }
+}
+
+TEST_CASE("Propagator Serialization Format Benchmarks", "[benchmark][Propagator]")
+{
+  using namespace libGBP2;
+  Propagator propagator;
+
+  msg::Propagator_run_Input input_msg;
+  *input_msg.mutable_beam()->mutable_wavelength() << "532 nm";
+  *input_msg.mutable_beam()->mutable_beam_waist_width() << "10 um";
+  input_msg.mutable_beam()->set_beam_waist_width_type(msg::BEAM_WIDTH_TYPE_ONE_OVER_E_SQUARED_RADIUS);
+  *input_msg.mutable_beam()->mutable_beam_waist_position() << "0 cm";
+  *input_msg.mutable_beam()->mutable_beam_quality_factor() << "1";
+  for(int i = 0; i < 10; ++i) {
+    auto ptr = input_msg.mutable_optical_system()->add_elements();
+    *ptr->mutable_position() << std::to_string(1 + i) + " cm";
+    *ptr->mutable_element()->mutable_lens()->mutable_focal_length() << std::to_string(10 + i) + " cm";
+  }
+  int N = 100000;
+  for(int i = 0; i < N; ++i) {
+    auto ptr = input_msg.add_positions();
+    ptr->set_value(20. * i / N);
+    ptr->set_unit("cm");
+  }
+
+  // serialize the input, run, and deserialize the output, the way a client would.
+  for(auto format : {msg::serialization_format::JSON, msg::serialization_format::PROTOBUF}) {
+    input_msg.set_return_full_beam_characterizations(false);
+    std::string name = format == msg::serialization_format::JSON ? "JSON" : "binary";
+    BENCHMARK("Propagator::run round trip, " + name + ", " + std::to_string(N) + " positions")
+    {
+      msg::Propagator_run_Output output_msg;
+      msg::deserialize_message(propagator.run(msg::serialize_message(input_msg, format)), output_msg);
+      return output_msg.beam_widths_size();
+    };
+    input_msg.set_return_full_beam_characterizations(true);
+    BENCHMARK("Propagator::run round trip, " + name + ", " + std::to_string(N) + " positions, full beams")
+    {
+      msg::Propagator_run_Output output_msg;
+      msg::deserialize_message(propagator.run(msg::serialize_message(input_msg, format)), output_msg);
+      return output_msg.beams_size();
+    };
+  }
+
+  // the same positions as a packed array
+  msg::Propagator_run_Input array_input_msg = input_msg;
+  array_input_msg.clear_positions();
+  array_input_msg.set_return_full_beam_characterizations(false);
+  array_input_msg.mutable_positions_array()->set_unit("cm");
+  for(int i = 0; i < N; ++i) {
+    array_input_msg.mutable_positions_array()->add_values(20. * i / N);
+  }
+  for(auto format : {msg::serialization_format::JSON, msg::serialization_format::PROTOBUF}) {
+    std::string name = format == msg::serialization_format::JSON ? "JSON" : "binary";
+    BENCHMARK("Propagator::run round trip, " + name + ", " + std::to_string(N) + " positions, packed arrays")
+    {
+      msg::Propagator_run_Output output_msg;
+      msg::deserialize_message(propagator.run(msg::serialize_message(array_input_msg, format)), output_msg);
+      return output_msg.beam_widths_array().values_size();
+    };
+  }
+}
+
+TEST_CASE("Propagator Batch Benchmarks", "[benchmark][Propagator]")
+{
+  using namespace libGBP2;
+  Propagator propagator;
+
+  // 100 beams through 10 systems, 100 positions each
+  msg::Propagator_batch_Input batch_msg;
+  for(int i = 0; i < 100; ++i) {
+    auto beam = batch_msg.add_beams();
+    *beam->mutable_wavelength() << "532 nm";
+    *beam->mutable_beam_waist_width() << std::to_string(10 + i) + " um";
+    beam->set_beam_waist_width_type(msg::BEAM_WIDTH_TYPE_ONE_OVER_E_SQUARED_RADIUS);
+    *beam->mutable_beam_waist_position() << "0 cm";
+    *beam->mutable_beam_quality_factor() << "1";
+  }
+  for(int i = 0; i < 10; ++i) {
+    auto ptr = batch_msg.add_optical_systems()->add_elements();
+    *ptr->mutable_position() << "1 cm";
+    *ptr->mutable_element()->mutable_lens()->mutable_focal_length() << std::to_string(10 + i) + " cm";
+  }
+  for(int i = 0; i < 100; ++i) {
+    auto ptr = batch_msg.add_positions();
+    ptr->set_value(20. * i / 100);
+    ptr->set_unit("cm");
+  }
+
+  std::vector<std::string> run_inputs;
+  for(int b = 0; b < batch_msg.beams_size(); ++b) {
+    for(int s = 0; s < batch_msg.optical_systems_size(); ++s) {
+      msg::Propagator_run_Input run_msg;
+      *run_msg.mutable_beam()           = batch_msg.beams(b);
+      *run_msg.mutable_optical_system() = batch_msg.optical_systems(s);
+      *run_msg.mutable_positions()      = batch_msg.positions();
+      run_inputs.push_back(msg::serialize_message(run_msg));
+    }
+  }
+  std::string batch_input = msg::serialize_message(batch_msg);
+
+  BENCHMARK("Propagator::run, 100 beams x 10 systems, 100 positions")
+  {
+    std::size_t size = 0;
+    for(auto& input : run_inputs) {
+      size += propagator.run(input).size();
+    }
+    return size;
+  };
+  propagator.batch(batch_input);  // start the thread pool outside of the benchmark
+  BENCHMARK("Propagator::batch, 100 beams x 10 systems, 100 positions")
+  {
+    return propagator.batch(batch_input);
+  };
+}
+
+TEST_CASE("Unit Conversion Benchmarks", "[benchmark][Messages]")
+{
+  using namespace libGBP2;
+  msg::Quantity quantity;
+  quantity << "532 nm";
+  msg::make_quantity<t::cm>(quantity);
+
+  BENCHMARK("make_quantity, cached unit")
+  {
+    return msg::make_quantity<t::cm>(quantity);
+  };
+}
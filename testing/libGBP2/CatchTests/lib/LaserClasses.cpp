@@ -6,6 +6,7 @@
 #include <catch2/catch_approx.hpp>
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_string.hpp>
+#include <libGBP2/CircularGaussianBeamBatch.hpp>
 #include <libGBP2/CircularGaussianLaserBeam.hpp>
 #include <libGBP2/CircularLaserBeam.hpp>
 #include <libGBP2/Conventions.hpp>
@@ -512,3 +513,83 @@ TEST_CASE("Complex Numbers")
   CHECK(b.real() == Approx(1. / 20));
   CHECK(b.imag() == Approx(-3. / 20));
 }
+
+TEST_CASE("CircularGaussianBeamBatch")
+{
+  using namespace libGBP2;
+
+  // use an odd number of beams/positions so that the scalar tail of the kernels is used too.
+  CircularGaussianBeamBatch              batch;
+  std::vector<CircularGaussianLaserBeam> beams;
+  for(int i = 0; i < 11; ++i) {
+    CircularGaussianLaserBeam beam;
+    beam.setWavelength((400 + 50 * i) * i::nm);
+    beam.setRefractiveIndex(1 + 0.05 * i);
+    beam.setBeamWaistWidth(make_width<OneOverESquaredDiameter>((1 + 0.1 * i) * i::mm));
+    beam.setBeamWaistPosition((i - 5) * i::cm);
+    beam.setBeamQualityFactor((1 + 0.2 * i) * i::dimensionless);
+    beams.push_back(beam);
+    batch.push_back(beam);
+  }
+  REQUIRE(batch.size() == 11);
+
+  std::vector<double> z;
+  for(int i = 0; i < 13; ++i) {
+    z.push_back(-200 + 33.3 * i);
+  }
+
+  SECTION("Round trip")
+  {
+    for(std::size_t i = 0; i < beams.size(); ++i) {
+      auto beam = batch.getBeam(i);
+      CHECK(beam.getWavelength<t::nm>().value() == Approx(beams[i].getWavelength<t::nm>().value()));
+      CHECK(beam.getRefractiveIndex().value() == Approx(beams[i].getRefractiveIndex().value()));
+      CHECK(beam.getBeamWaistWidth<t::mm>().get<OneOverESquaredDiameter>().value() == Approx(beams[i].getBeamWaistWidth<t::mm>().get<OneOverESquaredDiameter>().value()));
+      CHECK(beam.getBeamWaistPosition<t::cm>().value() == Approx(beams[i].getBeamWaistPosition<t::cm>().value()));
+      CHECK(beam.getBeamQualityFactor().value() == Approx(beams[i].getBeamQualityFactor().value()));
+      CHECK(batch.getDivergences()[i] == Approx(beams[i].getSecondMomentDivergence<t::rad>().value()));
+      CHECK(batch.getRayleighRanges()[i] == Approx(beams[i].getRayleighRange<t::cm>().value()));
+    }
+    CHECK_THROWS(batch.getBeam(11));
+  }
+
+  SECTION("One beam, many positions")
+  {
+    std::vector<double> width(z.size()), roc(z.size()), gouy(z.size()), re(z.size()), im(z.size());
+    for(std::size_t i = 0; i < beams.size(); ++i) {
+      batch.getBeamWidths(i, z, width);
+      batch.getRadiiOfCurvature(i, z, roc);
+      batch.getGouyPhases(i, z, gouy);
+      batch.getComplexBeamParameters(i, z, re, im);
+      for(std::size_t j = 0; j < z.size(); ++j) {
+        auto zz = z[j] * i::cm;
+        CHECK(width[j] == Approx(beams[i].getBeamWidth(zz).get<OneOverESquaredRadius>().value()));
+        CHECK(roc[j] == Approx(beams[i].getRadiusOfCurvature(zz).value()));
+        CHECK(gouy[j] == Approx(beams[i].getGouyPhase(zz).value()));
+        CHECK(re[j] == Approx(beams[i].getComplexBeamParameter(zz).value().real()));
+        CHECK(im[j] == Approx(beams[i].getComplexBeamParameter(zz).value().imag()));
+      }
+    }
+    std::vector<double> too_small(z.size() - 1);
+    CHECK_THROWS(batch.getBeamWidths(0, z, too_small));
+  }
+
+  SECTION("Many beams, one position")
+  {
+    std::vector<double> width(batch.size()), roc(batch.size()), gouy(batch.size()), re(batch.size()), im(batch.size());
+    for(std::size_t j = 0; j < z.size(); ++j) {
+      batch.getBeamWidths(z[j], width);
+      batch.getRadiiOfCurvature(z[j], roc);
+      batch.getGouyPhases(z[j], gouy);
+      batch.getComplexBeamParameters(z[j], re, im);
+      auto zz = z[j] * i::cm;
+      for(std::size_t i = 0; i < beams.size(); ++i) {
+        CHECK(width[i] == Approx(beams[i].getBeamWidth(zz).get<OneOverESquaredRadius>().value()));
+        CHECK(roc[i] == Approx(beams[i].getRadiusOfCurvature(zz).value()));
+        CHECK(gouy[i] == Approx(beams[i].getGouyPhase(zz).value()));
+        CHECK(re[i] == Approx(beams[i].getComplexBeamParameter(zz).value().real()));
+        CHECK(im[i] == Approx(beams[i].getComplexBeamParameter(zz).value().imag()));
+      }
+    }
+  }
+}
@@ -1,15 +1,20 @@
 
+#include <algorithm>
 #include <fstream>
+#include <span>
 
 #include <BoostUnitDefinitions/Units.hpp>
 
 #include <catch2/catch_approx.hpp>
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_string.hpp>
+#include <libGBP2/Analysis.hpp>
 #include <libGBP2/CircularGaussianLaserBeam.hpp>
 #include <libGBP2/CircularLaserBeam.hpp>
 #include <libGBP2/Conventions.hpp>
 #include <libGBP2/MonochromaticSource.hpp>
+#include <libGBP2/CompiledOpticalSystem.hpp>
+#include <libGBP2/EditableOpticalSystem.hpp>
 #include <libGBP2/OpticalElements/FlatRefractiveSurface.hpp>
 #include <libGBP2/OpticalElements/FreeSpace.hpp>
 #include <libGBP2/OpticalElements/OpticalElement.hpp>
@@ -62,6 +67,87 @@ TEST_CASE("OpticalElement")
     CHECK(mat(1, 1) == Approx(1));
   }
 
+  SECTION("Unit-free kernel")
+  {
+    OpticalElement<t::mm> element1;
+    element1.setB(2 * i::m);
+    element1.setC(2 * i::cm_n1);
+    element1.setDisplacement(3 * i::mm);
+
+    // kernel is always in cm
+    auto k = element1.getRayTransferKernel();
+    CHECK(k.A == Approx(1));
+    CHECK(k.B == Approx(200));
+    CHECK(k.C == Approx(2));
+    CHECK(k.D == Approx(1));
+    CHECK(k.displacement == Approx(0.3));
+    CHECK(k.refractive_index_scale == Approx(1));
+
+    auto product = kernel::compose(kernel::free_space(10), k);
+    CHECK(product.A == Approx(21));
+    CHECK(product.B == Approx(210));
+    CHECK(product.C == Approx(2));
+    CHECK(product.D == Approx(1));
+    CHECK(product.displacement == Approx(10.3));
+
+    auto identity = kernel::compose(kernel::invert(product), product);
+    CHECK(identity.A == Approx(1));
+    CHECK(identity.B == Approx(0).scale(1));
+    CHECK(identity.C == Approx(0).scale(1));
+    CHECK(identity.D == Approx(1));
+    CHECK(identity.displacement == Approx(0).scale(1));
+
+    std::complex<double> q(-10, 2);
+    auto                 q2 = kernel::apply(kernel::free_space(10), q);
+    CHECK(q2.real() == Approx(0).scale(1));
+    CHECK(q2.imag() == Approx(2));
+    q2 = kernel::apply(k, q);
+    CHECK(q2.real() == Approx(((q * 1. + 200.) / (q * 2. + 1.)).real()));
+    CHECK(q2.imag() == Approx(((q * 1. + 200.) / (q * 2. + 1.)).imag()));
+  }
+
+  SECTION("Transform many beam parameters")
+  {
+    OpticalSystem<t::cm> system;
+    system.add(2 * i::cm, ThinLens(10 * i ::mm));
+    system.add(5 * i::cm, ThickLens(1.5 * i::dimensionless, 40. * i::mm, 4 * i::mm, -40 * i::mm));
+    CompiledOpticalSystem<t::cm> compiled(system);
+    auto                         element = compiled.build(10 * i::cm);
+
+    // odd size so that the scalar tail of the simd loop is used
+    std::vector<double> re(103), im(103), out_re(103), out_im(103);
+    for(std::size_t i = 0; i < re.size(); ++i) {
+      re[i] = -1. + 0.01 * i;
+      im[i] = 0.05 + 0.001 * i;
+    }
+
+    element.transformBeamParameters(re, im, out_re, out_im);
+    for(std::size_t i = 0; i < re.size(); ++i) {
+      auto q = element * quantity<t::cm, std::complex<double>>::from_value({re[i], im[i]});
+      CHECK(out_re[i] == Approx(q.value().real()));
+      CHECK(out_im[i] == Approx(q.value().imag()));
+    }
+
+    // q in mm
+    element.transformBeamParameters<t::mm>(re, im, out_re, out_im);
+    for(std::size_t i = 0; i < re.size(); ++i) {
+      auto q = element * quantity<t::mm, std::complex<double>>::from_value({re[i], im[i]});
+      CHECK(out_re[i] == Approx(q.value().real()));
+      CHECK(out_im[i] == Approx(q.value().imag()));
+    }
+
+    // in place
+    auto expected_re = out_re;
+    auto expected_im = out_im;
+    element.transformBeamParameters<t::mm>(re, im, re, im);
+    for(std::size_t i = 0; i < re.size(); ++i) {
+      CHECK(re[i] == Approx(expected_re[i]));
+      CHECK(im[i] == Approx(expected_im[i]));
+    }
+
+    CHECK_THROWS_AS(element.transformBeamParameters(re, im, std::span(out_re).first(10), out_im), std::runtime_error);
+  }
+
   SECTION("Multiply and Assign")
   {
     SECTION("Homogeneous Units")
@@ -150,6 +236,87 @@ TEST_CASE("OpticalElement")
   }
 }
 
+namespace
+{
+// Approx is not usable in constant expressions
+constexpr bool is_close(double a_val, double a_expected, double a_epsilon = 1e-12)
+{
+  double diff  = a_val > a_expected ? a_val - a_expected : a_expected - a_val;
+  double scale = a_expected > 0 ? a_expected : -a_expected;
+  return diff <= a_epsilon * (scale > 1 ? scale : 1);
+}
+}  // namespace
+
+TEST_CASE("Compile-time Optical Elements")
+{
+  using namespace libGBP2;
+
+  SECTION("Elements")
+  {
+    constexpr ThinLens<t::cm> lens(10. * i::cm);
+    static_assert(is_close(lens.getC().value(), -0.1));
+    static_assert(is_close(lens.getFocalLength<t::mm>().value(), 100));
+
+    constexpr FreeSpace<t::cm> space(2. * i::mm);
+    static_assert(is_close(space.getB().value(), 0.2));
+    static_assert(is_close(space.getDisplacement().value(), 0.2));
+
+    constexpr FlatRefractiveSurface<t::cm> flat(1.5 * i::dimensionless);
+    static_assert(is_close(flat.getD().value(), 1 / 1.5));
+    static_assert(is_close(flat.getRefractiveIndexScale().value(), 1.5));
+
+    constexpr SphericalRefractiveSurface<t::cm> surface(1.5 * i::dimensionless, 40. * i::mm);
+    static_assert(is_close(surface.getC().value(), -1. / 12.0));
+    static_assert(is_close(surface.getD().value(), 1 / 1.5));
+
+    // compare to the same elements built at runtime
+    ThinLens<t::cm>                   rt_lens(10. * i::cm);
+    SphericalRefractiveSurface<t::cm> rt_surface(1.5 * i::dimensionless, 40. * i::mm);
+    CHECK(lens.getC().value() == rt_lens.getC().value());
+    CHECK(surface.getC().value() == rt_surface.getC().value());
+    CHECK(surface.getD().value() == rt_surface.getD().value());
+  }
+
+  SECTION("Thick lens")
+  {
+    constexpr ThickLens<t::cm> lens(1.5 * i::dimensionless, 40. * i::mm, 4. * i::mm, -40. * i::mm);
+    // effective focal length is 40.677966 mm
+    static_assert(is_close(lens.getC<t::cm_n1>().value(), -1 / 4.0677966101694915));
+    static_assert(is_close(lens.getDisplacement<t::mm>().value(), 4));
+    static_assert(is_close(lens.getRefractiveIndexScale().value(), 1));
+
+    ThickLens<t::cm> rt_lens(1.5 * i::dimensionless, 40. * i::mm, 4. * i::mm, -40. * i::mm);
+    CHECK(lens.getA().value() == rt_lens.getA().value());
+    CHECK(lens.getB().value() == rt_lens.getB().value());
+    CHECK(lens.getC().value() == rt_lens.getC().value());
+    CHECK(lens.getD().value() == rt_lens.getD().value());
+  }
+
+  SECTION("Fixed system")
+  {
+    // a Keplerian telescope collapses to a single element at compile time
+    constexpr auto telescope = ThinLens<t::cm>(5. * i::cm) * FreeSpace<t::cm>(15. * i::cm) * ThinLens<t::cm>(10. * i::cm);
+    static_assert(is_close(telescope.getA().value(), -0.5));
+    static_assert(is_close(telescope.getB().value(), 15));
+    static_assert(is_close(telescope.getC().value(), 0));
+    static_assert(is_close(telescope.getD().value(), -2));
+    static_assert(is_close(telescope.getDisplacement().value(), 15));
+
+    constexpr auto q = telescope * quantity<t::cm, std::complex<double>>::from_value(std::complex<double>(0, 2));
+    static_assert(is_close(q.value().real(), -7.5));
+    static_assert(is_close(q.value().imag(), 0.5));
+
+    OpticalSystem<t::cm> system;
+    system.add(0 * i::cm, ThinLens(10 * i::cm));
+    system.add(15 * i::cm, ThinLens(5 * i::cm));
+    auto rt_telescope = system.build();
+    CHECK(telescope.getA().value() == Approx(rt_telescope.getA().value()));
+    CHECK(telescope.getB().value() == Approx(rt_telescope.getB().value()));
+    CHECK(telescope.getC().value() == Approx(rt_telescope.getC().value()).scale(1));
+    CHECK(telescope.getD().value() == Approx(rt_telescope.getD().value()));
+  }
+}
+
 TEST_CASE("Optical Element Transformations")
 {
   using namespace libGBP2;
@@ -432,6 +599,239 @@ TEST_CASE("Optical System")
   }
 }
 
+TEST_CASE("Compiled Optical System")
+{
+  using namespace libGBP2;
+  OpticalSystem system;
+
+  auto check_builds = [](const OpticalSystem<t::cm>& a_system, const CompiledOpticalSystem<t::cm>& a_compiled, double a_zmin, double a_zmax) {
+    int N = 40;
+    for(int i = 0; i <= N; ++i) {
+      for(int j = 0; j <= N; ++j) {
+        auto z0 = (a_zmin + (a_zmax - a_zmin) * i / N) * i::cm;
+        auto z1 = (a_zmin + (a_zmax - a_zmin) * j / N) * i::cm;
+
+        auto expected = a_system.build(z0, z1);
+        auto actual   = a_compiled.build(z0, z1);
+
+        auto mat1 = expected.getRayTransferMatrix();
+        auto mat2 = actual.getRayTransferMatrix();
+
+        CHECK(mat2(0, 0) == Approx(mat1(0, 0)).margin(1e-10));
+        CHECK(mat2(0, 1) == Approx(mat1(0, 1)).margin(1e-10));
+        CHECK(mat2(1, 0) == Approx(mat1(1, 0)).margin(1e-10));
+        CHECK(mat2(1, 1) == Approx(mat1(1, 1)).margin(1e-10));
+        CHECK(actual.getDisplacement().value() == Approx(expected.getDisplacement().value()).margin(1e-10));
+        CHECK(actual.getRefractiveIndexScale().value() == Approx(expected.getRefractiveIndexScale().value()));
+      }
+    }
+  };
+
+  SECTION("Empty system")
+  {
+    CompiledOpticalSystem compiled(system);
+    CHECK(compiled.size() == 0);
+    check_builds(system, compiled, -10, 10);
+  }
+
+  SECTION("Thin lenses")
+  {
+    system.add(0 * i::cm, ThinLens(8 * i::cm));
+    system.add(10 * i::cm, ThinLens(2 * i::cm));
+    system.add(20 * i::cm, ThinLens(-2 * i::cm));
+    system.add(20 * i::cm, ThinLens(5 * i::cm));
+
+    CompiledOpticalSystem compiled(system);
+    CHECK(compiled.size() == 4);
+    check_builds(system, compiled, -5, 30);
+
+    CHECK(compiled.build().getRayTransferMatrix()(1, 0) == Approx(system.build().getRayTransferMatrix()(1, 0)));
+    CHECK(compiled.build(25 * i::cm).getRayTransferMatrix()(0, 1) == Approx(system.build(25 * i::cm).getRayTransferMatrix()(0, 1)));
+  }
+
+  SECTION("Refractive surfaces")
+  {
+    system.add(0 * i::cm, SphericalRefractiveSurface(1.5 * i::dimensionless, 8 * i::cm));
+    system.add(2 * i::cm, SphericalRefractiveSurface(1 / 1.5 * i::dimensionless, -8 * i::cm));
+    system.add(10 * i::cm, FlatRefractiveSurface(1.3 * i::dimensionless));
+
+    CompiledOpticalSystem compiled(system);
+    check_builds(system, compiled, -5, 15);
+  }
+
+  SECTION("Elements that include a thickness")
+  {
+    // the thin lens sits inside the thick lens, so it is skipped unless
+    // the build starts on it.
+    system.add(0 * i::cm, ThickLens(1.5 * i::dimensionless, 10 * i::cm, 5 * i::cm, -10 * i::cm));
+    system.add(2 * i::cm, ThinLens(3 * i::cm));
+    system.add(8 * i::cm, ThinLens(4 * i::cm));
+
+    CompiledOpticalSystem compiled(system);
+    check_builds(system, compiled, -5, 15);
+  }
+
+  SECTION("Long chain of strong elements")
+  {
+    // builds that start inside the system compose the elements between the start
+    // and the end, so they are as accurate as OpticalSystem::build.
+    for(int i = 0; i < 300; ++i) {
+      system.add(i * i::cm, ThinLens((i % 2 == 0 ? 0.3 : -0.2) * i::cm));
+    }
+    CompiledOpticalSystem compiled(system);
+
+    for(double z0 : {-1., 0., 0.5, 37., 150.25, 298.}) {
+      for(double z1 : {z0, z0 + 1.5, z0 + 17, 299.5}) {
+        auto expected = system.build(z0 * i::cm, z1 * i::cm).getRayTransferMatrix();
+        auto actual   = compiled.build(z0 * i::cm, z1 * i::cm).getRayTransferMatrix();
+        for(int r = 0; r < 2; ++r) {
+          for(int c = 0; c < 2; ++c) {
+            CHECK(actual(r, c) == Approx(expected(r, c)).epsilon(1e-9).margin(1e-12 * expected.norm()));
+          }
+        }
+      }
+    }
+  }
+
+  SECTION("Mixed units")
+  {
+    OpticalSystem<t::mm> mm_system;
+    mm_system.add(0 * i::mm, ThinLens(-5 * i::mm));
+    mm_system.add(45 * i::mm, ThinLens(50 * i::mm));
+
+    CompiledOpticalSystem<t::cm> compiled(mm_system);
+    auto                         mat1 = mm_system.build<t::cm>(0 * i::cm, 10 * i::cm).getRayTransferMatrix();
+    auto                         mat2 = compiled.build(0 * i::cm, 10 * i::cm).getRayTransferMatrix();
+    CHECK(mat2(0, 0) == Approx(mat1(0, 0)).margin(1e-10));
+    CHECK(mat2(0, 1) == Approx(mat1(0, 1)).margin(1e-10));
+    CHECK(mat2(1, 0) == Approx(mat1(1, 0)).margin(1e-10));
+    CHECK(mat2(1, 1) == Approx(mat1(1, 1)).margin(1e-10));
+  }
+}
+
+TEST_CASE("Editable Optical System")
+{
+  using namespace libGBP2;
+
+  auto check_builds = [](const EditableOpticalSystem<t::cm>& a_editable, const std::vector<std::pair<double, OpticalElement<t::cm>>>& a_elements) {
+    OpticalSystem<t::cm> system;
+    for(const auto& elem : a_elements) {
+      system.add(elem.first * i::cm, elem.second);
+    }
+    REQUIRE(a_editable.size() == a_elements.size());
+
+    int N = 25;
+    for(int i = 0; i <= N; ++i) {
+      for(int j = 0; j <= N; ++j) {
+        auto z0 = (-5 + 40. * i / N) * i::cm;
+        auto z1 = (-5 + 40. * j / N) * i::cm;
+
+        auto expected = system.build(z0, z1);
+        auto actual   = a_editable.build(z0, z1);
+
+        CHECK(actual.getA().value() == Approx(expected.getA().value()).margin(1e-9));
+        CHECK(actual.getB().value() == Approx(expected.getB().value()).margin(1e-9));
+        CHECK(actual.getC().value() == Approx(expected.getC().value()).margin(1e-9));
+        CHECK(actual.getD().value() == Approx(expected.getD().value()).margin(1e-9));
+        CHECK(actual.getDisplacement().value() == Approx(expected.getDisplacement().value()).margin(1e-9));
+        CHECK(actual.getRefractiveIndexScale().value() == Approx(expected.getRefractiveIndexScale().value()));
+      }
+    }
+    CHECK(a_editable.build().getC().value() == Approx(system.build().getC().value()).margin(1e-9));
+    CHECK(a_editable.build(30 * i::cm).getB().value() == Approx(system.build(30 * i::cm).getB().value()).margin(1e-9));
+  };
+
+  EditableOpticalSystem<t::cm>                           editable;
+  std::vector<std::pair<double, OpticalElement<t::cm>>> elements;
+
+  check_builds(editable, elements);
+
+  auto lens1 = editable.insert(10 * i::cm, ThinLens(5 * i::cm));
+  elements.push_back({10, ThinLens(5 * i::cm)});
+  auto lens2 = editable.insert(2 * i::cm, ThinLens(-3 * i::cm));
+  elements.push_back({2, ThinLens(-3 * i::cm)});
+  auto thick = editable.insert(15 * i::cm, ThickLens(1.5 * i::dimensionless, 4. * i::cm, 0.5 * i::cm, -4. * i::cm));
+  elements.push_back({15, ThickLens(1.5 * i::dimensionless, 4. * i::cm, 0.5 * i::cm, -4. * i::cm)});
+  auto surface = editable.insert(20 * i::cm, FlatRefractiveSurface(1.3 * i::dimensionless));
+  elements.push_back({20, FlatRefractiveSurface(1.3 * i::dimensionless)});
+  editable.insert(20 * i::cm, ThinLens(8 * i::cm));
+  elements.push_back({20, ThinLens(8 * i::cm)});
+
+  SECTION("Insert")
+  {
+    check_builds(editable, elements);
+    CHECK(editable.getPosition(thick).value() == Approx(15));
+    CHECK(editable.getPosition<t::mm>(lens2).value() == Approx(20));
+    CHECK(editable.getElement(lens1).getC().value() == Approx(-0.2));
+  }
+
+  SECTION("Replace")
+  {
+    editable.replace(lens1, ThinLens(7 * i::cm));
+    elements[0].second = ThinLens(7 * i::cm);
+    check_builds(editable, elements);
+  }
+
+  SECTION("Move")
+  {
+    editable.move(lens2, 30 * i::cm);
+    elements[1].first = 30;
+    check_builds(editable, elements);
+
+    editable.move(thick, 5 * i::cm);
+    elements[2].first = 5;
+    check_builds(editable, elements);
+  }
+
+  SECTION("Remove")
+  {
+    editable.remove(surface);
+    elements.erase(elements.begin() + 3);
+    check_builds(editable, elements);
+
+    editable.remove(lens1);
+    elements.erase(elements.begin());
+    check_builds(editable, elements);
+
+    CHECK_THROWS(editable.remove(lens1));
+
+    // handles are reused
+    editable.insert(0 * i::cm, ThinLens(9 * i::cm));
+    elements.push_back({0, ThinLens(9 * i::cm)});
+    check_builds(editable, elements);
+  }
+
+  SECTION("Overlapping elements")
+  {
+    // inside of the thick lens
+    CHECK_THROWS(editable.insert(15.2 * i::cm, ThinLens(5 * i::cm)));
+    // would contain the element at 20 cm
+    CHECK_THROWS(editable.insert(19 * i::cm, FreeSpace(2 * i::cm)));
+    CHECK_THROWS(editable.move(lens1, 15.3 * i::cm));
+    CHECK_THROWS(editable.replace(lens1, FreeSpace(6 * i::cm)));
+    // right at the back of the thick lens is ok
+    editable.insert(15.5 * i::cm, ThinLens(5 * i::cm));
+    elements.push_back({15.5, ThinLens(5 * i::cm)});
+    check_builds(editable, elements);
+  }
+
+  SECTION("Many edits")
+  {
+    std::vector<EditableOpticalSystem<t::cm>::Handle> handles;
+    EditableOpticalSystem<t::cm>                       large;
+    std::vector<std::pair<double, OpticalElement<t::cm>>> large_elements;
+    for(int i = 0; i < 60; ++i) {
+      handles.push_back(large.insert(i * 0.5 * i::cm, ThinLens((10 + i) * i::cm)));
+      large_elements.push_back({i * 0.5, ThinLens((10 + i) * i::cm)});
+    }
+    for(int i = 0; i < 60; i += 7) {
+      large.replace(handles[i], ThinLens((20 - i) * i::cm));
+      large_elements[i].second = ThinLens((20 - i) * i::cm);
+    }
+    check_builds(large, large_elements);
+  }
+}
+
 TEST_CASE("Propagation")
 {
   using namespace libGBP2;
@@ -591,5 +991,137 @@ TEST_CASE("Propagation")
       CHECK(beam_out.getBeamWaistWidth<t::um>().get<OneOverESquaredDiameter>().value() == Approx(11.02).epsilon(0.01));
       CHECK(beam_out.getBeamWaistPosition<t::mm>().value() == Approx(39.322));
     }
+
+    SECTION("Sweep over many positions")
+    {
+      OpticalSystem<t::cm> system;
+      system.add(2 * i::cm, ThinLens(10 * i ::mm));
+      system.add(5 * i::cm, ThickLens(1.5 * i::dimensionless, 40. * i::mm, 4 * i::mm, -40 * i::mm));
+      system.add(5.2 * i::cm, ThinLens(10 * i ::mm));  // inside of the thick lens
+      system.add(8 * i::cm, FlatRefractiveSurface(1.3 * i::dimensionless));
+      system.add(8 * i::cm, ThinLens(-20 * i ::mm));
+
+      std::vector<quantity<t::mm>> positions;
+      for(int i = 0; i < 120; ++i) {
+        positions.push_back(i * 1. * i::mm);
+      }
+
+      auto check_beams = [&](const std::vector<CircularGaussianLaserBeam>& a_beams, const std::vector<quantity<t::mm>>& a_positions, bool a_fixed) {
+        REQUIRE(a_beams.size() == a_positions.size());
+        for(std::size_t i = 0; i < a_positions.size(); i++) {
+          auto beam_out = propagate_beam_through_system(beam, system, a_positions[i], a_fixed);
+          CHECK(a_beams[i].getBeamWaistPosition<t::cm>().value() == beam_out.getBeamWaistPosition<t::cm>().value());
+          CHECK(a_beams[i].getBeamWaistWidth<t::cm>().get<OneOverESquaredRadius>().value() == beam_out.getBeamWaistWidth<t::cm>().get<OneOverESquaredRadius>().value());
+          CHECK(a_beams[i].getWavelength<t::nm>().value() == beam_out.getWavelength<t::nm>().value());
+        }
+      };
+
+      SECTION("Sorted")
+      {
+        check_beams(propagate_beam_through_system(beam, system, positions), positions, false);
+        check_beams(propagate_beam_through_system(beam, system, positions, true), positions, true);
+        check_beams(propagate_beam_through_system(beam, system, std::span(positions)), positions, false);
+      }
+      SECTION("Unsorted")
+      {
+        std::reverse(positions.begin(), positions.end());
+        std::swap(positions[10], positions[50]);
+        check_beams(propagate_beam_through_system(beam, system, positions), positions, false);
+      }
+      SECTION("Empty")
+      {
+        positions.clear();
+        CHECK(propagate_beam_through_system(beam, system, positions).size() == 0);
+      }
+    }
+  }
+}
+
+TEST_CASE("Beam Analysis")
+{
+  using namespace libGBP2;
+  CircularGaussianLaserBeam beam;
+  beam.setWavelength(532 * i::nm);
+  beam.setBeamWaistWidth(make_width<OneOverESquaredRadius>(10 * i::um));
+  beam.setBeamQualityFactor(4 * i::dimensionless);
+
+  OpticalSystem<t::cm> system;
+  system.add(2 * i::cm, ThinLens(10 * i ::mm));
+  system.add(5 * i::cm, ThickLens(1.5 * i::dimensionless, 40. * i::mm, 4 * i::mm, -40 * i::mm));
+  system.add(5.2 * i::cm, ThinLens(10 * i ::mm));  // inside of the thick lens
+  system.add(8 * i::cm, FlatRefractiveSurface(1.3 * i::dimensionless));
+  system.add(8 * i::cm, ThinLens(-20 * i ::mm));
+
+  SECTION("Segments")
+  {
+    auto segments = analyze_beam_through_system(beam, system);
+    REQUIRE(segments.size() == 5);
+    CHECK(std::isinf(segments[0].start.value()));
+    CHECK(segments[0].end.value() == Approx(2));
+    CHECK(segments[1].start.value() == Approx(2));
+    CHECK(segments[1].end.value() == Approx(5));
+    CHECK(segments[2].start.value() == Approx(5.4));
+    CHECK(segments[2].end.value() == Approx(8));
+    CHECK(segments[3].start.value() == Approx(8));
+    CHECK(segments[3].end.value() == Approx(8));
+    CHECK(segments[4].start.value() == Approx(8));
+    CHECK(std::isinf(segments[4].end.value()));
+
+    // the input beam waist is at z = 0 and the beam focuses after the first lens
+    CHECK(segments[0].containsWaist());
+    CHECK(segments[0].beam.getBeamWaistPosition<t::cm>().value() == Approx(0).scale(1));
+    CHECK(segments[1].containsWaist());
+    CHECK(!segments[2].containsWaist());
+    CHECK(segments[3].crossings.size() == 0);
+
+    // the beam in each segment matches the propagated beam
+    for(double z : {-1., 0., 1., 2.5, 3., 4., 4.9, 5.5, 6., 7.5, 9., 12.}) {
+      auto segment = std::find_if(segments.begin(), segments.end(), [z](const BeamSegment& s) { return s.start.value() <= z && z <= s.end.value(); });
+      REQUIRE(segment != segments.end());
+      auto beam_out = propagate_beam_through_system(beam, system, z * i::cm);
+      CHECK(segment->beam.getBeamWidth<t::cm>(z * i::cm).get<OneOverESquaredRadius>().value() == Approx(beam_out.getBeamWidth<t::cm>().get<OneOverESquaredRadius>().value()));
+      CHECK(segment->beam.getBeamWaistWidth<t::cm>().get<OneOverESquaredRadius>().value() == Approx(beam_out.getBeamWaistWidth<t::cm>().get<OneOverESquaredRadius>().value()));
+      CHECK(segment->beam.getBeamWaistPosition<t::cm>().value() == Approx(z + beam_out.getBeamWaistPosition<t::cm>().value()));
+      CHECK(segment->beam.getWavelength<t::nm>().value() == Approx(beam_out.getWavelength<t::nm>().value()));
+    }
+
+    // the focus after the first lens
+    auto z_focus  = segments[1].beam.getBeamWaistPosition<t::cm>();
+    auto beam_out = propagate_beam_through_system(beam, system, z_focus);
+    CHECK(beam_out.getBeamWaistPosition<t::cm>().value() == Approx(0).scale(1));
+    CHECK(segments[1].beam.getBeamWaistWidth<t::um>().get<OneOverESquaredRadius>().value() == Approx(beam_out.getBeamWidth<t::um>().get<OneOverESquaredRadius>().value()));
+  }
+
+  SECTION("Target width")
+  {
+    auto target   = make_width<FWHMDiameter>(0.5 * i::mm);
+    auto segments = analyze_beam_through_system(beam, system, target);
+    REQUIRE(segments.size() == 5);
+
+    std::size_t count = 0;
+    for(const auto& segment : segments) {
+      for(std::size_t i = 0; i < segment.crossings.size(); ++i) {
+        auto z = segment.crossings[i];
+        CHECK(segment.start <= z);
+        CHECK(z <= segment.end);
+        if(i > 0) {
+          CHECK(segment.crossings[i - 1] < z);
+        }
+        auto beam_out = propagate_beam_through_system(beam, system, z);
+        CHECK(beam_out.getBeamWidth<t::mm>().get<FWHMDiameter>().value() == Approx(0.5));
+        ++count;
+      }
+    }
+    // on both sides of the input waist and the focus after the first lens
+    CHECK(count == 4);
+    REQUIRE(segments[0].crossings.size() == 2);
+    CHECK(segments[0].crossings[0].value() == Approx(-segments[0].crossings[1].value()));
+    CHECK(segments[1].crossings.size() == 2);
+
+    // smaller than any waist in the system
+    segments = analyze_beam_through_system(beam, system, make_width<OneOverESquaredRadius>(1 * i::um));
+    for(const auto& segment : segments) {
+      CHECK(segment.crossings.size() == 0);
+    }
   }
 }
@@ -0,0 +1,172 @@
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include <BoostUnitDefinitions/Units.hpp>
+
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <libGBP2/CircularGaussianLaserBeam.hpp>
+#include <libGBP2/OpticalElements/ThickLens.hpp>
+#include <libGBP2/OpticalElements/ThinLens.hpp>
+#include <libGBP2/OpticalSystem.hpp>
+#include <libGBP2/ParameterSweep.hpp>
+#include <libGBP2/Propagation.hpp>
+#include <libGBP2/ThreadPool.hpp>
+
+using namespace Catch;
+
+TEST_CASE("Thread Pool")
+{
+  using namespace libGBP2;
+
+  SECTION("parallel_for covers every index once")
+  {
+    for(std::size_t threads : {1, 2, 5}) {
+      ThreadPool pool(threads);
+      CHECK(pool.size() == threads);
+      for(std::size_t grain : {1, 3, 100, 2000}) {
+        std::vector<std::atomic<int>> counts(1000);
+        std::atomic<bool>             too_large = false;
+        // Catch assertions are not thread safe, so only check results on this thread
+        pool.parallel_for(counts.size(), grain, [&](std::size_t a_begin, std::size_t a_end) {
+          if(a_end - a_begin > grain) {
+            too_large = true;
+          }
+          for(std::size_t i = a_begin; i < a_end; ++i) {
+            ++counts[i];
+          }
+        });
+        CHECK(!too_large);
+        for(auto& c : counts) {
+          CHECK(c == 1);
+        }
+      }
+      pool.parallel_for(0, 1, [](std::size_t, std::size_t) { throw std::runtime_error("should not be called"); });
+    }
+  }
+
+  SECTION("exceptions are passed to the caller")
+  {
+    ThreadPool       pool(3);
+    std::atomic<int> calls = 0;
+    CHECK_THROWS_AS(pool.parallel_for(100, 1,
+                                      [&](std::size_t a_begin, std::size_t) {
+                                        ++calls;
+                                        if(a_begin == 42) {
+                                          throw std::runtime_error("error");
+                                        }
+                                      }),
+                    std::runtime_error);
+    // every task still runs
+    CHECK(calls == 100);
+
+    // and the pool is still usable
+    std::atomic<int> sum = 0;
+    pool.parallel_for(10, 1, [&](std::size_t a_begin, std::size_t) { sum += a_begin; });
+    CHECK(sum == 45);
+  }
+
+  SECTION("workers of one pool can use another pool")
+  {
+    // the worker's queue index in the outer pool must not be used in the inner pool
+    ThreadPool       outer(4), inner(2);
+    std::atomic<int> sum = 0;
+    outer.parallel_for(8, 1, [&](std::size_t, std::size_t) {
+      inner.parallel_for(10, 1, [&](std::size_t a_begin, std::size_t) { sum += a_begin; });
+    });
+    CHECK(sum == 8 * 45);
+  }
+}
+
+TEST_CASE("Parameter Sweep")
+{
+  using namespace libGBP2;
+  CircularGaussianLaserBeam beam;
+  beam.setWavelength(532 * i::nm);
+  beam.setBeamWaistWidth(make_width<OneOverESquaredRadius>(10 * i::um));
+  beam.setBeamQualityFactor(4 * i::dimensionless);
+
+  OpticalSystem<t::cm> system;
+  system.add(2 * i::cm, ThinLens(10 * i ::mm));
+  system.add(5 * i::cm, ThickLens(1.5 * i::dimensionless, 40. * i::mm, 4 * i::mm, -40 * i::mm));
+
+  std::vector<quantity<t::mm>> positions;
+  for(int i = 0; i < 100; ++i) {
+    positions.push_back(i * 1. * i::mm);
+  }
+
+  std::vector<double> focal_lengths = {5, 10, 20};
+  std::vector<double> waists        = {5, 10, 15, 20};
+
+  ParameterSweep sweep(beam, system);
+  sweep.setPositions(positions);
+  sweep.addBeamAxis(waists, [](CircularGaussianLaserBeam& a_beam, double a_w) {
+    a_beam.setBeamWaistWidth(make_width<OneOverESquaredRadius>(a_w * i::um));
+  });
+  sweep.addSystemAxis(focal_lengths, [](OpticalSystem<t::cm>& a_system, double a_f) {
+    a_system.add(8 * i::cm, ThinLens(a_f * i::cm));
+  });
+
+  CHECK(sweep.shape() == std::vector<std::size_t>{4, 3, 100});
+  CHECK(sweep.size() == 1200);
+
+  SECTION("Results match a serial propagation for any number of threads")
+  {
+    sweep.setNumberOfThreads(1);
+    auto serial_widths = sweep.runBeamWidths();
+    for(std::size_t threads : {1, 2, 7}) {
+      sweep.setNumberOfThreads(threads);
+      auto widths = sweep.runBeamWidths();
+      auto beams  = sweep.runBeams();
+      REQUIRE(widths.size() == 1200);
+      REQUIRE(beams.size() == 1200);
+      // the same code computes each result, no matter which thread runs it
+      CHECK(widths == serial_widths);
+
+      std::size_t n = 0;
+      for(auto w : waists) {
+        for(auto f : focal_lengths) {
+          CircularGaussianLaserBeam b = beam;
+          b.setBeamWaistWidth(make_width<OneOverESquaredRadius>(w * i::um));
+          OpticalSystem<t::cm> s = system;
+          s.add(8 * i::cm, ThinLens(f * i::cm));
+          for(auto z : positions) {
+            auto beam_out = propagate_beam_through_system(b, s, z);
+            CHECK(widths[n] == beam_out.getSecondMomentBeamWidth<t::cm>().value());
+            CHECK(beams[n].getBeamWaistPosition<t::cm>().value() == beam_out.getBeamWaistPosition<t::cm>().value());
+            CHECK(beams[n].getBeamWaistWidth<t::cm>().get<OneOverESquaredRadius>().value() == beam_out.getBeamWaistWidth<t::cm>().get<OneOverESquaredRadius>().value());
+            ++n;
+          }
+        }
+      }
+    }
+  }
+
+  SECTION("Sweep with no axes")
+  {
+    ParameterSweep plain(beam, system);
+    plain.setPositions(positions);
+    plain.setNumberOfThreads(3);
+    CHECK(plain.shape() == std::vector<std::size_t>{100});
+    auto widths = plain.runBeamWidths();
+    REQUIRE(widths.size() == 100);
+    for(std::size_t i = 0; i < positions.size(); ++i) {
+      CHECK(widths[i] == propagate_beam_through_system(beam, system, positions[i]).getSecondMomentBeamWidth<t::cm>().value());
+    }
+  }
+
+  SECTION("Errors")
+  {
+    CHECK_THROWS_AS(sweep.addAxis({}, [](CircularGaussianLaserBeam&, OpticalSystem<t::cm>&, double) {}), std::runtime_error);
+
+    std::vector<double> output(10);
+    CHECK_THROWS_AS(sweep.runBeamWidths(output), std::runtime_error);
+
+    ParameterSweep empty(beam, system);
+    CHECK_THROWS_AS(empty.runBeamWidths(), std::runtime_error);
+
+    sweep.addSystemAxis({1}, [](OpticalSystem<t::cm>&, double) { throw std::runtime_error("bad system"); });
+    CHECK_THROWS_AS(sweep.runBeams(), std::runtime_error);
+  }
+}
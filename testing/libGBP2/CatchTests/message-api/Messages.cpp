@@ -46,6 +46,25 @@ TEST_CASE("Quantity message << operator")
     CHECK(msg.beam_waist_width().value() == Approx(10));
     CHECK(msg.beam_waist_width().unit() == "mm");
   }
+  SECTION("set_quantity gives the same message as writing a quantity")
+  {
+    msg::Quantity expected, msg;
+
+    expected << 532. * i::nm;
+    msg::set_quantity(&msg, 532. * i::nm);
+    CHECK(msg.value() == expected.value());
+    CHECK(msg.unit() == expected.unit());
+
+    expected << 0.1 * i::cm;
+    msg::set_quantity(&msg, 0.1 * i::cm);
+    CHECK(msg.value() == expected.value());
+    CHECK(msg.unit() == expected.unit());
+
+    expected << 1.3 * i::dimensionless;
+    msg::set_quantity(&msg, 1.3 * i::dimensionless);
+    CHECK(msg.value() == expected.value());
+    CHECK(msg.unit() == expected.unit());
+  }
 }
 
 TEST_CASE("Quantity utility methods")
@@ -306,3 +325,78 @@ TEST_CASE("Optical Element Messages")
 
   /* std::cout << msg::serialize_message(element) << std::endl; */
 }
+
+TEST_CASE("Unit scale cache")
+{
+  using namespace libGBP2;
+  auto& cache = msg::get_unit_scale_cache();
+  cache.clear();
+  cache.resetStats();
+
+  msg::Quantity val;
+  val << "23 mm";
+
+  CHECK(msg::make_quantity<t::cm>(val).value() == Approx(2.3));
+  CHECK(cache.getStats().misses == 1);
+  CHECK(cache.getStats().hits == 0);
+
+  CHECK(msg::make_quantity<t::cm>(val).value() == Approx(2.3));
+  CHECK(msg::make_quantity<t::m>(val).value() == Approx(0.023));
+  CHECK(cache.getStats().misses == 2);
+  CHECK(cache.getStats().hits == 1);
+
+  SECTION("Converting lists only looks up each unit once")
+  {
+    google::protobuf::RepeatedPtrField<msg::Quantity> positions;
+    for(int i = 0; i < 100; ++i) {
+      *positions.Add() << std::to_string(i) + " mm";
+    }
+    *positions.Add() << "1 m";
+    *positions.Add() << "2 m";
+    auto quantities = msg::make_quantities<t::cm>(positions);
+    REQUIRE(quantities.size() == 102);
+    CHECK(quantities[0].value() == Approx(0).scale(1));
+    CHECK(quantities[99].value() == Approx(9.9));
+    CHECK(quantities[100].value() == Approx(100));
+    CHECK(quantities[101].value() == Approx(200));
+    CHECK(cache.getStats().misses == 3);
+    CHECK(cache.getStats().hits == 2);
+    CHECK(cache.getStats().hitRate() == Approx(0.4));
+  }
+
+  SECTION("Converting messages")
+  {
+    msg::convert(val, "in");
+    CHECK(val.value() == Approx(23 / 25.4));
+    CHECK(val.unit() == "in");
+    CHECK(cache.getScale("mm", "in").value() == Approx(1 / 25.4));
+    CHECK(cache.getStats().misses == 3);
+    CHECK(cache.getStats().hits == 2);
+  }
+
+  SECTION("Errors are not cached")
+  {
+    val << "23 not_a_unit";
+    CHECK_THROWS(msg::make_quantity<t::cm>(val));
+    CHECK_THROWS(msg::make_quantity<t::cm>(val));
+    CHECK(cache.getStats().misses == 4);
+  }
+
+  SECTION("Lookup time is estimated from a sample of lookups")
+  {
+    for(int i = 0; i < 1000; ++i) {
+      msg::make_quantity<t::cm>(val);
+    }
+    CHECK(cache.getStats().hits == 1001);
+    CHECK(cache.getStats().lookup_time.count() > 0);
+  }
+
+  SECTION("Reset")
+  {
+    cache.resetStats();
+    CHECK(cache.getStats().hits == 0);
+    CHECK(cache.getStats().misses == 0);
+    CHECK(cache.getStats().lookup_time.count() == 0);
+    CHECK(cache.getStats().hitRate() == Approx(0).scale(1));
+  }
+}
@@ -1,3 +1,8 @@
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include <catch2/catch_approx.hpp>
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_string.hpp>
@@ -164,3 +169,833 @@ TEST_CASE("running propagation analysis")
     }
   }
 }
+
+TEST_CASE("batch propagation analysis")
+{
+  using namespace libGBP2;
+  Propagator propagator;
+
+  msg::Propagator_batch_Input  input_msg;
+  msg::Propagator_batch_Output output_msg;
+
+  for(std::string width : {"10 um", "20 um", "50 um"}) {
+    auto beam = input_msg.add_beams();
+    *beam->mutable_wavelength() << "532 nm";
+    *beam->mutable_beam_waist_width() << width;
+    beam->set_beam_waist_width_type(msg::BEAM_WIDTH_TYPE_ONE_OVER_E_SQUARED_RADIUS);
+    *beam->mutable_beam_waist_position() << "0 cm";
+    *beam->mutable_beam_quality_factor() << "1";
+  }
+  for(std::string focal_length : {"5 mm", "10 mm"}) {
+    auto ptr = input_msg.add_optical_systems()->add_elements();
+    *ptr->mutable_position() << "1 cm";
+    *ptr->mutable_element()->mutable_lens()->mutable_focal_length() << focal_length;
+  }
+  *input_msg.add_positions() << "0 cm";
+  *input_msg.add_positions() << "5 mm";
+  *input_msg.add_positions() << "2 cm";
+  *input_msg.add_positions() << "3 cm";
+  input_msg.set_output_beam_width_unit("mm");
+  input_msg.set_return_full_beam_characterizations(true);
+
+  // the result of a batch entry should be the same as a call to run
+  auto check_result = [&](const msg::Propagator_run_Output& a_result, int a_beam, int a_system) {
+    msg::Propagator_run_Input  run_input;
+    msg::Propagator_run_Output run_output;
+    *run_input.mutable_beam() = input_msg.beams(a_beam);
+    if(a_system < input_msg.optical_systems_size()) {
+      *run_input.mutable_optical_system() = input_msg.optical_systems(a_system);
+    }
+    *run_input.mutable_positions() = input_msg.positions();
+    run_input.set_output_beam_width_unit("mm");
+    run_input.set_return_full_beam_characterizations(true);
+    msg::deserialize_message(propagator.run(msg::serialize_message(run_input)), run_output);
+
+    CHECK(!a_result.return_status().has_error_message());
+    REQUIRE(a_result.beam_widths_size() == run_output.beam_widths_size());
+    REQUIRE(a_result.beams_size() == run_output.beams_size());
+    for(int i = 0; i < a_result.beam_widths_size(); ++i) {
+      CHECK(a_result.beam_widths(i).value() == Approx(run_output.beam_widths(i).value()));
+      CHECK(a_result.beam_widths(i).unit() == "mm");
+      CHECK(a_result.beams(i).beam_waist_position().value() == Approx(run_output.beams(i).beam_waist_position().value()).scale(1));
+      CHECK(a_result.beams(i).beam_waist_width().value() == Approx(run_output.beams(i).beam_waist_width().value()));
+    }
+  };
+
+  SECTION("Cross product")
+  {
+    msg::deserialize_message(propagator.batch(msg::serialize_message(input_msg)), output_msg);
+
+    CHECK(!output_msg.return_status().has_error_message());
+    REQUIRE(output_msg.results_size() == 6);
+    for(int b = 0; b < 3; ++b) {
+      for(int s = 0; s < 2; ++s) {
+        check_result(output_msg.results(b * 2 + s), b, s);
+      }
+    }
+  }
+
+  SECTION("No optical systems")
+  {
+    input_msg.clear_optical_systems();
+    msg::deserialize_message(propagator.batch(msg::serialize_message(input_msg)), output_msg);
+
+    CHECK(!output_msg.return_status().has_error_message());
+    REQUIRE(output_msg.results_size() == 3);
+    for(int b = 0; b < 3; ++b) {
+      check_result(output_msg.results(b), b, 0);
+    }
+  }
+
+  SECTION("Zip")
+  {
+    input_msg.set_pairing(msg::BATCH_PAIRING_ZIP);
+
+    msg::deserialize_message(propagator.batch(msg::serialize_message(input_msg)), output_msg);
+    CHECK(output_msg.return_status().error_message() == "There was an error in `batch` method: Cannot zip 3 beams with 2 optical systems. The number of beams and systems must be the same, or one of them must be 1.");
+    CHECK(output_msg.results_size() == 0);
+
+    auto ptr = input_msg.add_optical_systems()->add_elements();
+    *ptr->mutable_position() << "2 cm";
+    *ptr->mutable_element()->mutable_lens()->mutable_focal_length() << "20 mm";
+    msg::deserialize_message(propagator.batch(msg::serialize_message(input_msg)), output_msg);
+    CHECK(!output_msg.return_status().has_error_message());
+    REQUIRE(output_msg.results_size() == 3);
+    for(int i = 0; i < 3; ++i) {
+      check_result(output_msg.results(i), i, i);
+    }
+
+    // a single system is used with every beam
+    input_msg.mutable_optical_systems()->DeleteSubrange(0, 2);
+    msg::deserialize_message(propagator.batch(msg::serialize_message(input_msg)), output_msg);
+    CHECK(!output_msg.return_status().has_error_message());
+    REQUIRE(output_msg.results_size() == 3);
+    for(int i = 0; i < 3; ++i) {
+      check_result(output_msg.results(i), i, 0);
+    }
+  }
+
+  SECTION("Errors are reported for each entry")
+  {
+    input_msg.mutable_beams(1)->clear_beam_quality_factor();
+    msg::deserialize_message(propagator.batch(msg::serialize_message(input_msg)), output_msg);
+
+    CHECK(!output_msg.return_status().has_error_message());
+    REQUIRE(output_msg.results_size() == 6);
+    for(int s = 0; s < 2; ++s) {
+      check_result(output_msg.results(s), 0, s);
+      CHECK(output_msg.results(2 + s).return_status().error_message() == "There was an error building beam 1: Neither beam quality factor or beam divergence were given. At least one must be set.");
+      CHECK(output_msg.results(2 + s).beam_widths_size() == 0);
+      check_result(output_msg.results(4 + s), 2, s);
+    }
+  }
+}
+
+TEST_CASE("output serialization format")
+{
+  using namespace libGBP2;
+  Propagator propagator;
+
+  msg::Propagator_run_Input  input_msg;
+  msg::Propagator_run_Output output_msg;
+
+  *input_msg.mutable_beam()->mutable_wavelength() << "532 nm";
+  *input_msg.mutable_beam()->mutable_beam_waist_width() << "10 um";
+  input_msg.mutable_beam()->set_beam_waist_width_type(msg::BEAM_WIDTH_TYPE_ONE_OVER_E_SQUARED_RADIUS);
+  *input_msg.mutable_beam()->mutable_beam_waist_position() << "0 cm";
+  *input_msg.mutable_beam()->mutable_beam_quality_factor() << "1";
+  *input_msg.add_positions() << "1 cm";
+
+  std::string json_input   = msg::serialize_message(input_msg, msg::serialization_format::JSON);
+  std::string binary_input = msg::serialize_message(input_msg, msg::serialization_format::PROTOBUF);
+
+  CHECK(propagator.getOutputFormat() == Propagator::OutputFormat::SAME_AS_INPUT);
+
+  SECTION("Output format follows the input format")
+  {
+    std::string output = propagator.run(json_input);
+    CHECK(msg::deserialize_message(output, output_msg) == msg::serialization_format::JSON);
+    REQUIRE(output_msg.beam_widths_size() == 1);
+    CHECK(output_msg.beam_widths(0).value() == Approx(169.64).epsilon(0.001));
+
+    output_msg.Clear();
+    output = propagator.run(binary_input);
+    CHECK(msg::deserialize_message(output, output_msg) == msg::serialization_format::PROTOBUF);
+    CHECK(!output_msg.return_status().has_error_message());
+    REQUIRE(output_msg.beam_widths_size() == 1);
+    CHECK(output_msg.beam_widths(0).value() == Approx(169.64).epsilon(0.001));
+    CHECK(output_msg.beam_widths(0).unit() == "um");
+  }
+
+  SECTION("Explicit output format")
+  {
+    propagator.setOutputFormat(Propagator::OutputFormat::PROTOBUF);
+    CHECK(msg::deserialize_message(propagator.run(json_input), output_msg) == msg::serialization_format::PROTOBUF);
+    CHECK(output_msg.beam_widths_size() == 1);
+
+    propagator.setOutputFormat(Propagator::OutputFormat::JSON);
+    output_msg.Clear();
+    CHECK(msg::deserialize_message(propagator.run(binary_input), output_msg) == msg::serialization_format::JSON);
+    CHECK(output_msg.beam_widths_size() == 1);
+  }
+
+  SECTION("Errors")
+  {
+    // errors parsing JSON input are returned as JSON
+    CHECK(msg::deserialize_message(propagator.run("{\"positions\": 1}"), output_msg) == msg::serialization_format::JSON);
+    CHECK(output_msg.return_status().has_error_message());
+
+    CHECK(msg::deserialize_message(propagator.run("not a message"), output_msg) == msg::serialization_format::PROTOBUF);
+    CHECK_THAT(output_msg.return_status().error_message(), Matchers::StartsWith("There was an error in `run` method: Could not parse binary protobuf message."));
+  }
+}
+
+TEST_CASE("packed position arrays")
+{
+  using namespace libGBP2;
+  Propagator propagator;
+
+  msg::Propagator_run_Input  input_msg;
+  msg::Propagator_run_Output output_msg, expected_msg;
+
+  *input_msg.mutable_beam()->mutable_wavelength() << "532 nm";
+  *input_msg.mutable_beam()->mutable_beam_waist_width() << "10 um";
+  input_msg.mutable_beam()->set_beam_waist_width_type(msg::BEAM_WIDTH_TYPE_ONE_OVER_E_SQUARED_RADIUS);
+  *input_msg.mutable_beam()->mutable_beam_waist_position() << "0 cm";
+  *input_msg.mutable_beam()->mutable_beam_quality_factor() << "1";
+  auto ptr = input_msg.mutable_optical_system()->add_elements();
+  *ptr->mutable_position() << "5 cm";
+  *ptr->mutable_element()->mutable_lens()->mutable_focal_length() << "10 cm";
+
+  msg::Propagator_run_Input array_input_msg = input_msg;
+  array_input_msg.mutable_positions_array()->set_unit("mm");
+  for(int i = 0; i < 100; ++i) {
+    *input_msg.add_positions() << std::to_string(i) + " mm";
+    array_input_msg.mutable_positions_array()->add_values(i);
+  }
+  msg::deserialize_message(propagator.run(msg::serialize_message(input_msg, msg::serialization_format::PROTOBUF)), expected_msg);
+  REQUIRE(expected_msg.beam_widths_size() == 100);
+
+  SECTION("Widths are returned in an array")
+  {
+    for(auto format : {msg::serialization_format::JSON, msg::serialization_format::PROTOBUF}) {
+      output_msg.Clear();
+      msg::deserialize_message(propagator.run(msg::serialize_message(array_input_msg, format)), output_msg);
+      CHECK(!output_msg.return_status().has_error_message());
+      CHECK(output_msg.beam_widths_size() == 0);
+      CHECK(output_msg.beam_widths_array().unit() == "um");
+      REQUIRE(output_msg.beam_widths_array().values_size() == 100);
+      for(int i = 0; i < 100; ++i) {
+        CHECK(output_msg.beam_widths_array().values(i) == Approx(expected_msg.beam_widths(i).value()));
+      }
+    }
+
+    array_input_msg.set_output_beam_width_unit("mm");
+    msg::deserialize_message(propagator.run(msg::serialize_message(array_input_msg)), output_msg);
+    CHECK(output_msg.beam_widths_array().unit() == "mm");
+    CHECK(output_msg.beam_widths_array().values(99) == Approx(expected_msg.beam_widths(99).value() / 1000));
+
+    // the array input is smaller than the list of quantities, especially as JSON
+    CHECK(array_input_msg.ByteSizeLong() < input_msg.ByteSizeLong() * 2 / 3);
+    CHECK(msg::serialize_message(array_input_msg).size() < msg::serialize_message(input_msg).size() / 2);
+  }
+
+  SECTION("Full beam characterizations are still returned")
+  {
+    array_input_msg.set_return_full_beam_characterizations(true);
+    msg::deserialize_message(propagator.run(msg::serialize_message(array_input_msg)), output_msg);
+    CHECK(output_msg.beam_widths_array().values_size() == 100);
+    CHECK(output_msg.beams_size() == 100);
+  }
+
+  SECTION("Streaming")
+  {
+    std::string stream;
+    propagator.run(msg::serialize_message(array_input_msg, msg::serialization_format::PROTOBUF), [&stream](const std::string& a_chunk) { stream += a_chunk; }, 30);
+    std::string_view    stream_view = stream;
+    std::string         chunk_str;
+    std::vector<double> widths;
+    while(msg::read_delimited(stream_view, chunk_str)) {
+      msg::deserialize_message(chunk_str, output_msg);
+      CHECK(output_msg.beam_widths_array().unit() == "um");
+      widths.insert(widths.end(), output_msg.beam_widths_array().values().begin(), output_msg.beam_widths_array().values().end());
+    }
+    REQUIRE(widths.size() == 100);
+    CHECK(widths[99] == Approx(expected_msg.beam_widths(99).value()));
+  }
+
+  SECTION("Batches and sessions")
+  {
+    msg::Propagator_batch_Input  batch_msg;
+    msg::Propagator_batch_Output batch_output;
+    *batch_msg.add_beams()               = array_input_msg.beam();
+    *batch_msg.add_optical_systems()     = array_input_msg.optical_system();
+    *batch_msg.mutable_positions_array() = array_input_msg.positions_array();
+    msg::deserialize_message(propagator.batch(msg::serialize_message(batch_msg)), batch_output);
+    REQUIRE(batch_output.results_size() == 1);
+    REQUIRE(batch_output.results(0).beam_widths_array().values_size() == 100);
+    CHECK(batch_output.results(0).beam_widths_array().values(99) == Approx(expected_msg.beam_widths(99).value()));
+
+    msg::Propagator_load_Input  load_msg;
+    msg::Propagator_load_Output load_output;
+    *load_msg.mutable_beam()           = array_input_msg.beam();
+    *load_msg.mutable_optical_system() = array_input_msg.optical_system();
+    msg::deserialize_message(propagator.load(msg::serialize_message(load_msg)), load_output);
+    msg::Propagator_query_Input  query_msg;
+    msg::Propagator_query_Output query_output;
+    query_msg.set_session_id(load_output.session_id());
+    *query_msg.mutable_positions_array() = array_input_msg.positions_array();
+    msg::deserialize_message(propagator.query(msg::serialize_message(query_msg)), query_output);
+    CHECK(query_output.beam_widths_size() == 0);
+    REQUIRE(query_output.beam_widths_array().values_size() == 100);
+    CHECK(query_output.beam_widths_array().values(99) == Approx(expected_msg.beam_widths(99).value()));
+  }
+
+  SECTION("Errors")
+  {
+    *array_input_msg.add_positions() << "1 cm";
+    msg::deserialize_message(propagator.run(msg::serialize_message(array_input_msg)), output_msg);
+    CHECK(output_msg.return_status().error_message() == "There was an error in `run` method: Both positions and positions_array were given. Only one or the other can be set.");
+  }
+}
+
+TEST_CASE("result cache")
+{
+  using namespace libGBP2;
+  Propagator propagator;
+
+  msg::Propagator_run_Input input_msg;
+  *input_msg.mutable_beam()->mutable_wavelength() << "532 nm";
+  *input_msg.mutable_beam()->mutable_beam_waist_width() << "10 um";
+  input_msg.mutable_beam()->set_beam_waist_width_type(msg::BEAM_WIDTH_TYPE_ONE_OVER_E_SQUARED_RADIUS);
+  *input_msg.mutable_beam()->mutable_beam_waist_position() << "0 cm";
+  *input_msg.mutable_beam()->mutable_beam_quality_factor() << "1";
+  for(int i = 0; i < 10; ++i) {
+    *input_msg.add_positions() << std::to_string(i) + " cm";
+  }
+  std::string input = msg::serialize_message(input_msg);
+
+  CHECK(propagator.getResultCacheSize() == 0);
+
+  SECTION("The cache is disabled by default")
+  {
+    CHECK(propagator.run(input) == propagator.run(input));
+    CHECK(propagator.getResultCacheStats().hits == 0);
+    CHECK(propagator.getResultCacheStats().misses == 0);
+    CHECK(propagator.getResultCacheStats().entries == 0);
+  }
+
+  SECTION("Repeated inputs return the stored output")
+  {
+    propagator.setResultCacheSize(1024 * 1024);
+    std::string output = propagator.run(input);
+    CHECK(propagator.getResultCacheStats().misses == 1);
+    CHECK(propagator.getResultCacheStats().hits == 0);
+    CHECK(propagator.getResultCacheStats().entries == 1);
+    CHECK(propagator.getResultCacheStats().bytes > output.size());
+
+    CHECK(propagator.run(input) == output);
+    CHECK(propagator.getResultCacheStats().hits == 1);
+
+    // the same message with different formatting
+    std::string formatted_input = "{\n  " + input.substr(1) + "\n";
+    CHECK(propagator.run(formatted_input) == output);
+    CHECK(propagator.getResultCacheStats().hits == 2);
+
+    // the same message as binary is returned as binary, so it is a different entry
+    std::string binary_input  = msg::serialize_message(input_msg, msg::serialization_format::PROTOBUF);
+    std::string binary_output = propagator.run(binary_input);
+    CHECK(msg::detect_serialization_format(binary_output) == msg::serialization_format::PROTOBUF);
+    CHECK(propagator.run(binary_input) == binary_output);
+    CHECK(propagator.getResultCacheStats().misses == 2);
+    CHECK(propagator.getResultCacheStats().hits == 3);
+    CHECK(propagator.getResultCacheStats().entries == 2);
+
+    // a different input
+    *input_msg.add_positions() << "10 cm";
+    CHECK(propagator.run(msg::serialize_message(input_msg)) != output);
+    CHECK(propagator.getResultCacheStats().misses == 3);
+
+    propagator.clearResultCache();
+    CHECK(propagator.getResultCacheStats().entries == 0);
+    CHECK(propagator.getResultCacheStats().bytes == 0);
+    CHECK(propagator.run(input) == output);
+    CHECK(propagator.getResultCacheStats().misses == 4);
+  }
+
+  SECTION("Positions are compared after converting them to cm")
+  {
+    propagator.setResultCacheSize(1024 * 1024);
+
+    msg::Propagator_run_Input m_input_msg = input_msg;
+    for(int i = 0; i < 10; ++i) {
+      *m_input_msg.mutable_positions(i) << std::to_string(i) + " m";
+      *input_msg.mutable_positions(i) << std::to_string(100 * i) + " cm";
+    }
+    std::string output = propagator.run(msg::serialize_message(input_msg));
+    CHECK(propagator.run(msg::serialize_message(m_input_msg)) == output);
+    CHECK(propagator.getResultCacheStats().hits == 1);
+
+    // positions_array returns beam_widths_array, so it is a different entry,
+    // but it is the same entry for any unit.
+    msg::Propagator_run_Input array_input_msg = input_msg;
+    array_input_msg.clear_positions();
+    array_input_msg.mutable_positions_array()->set_unit("cm");
+    for(int i = 0; i < 10; ++i) {
+      array_input_msg.mutable_positions_array()->add_values(100 * i);
+    }
+    std::string array_output = propagator.run(msg::serialize_message(array_input_msg));
+    CHECK(array_output != output);
+    CHECK(propagator.getResultCacheStats().misses == 2);
+
+    array_input_msg.mutable_positions_array()->set_unit("m");
+    for(int i = 0; i < 10; ++i) {
+      array_input_msg.mutable_positions_array()->set_values(i, i);
+    }
+    CHECK(propagator.run(msg::serialize_message(array_input_msg)) == array_output);
+    CHECK(propagator.getResultCacheStats().hits == 2);
+    CHECK(propagator.getResultCacheStats().entries == 2);
+
+    // the input is unchanged after computing its key
+    std::string array_input = msg::serialize_message(array_input_msg);
+    CHECK(propagator.run(array_input) == array_output);
+    CHECK(propagator.getResultCacheStats().hits == 3);
+  }
+
+  SECTION("Least recently used results are evicted")
+  {
+    propagator.setResultCacheSize(1024 * 1024);
+    propagator.run(input);
+    std::size_t entry_size = propagator.getResultCacheStats().bytes;
+
+    // room for two entries of about the same size
+    propagator.setResultCacheSize(entry_size * 5 / 2);
+    std::vector<std::string> inputs;
+    for(int i = 0; i < 3; ++i) {
+      input_msg.mutable_positions(0)->set_value(-i - 1);
+      inputs.push_back(msg::serialize_message(input_msg));
+    }
+    propagator.run(inputs[0]);
+    propagator.run(input);  // input is now more recently used than inputs[0]
+    propagator.run(inputs[1]);
+    CHECK(propagator.getResultCacheStats().evictions == 1);
+    CHECK(propagator.getResultCacheStats().entries == 2);
+    CHECK(propagator.getResultCacheStats().bytes <= propagator.getResultCacheSize());
+
+    auto hits = propagator.getResultCacheStats().hits;
+    propagator.run(input);
+    CHECK(propagator.getResultCacheStats().hits == hits + 1);
+    propagator.run(inputs[0]);
+    CHECK(propagator.getResultCacheStats().hits == hits + 1);
+
+    propagator.setResultCacheSize(0);
+    CHECK(propagator.getResultCacheStats().entries == 0);
+  }
+
+  SECTION("Errors are not cached")
+  {
+    propagator.setResultCacheSize(1024 * 1024);
+    input_msg.mutable_beam()->clear_beam_quality_factor();
+    std::string bad_input = msg::serialize_message(input_msg);
+    msg::Propagator_run_Output output_msg;
+    msg::deserialize_message(propagator.run(bad_input), output_msg);
+    CHECK(output_msg.return_status().has_error_message());
+    propagator.run(bad_input);
+    CHECK(propagator.getResultCacheStats().misses == 2);
+    CHECK(propagator.getResultCacheStats().entries == 0);
+  }
+
+  SECTION("Other methods are not cached")
+  {
+    propagator.setResultCacheSize(1024 * 1024);
+    msg::Propagator_load_Input load_msg;
+    *load_msg.mutable_beam() = input_msg.beam();
+    std::string load_input   = msg::serialize_message(load_msg);
+    CHECK(propagator.load(load_input) != propagator.load(load_input));
+    CHECK(propagator.getResultCacheStats().misses == 0);
+  }
+}
+
+TEST_CASE("timings")
+{
+  using namespace libGBP2;
+  Propagator propagator;
+
+  msg::Propagator_run_Input  input_msg;
+  msg::Propagator_run_Output output_msg;
+  *input_msg.mutable_beam()->mutable_wavelength() << "532 nm";
+  *input_msg.mutable_beam()->mutable_beam_waist_width() << "10 um";
+  input_msg.mutable_beam()->set_beam_waist_width_type(msg::BEAM_WIDTH_TYPE_ONE_OVER_E_SQUARED_RADIUS);
+  *input_msg.mutable_beam()->mutable_beam_waist_position() << "0 cm";
+  *input_msg.mutable_beam()->mutable_beam_quality_factor() << "1";
+  auto ptr = input_msg.mutable_optical_system()->add_elements();
+  *ptr->mutable_position() << "5 cm";
+  *ptr->mutable_element()->mutable_lens()->mutable_focal_length() << "10 cm";
+  for(int i = 0; i < 1000; ++i) {
+    *input_msg.add_positions() << std::to_string(i) + " mm";
+  }
+
+  SECTION("Timings are only returned if requested")
+  {
+    msg::deserialize_message(propagator.run(msg::serialize_message(input_msg)), output_msg);
+    CHECK(!output_msg.has_timings());
+  }
+
+  SECTION("Run")
+  {
+    input_msg.set_return_timings(true);
+    for(auto format : {msg::serialization_format::JSON, msg::serialization_format::PROTOBUF}) {
+      output_msg.Clear();
+      msg::deserialize_message(propagator.run(msg::serialize_message(input_msg, format)), output_msg);
+      CHECK(!output_msg.return_status().has_error_message());
+      CHECK(output_msg.beam_widths_size() == 1000);
+      REQUIRE(output_msg.has_timings());
+      const auto& timings = output_msg.timings();
+      CHECK(timings.deserialize_ns() > 0);
+      CHECK(timings.build_laser_ns() > 0);
+      CHECK(timings.build_optical_system_ns() > 0);
+      CHECK(timings.convert_ns() > 0);
+      CHECK(timings.propagate_ns() > 0);
+      CHECK(timings.write_output_ns() > 0);
+      CHECK(timings.serialize_ns() > 0);
+      CHECK(timings.total_ns() >= timings.deserialize_ns() + timings.build_laser_ns() + timings.build_optical_system_ns() + timings.convert_ns() + timings.propagate_ns() + timings.write_output_ns() + timings.serialize_ns());
+    }
+  }
+
+  SECTION("Streaming")
+  {
+    input_msg.set_return_timings(true);
+    std::string stream;
+    propagator.run(msg::serialize_message(input_msg, msg::serialization_format::PROTOBUF), [&stream](const std::string& a_chunk) { stream += a_chunk; }, 400);
+    std::string_view stream_view = stream;
+    std::string      chunk_str;
+    int              num_chunks = 0;
+    while(msg::read_delimited(stream_view, chunk_str)) {
+      msg::deserialize_message(chunk_str, output_msg);
+      REQUIRE(output_msg.has_timings());
+      // only the first chunk includes parsing the input and building the beam and system
+      CHECK((output_msg.timings().deserialize_ns() > 0) == (num_chunks == 0));
+      CHECK((output_msg.timings().build_laser_ns() > 0) == (num_chunks == 0));
+      CHECK(output_msg.timings().propagate_ns() > 0);
+      CHECK(output_msg.timings().serialize_ns() > 0);
+      ++num_chunks;
+    }
+    CHECK(num_chunks == 3);
+  }
+
+  SECTION("Other methods")
+  {
+    msg::Propagator_batch_Input  batch_msg;
+    msg::Propagator_batch_Output batch_output;
+    *batch_msg.add_beams()           = input_msg.beam();
+    *batch_msg.add_optical_systems() = input_msg.optical_system();
+    *batch_msg.mutable_positions()   = input_msg.positions();
+    batch_msg.set_return_timings(true);
+    msg::deserialize_message(propagator.batch(msg::serialize_message(batch_msg)), batch_output);
+    REQUIRE(batch_output.has_timings());
+    CHECK(batch_output.timings().serialize_ns() > 0);
+    CHECK(batch_output.timings().build_laser_ns() > 0);
+    CHECK(batch_output.timings().propagate_ns() > 0);
+    CHECK(batch_output.timings().total_ns() > 0);
+
+    msg::Propagator_load_Input  load_msg;
+    msg::Propagator_load_Output load_output;
+    *load_msg.mutable_beam()           = input_msg.beam();
+    *load_msg.mutable_optical_system() = input_msg.optical_system();
+    load_msg.set_return_timings(true);
+    msg::deserialize_message(propagator.load(msg::serialize_message(load_msg)), load_output);
+    REQUIRE(load_output.has_timings());
+    CHECK(load_output.timings().serialize_ns() > 0);
+    CHECK(load_output.timings().build_optical_system_ns() > 0);
+    CHECK(load_output.timings().propagate_ns() == 0);
+
+    msg::Propagator_query_Input  query_msg;
+    msg::Propagator_query_Output query_output;
+    query_msg.set_session_id(load_output.session_id());
+    *query_msg.mutable_positions() = input_msg.positions();
+    query_msg.set_return_timings(true);
+    msg::deserialize_message(propagator.query(msg::serialize_message(query_msg)), query_output);
+    REQUIRE(query_output.has_timings());
+    CHECK(query_output.timings().serialize_ns() > 0);
+    CHECK(query_output.timings().build_laser_ns() == 0);
+    CHECK(query_output.timings().propagate_ns() > 0);
+
+    msg::Propagator_release_Input  release_msg;
+    msg::Propagator_release_Output release_output;
+    release_msg.set_session_id(load_output.session_id());
+    release_msg.set_return_timings(true);
+    msg::deserialize_message(propagator.release(msg::serialize_message(release_msg)), release_output);
+    REQUIRE(release_output.has_timings());
+    CHECK(release_output.timings().serialize_ns() > 0);
+    CHECK(release_output.timings().total_ns() > 0);
+  }
+
+  SECTION("Timed outputs are not cached")
+  {
+    propagator.setResultCacheSize(1024 * 1024);
+    input_msg.set_return_timings(true);
+    std::string input = msg::serialize_message(input_msg);
+    propagator.run(input);
+    propagator.run(input);
+    CHECK(propagator.getResultCacheStats().hits == 0);
+    CHECK(propagator.getResultCacheStats().entries == 0);
+  }
+}
+
+TEST_CASE("streaming propagation analysis")
+{
+  using namespace libGBP2;
+  Propagator propagator;
+
+  msg::Propagator_run_Input  input_msg;
+  msg::Propagator_run_Output output_msg;
+
+  *input_msg.mutable_beam()->mutable_wavelength() << "532 nm";
+  *input_msg.mutable_beam()->mutable_beam_waist_width() << "10 um";
+  input_msg.mutable_beam()->set_beam_waist_width_type(msg::BEAM_WIDTH_TYPE_ONE_OVER_E_SQUARED_RADIUS);
+  *input_msg.mutable_beam()->mutable_beam_waist_position() << "0 cm";
+  *input_msg.mutable_beam()->mutable_beam_quality_factor() << "1";
+  {
+    auto ptr = input_msg.mutable_optical_system()->add_elements();
+    *ptr->mutable_position() << "1 cm";
+    *ptr->mutable_element()->mutable_lens()->mutable_focal_length() << "5 mm";
+  }
+  for(int i = 0; i < 25; ++i) {
+    *input_msg.add_positions() << std::to_string(i) + " mm";
+  }
+  input_msg.set_return_full_beam_characterizations(true);
+
+  msg::Propagator_run_Output expected;
+  msg::deserialize_message(propagator.run(msg::serialize_message(input_msg)), expected);
+  REQUIRE(expected.beam_widths_size() == 25);
+
+  // collect the chunks written for an input and check that they add up to the output of run
+  auto check_chunks = [&](const std::string& a_stream, std::vector<int> a_sizes) {
+    std::string_view stream = a_stream;
+    std::string      chunk_str;
+    std::size_t      n = 0;
+    int              i = 0;
+    while(msg::read_delimited(stream, chunk_str)) {
+      REQUIRE(n < a_sizes.size());
+      msg::deserialize_message(chunk_str, output_msg);
+      CHECK(output_msg.has_return_status());
+      CHECK(!output_msg.return_status().has_error_message());
+      REQUIRE(output_msg.beam_widths_size() == a_sizes[n]);
+      REQUIRE(output_msg.beams_size() == a_sizes[n]);
+      for(int j = 0; j < output_msg.beam_widths_size(); ++j, ++i) {
+        CHECK(output_msg.beam_widths(j).value() == Approx(expected.beam_widths(i).value()));
+        CHECK(output_msg.beam_widths(j).unit() == expected.beam_widths(i).unit());
+        CHECK(output_msg.beams(j).beam_waist_position().value() == Approx(expected.beams(i).beam_waist_position().value()).scale(1));
+      }
+      ++n;
+    }
+    CHECK(n == a_sizes.size());
+  };
+
+  SECTION("Chunks are written to the sink")
+  {
+    for(auto format : {msg::serialization_format::JSON, msg::serialization_format::PROTOBUF}) {
+      std::string stream;
+      int         calls = 0;
+      propagator.run(
+          msg::serialize_message(input_msg, format), [&](const std::string& a_chunk) { stream += a_chunk; ++calls; }, 10);
+      CHECK(calls == 3);
+      check_chunks(stream, {10, 10, 5});
+    }
+
+    std::string stream;
+    propagator.run(msg::serialize_message(input_msg), [&](const std::string& a_chunk) { stream += a_chunk; });
+    check_chunks(stream, {25});
+
+    stream.clear();
+    input_msg.clear_positions();
+    propagator.run(msg::serialize_message(input_msg), [&](const std::string& a_chunk) { stream += a_chunk; });
+    check_chunks(stream, {0});
+  }
+
+  SECTION("Chunks are written to a file descriptor")
+  {
+    std::FILE* file = std::tmpfile();
+    REQUIRE(file != nullptr);
+    propagator.run(msg::serialize_message(input_msg, msg::serialization_format::PROTOBUF), fileno(file), 7);
+
+    std::string stream;
+    std::rewind(file);
+    for(int c = std::fgetc(file); c != EOF; c = std::fgetc(file)) {
+      stream.push_back(static_cast<char>(c));
+    }
+    std::fclose(file);
+    check_chunks(stream, {7, 7, 7, 4});
+
+    CHECK_THROWS_AS(propagator.run(msg::serialize_message(input_msg), -1), std::runtime_error);
+  }
+
+  SECTION("Errors are written as a single chunk")
+  {
+    input_msg.mutable_beam()->clear_beam_quality_factor();
+    std::vector<std::string> chunks;
+    propagator.run(
+        msg::serialize_message(input_msg), [&](const std::string& a_chunk) { chunks.push_back(a_chunk); }, 10);
+    REQUIRE(chunks.size() == 1);
+
+    std::string_view stream = chunks[0];
+    std::string      chunk_str;
+    REQUIRE(msg::read_delimited(stream, chunk_str));
+    CHECK(stream.size() == 0);
+    msg::deserialize_message(chunk_str, output_msg);
+    CHECK(output_msg.return_status().error_message() == "There was an error in `run` method: Neither beam quality factor or beam divergence were given. At least one must be set.");
+    CHECK(output_msg.beam_widths_size() == 0);
+  }
+
+  SECTION("Reading delimited messages")
+  {
+    std::string stream;
+    msg::append_delimited(std::string(300, 'a'), stream);
+    msg::append_delimited("", stream);
+    CHECK(stream.size() == 2 + 300 + 1);
+
+    std::string_view view = stream;
+    std::string      message;
+    CHECK(msg::read_delimited(view, message));
+    CHECK(message == std::string(300, 'a'));
+    CHECK(msg::read_delimited(view, message));
+    CHECK(message == "");
+    CHECK(!msg::read_delimited(view, message));
+
+    view = std::string_view(stream).substr(0, 100);
+    CHECK_THROWS_AS(msg::read_delimited(view, message), std::runtime_error);
+  }
+}
+
+TEST_CASE("propagation analysis sessions")
+{
+  using namespace libGBP2;
+  Propagator propagator;
+
+  msg::Propagator_load_Input     load_msg;
+  msg::Propagator_load_Output    load_output;
+  msg::Propagator_query_Input    query_msg;
+  msg::Propagator_query_Output   query_output;
+  msg::Propagator_release_Input  release_msg;
+  msg::Propagator_release_Output release_output;
+  msg::Propagator_run_Input      run_msg;
+  msg::Propagator_run_Output     run_output;
+
+  *load_msg.mutable_beam()->mutable_wavelength() << "532 nm";
+  *load_msg.mutable_beam()->mutable_beam_waist_width() << "10 um";
+  load_msg.mutable_beam()->set_beam_waist_width_type(msg::BEAM_WIDTH_TYPE_ONE_OVER_E_SQUARED_RADIUS);
+  *load_msg.mutable_beam()->mutable_beam_waist_position() << "0 cm";
+  *load_msg.mutable_beam()->mutable_beam_quality_factor() << "1";
+  {
+    auto ptr = load_msg.mutable_optical_system()->add_elements();
+    *ptr->mutable_position() << "1 cm";
+    *ptr->mutable_element()->mutable_lens()->mutable_focal_length() << "5 mm";
+    ptr = load_msg.mutable_optical_system()->add_elements();
+    *ptr->mutable_position() << "3 cm";
+    *ptr->mutable_element()->mutable_lens()->mutable_focal_length() << "10 mm";
+  }
+
+  CHECK(propagator.getNumberOfSessions() == 0);
+  msg::deserialize_message(propagator.load(msg::serialize_message(load_msg)), load_output);
+  CHECK(!load_output.return_status().has_error_message());
+  CHECK(load_output.session_id() > 0);
+  CHECK(propagator.getNumberOfSessions() == 1);
+
+  SECTION("Queries give the same results as run")
+  {
+    *run_msg.mutable_beam()           = load_msg.beam();
+    *run_msg.mutable_optical_system() = load_msg.optical_system();
+    query_msg.set_session_id(load_output.session_id());
+    for(std::string z : {"0 cm", "5 mm", "1 cm", "2 cm", "35 mm", "1 mm"}) {
+      *query_msg.add_positions() << z;
+      *run_msg.add_positions() << z;
+    }
+    for(bool full : {false, true}) {
+      query_msg.set_return_full_beam_characterizations(full);
+      run_msg.set_return_full_beam_characterizations(full);
+      query_msg.set_output_beam_width_unit("mm");
+      run_msg.set_output_beam_width_unit("mm");
+      msg::deserialize_message(propagator.query(msg::serialize_message(query_msg)), query_output);
+      msg::deserialize_message(propagator.run(msg::serialize_message(run_msg)), run_output);
+
+      CHECK(!query_output.return_status().has_error_message());
+      REQUIRE(query_output.beam_widths_size() == 6);
+      REQUIRE(query_output.beams_size() == (full ? 6 : 0));
+      for(int i = 0; i < 6; ++i) {
+        CHECK(query_output.beam_widths(i).value() == Approx(run_output.beam_widths(i).value()));
+        CHECK(query_output.beam_widths(i).unit() == "mm");
+      }
+      for(int i = 0; i < query_output.beams_size(); ++i) {
+        CHECK(query_output.beams(i).beam_waist_position().value() == Approx(run_output.beams(i).beam_waist_position().value()).scale(1));
+        CHECK(query_output.beams(i).beam_waist_width().value() == Approx(run_output.beams(i).beam_waist_width().value()));
+      }
+    }
+
+    // output options default to the input beam width type and unit
+    query_msg.clear_output_beam_width_unit();
+    msg::deserialize_message(propagator.query(msg::serialize_message(query_msg)), query_output);
+    CHECK(query_output.beam_widths(0).value() == Approx(10));
+    CHECK(query_output.beam_widths(0).unit() == "um");
+  }
+
+  SECTION("Release")
+  {
+    release_msg.set_session_id(load_output.session_id());
+    msg::deserialize_message(propagator.release(msg::serialize_message(release_msg)), release_output);
+    CHECK(!release_output.return_status().has_error_message());
+    CHECK(propagator.getNumberOfSessions() == 0);
+
+    msg::deserialize_message(propagator.release(msg::serialize_message(release_msg)), release_output);
+    CHECK(release_output.return_status().error_message() == "There was an error in `release` method: No session with id " + std::to_string(load_output.session_id()) + ". It may have been released or evicted.");
+
+    query_msg.set_session_id(load_output.session_id());
+    *query_msg.add_positions() << "1 cm";
+    msg::deserialize_message(propagator.query(msg::serialize_message(query_msg)), query_output);
+    CHECK(query_output.return_status().has_error_message());
+    CHECK(query_output.beam_widths_size() == 0);
+  }
+
+  SECTION("Least recently used sessions are evicted")
+  {
+    CHECK(propagator.getMaxNumberOfSessions() == 100);
+    propagator.setMaxNumberOfSessions(3);
+
+    std::vector<std::uint64_t> ids = {load_output.session_id()};
+    for(int i = 0; i < 2; ++i) {
+      msg::deserialize_message(propagator.load(msg::serialize_message(load_msg)), load_output);
+      ids.push_back(load_output.session_id());
+    }
+    CHECK(propagator.getNumberOfSessions() == 3);
+
+    // use the first session so that the second one is the least recently used
+    *query_msg.add_positions() << "1 cm";
+    query_msg.set_session_id(ids[0]);
+    msg::deserialize_message(propagator.query(msg::serialize_message(query_msg)), query_output);
+    CHECK(!query_output.return_status().has_error_message());
+
+    msg::deserialize_message(propagator.load(msg::serialize_message(load_msg)), load_output);
+    ids.push_back(load_output.session_id());
+    CHECK(propagator.getNumberOfSessions() == 3);
+
+    for(std::size_t i = 0; i < ids.size(); ++i) {
+      query_msg.set_session_id(ids[i]);
+      msg::deserialize_message(propagator.query(msg::serialize_message(query_msg)), query_output);
+      CHECK(query_output.return_status().has_error_message() == (i == 1));
+    }
+
+    propagator.setMaxNumberOfSessions(1);
+    CHECK(propagator.getNumberOfSessions() == 1);
+
+    CHECK_THROWS_AS(propagator.setMaxNumberOfSessions(0), std::runtime_error);
+    CHECK(propagator.getMaxNumberOfSessions() == 1);
+    CHECK(propagator.getNumberOfSessions() == 1);
+  }
+
+  SECTION("Errors")
+  {
+    load_msg.mutable_beam()->clear_beam_quality_factor();
+    msg::deserialize_message(propagator.load(msg::serialize_message(load_msg)), load_output);
+    CHECK(load_output.return_status().has_error_message());
+    CHECK(propagator.getNumberOfSessions() == 1);
+  }
+}
@@ -0,0 +1,268 @@
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <libGBP2/MessageAPI/Messages.hpp>
+#include <libGBP2/MessageAPI/PropagatorServer.hpp>
+
+#include "Messages.pb.h"
+
+using namespace Catch;
+
+namespace
+{
+int connect_to(const std::string& a_path)
+{
+  int         fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  a_path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+  if(::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * Send all requests at once, then read responses until the server closes the connection.
+ */
+std::map<std::uint64_t, libGBP2::msg::PropagatorServer_Response> send_requests(const std::string& a_path, const std::string& a_requests)
+{
+  std::map<std::uint64_t, libGBP2::msg::PropagatorServer_Response> responses;
+
+  int fd = connect_to(a_path);
+  REQUIRE(fd >= 0);
+  REQUIRE(::write(fd, a_requests.data(), a_requests.size()) == static_cast<ssize_t>(a_requests.size()));
+  ::shutdown(fd, SHUT_WR);
+
+  std::string data;
+  char        buffer[4096];
+  for(auto n = ::read(fd, buffer, sizeof(buffer)); n > 0; n = ::read(fd, buffer, sizeof(buffer))) {
+    data.append(buffer, n);
+  }
+  ::close(fd);
+
+  std::string_view stream = data;
+  std::string      response_str;
+  while(libGBP2::msg::read_delimited(stream, response_str)) {
+    libGBP2::msg::PropagatorServer_Response response;
+    REQUIRE(response.ParseFromString(response_str));
+    responses[response.request_id()] = response;
+  }
+  return responses;
+}
+
+void add_request(std::string& a_requests, std::uint64_t a_id, const std::string& a_method, const std::string& a_input)
+{
+  libGBP2::msg::PropagatorServer_Request request;
+  request.set_request_id(a_id);
+  request.set_method(a_method);
+  request.set_input(a_input);
+  libGBP2::msg::append_delimited(request.SerializeAsString(), a_requests);
+}
+}  // namespace
+
+TEST_CASE("Propagator server")
+{
+  using namespace libGBP2;
+  std::string socket_path = (std::filesystem::temp_directory_path() / ("libGBP2-server-test-" + std::to_string(::getpid()) + ".sock")).string();
+
+  PropagatorServer server(socket_path, 3);
+  CHECK(!server.isRunning());
+  server.start();
+  CHECK(server.isRunning());
+  CHECK(std::filesystem::exists(socket_path));
+
+  msg::Propagator_run_Input input_msg;
+  *input_msg.mutable_beam()->mutable_wavelength() << "532 nm";
+  *input_msg.mutable_beam()->mutable_beam_waist_width() << "10 um";
+  input_msg.mutable_beam()->set_beam_waist_width_type(msg::BEAM_WIDTH_TYPE_ONE_OVER_E_SQUARED_RADIUS);
+  *input_msg.mutable_beam()->mutable_beam_waist_position() << "0 cm";
+  *input_msg.mutable_beam()->mutable_beam_quality_factor() << "1";
+
+  SECTION("Pipelined requests")
+  {
+    // send many requests before reading any responses
+    std::string requests;
+    for(int i = 0; i < 50; ++i) {
+      input_msg.clear_positions();
+      *input_msg.add_positions() << std::to_string(i) + " mm";
+      auto format = i % 2 == 0 ? msg::serialization_format::JSON : msg::serialization_format::PROTOBUF;
+      add_request(requests, 100 + i, "run", msg::serialize_message(input_msg, format));
+    }
+    add_request(requests, 1, "not_a_method", "");
+
+    auto responses = send_requests(socket_path, requests);
+    REQUIRE(responses.size() == 51);
+
+    CHECK(responses[1].return_status().error_message() == "Unknown method `not_a_method`.");
+    CHECK(responses[1].output().size() == 0);
+
+    for(int i = 0; i < 50; ++i) {
+      REQUIRE(responses.count(100 + i) == 1);
+      CHECK(!responses[100 + i].return_status().has_error_message());
+      input_msg.clear_positions();
+      *input_msg.add_positions() << std::to_string(i) + " mm";
+      msg::Propagator_run_Output expected, output;
+      msg::deserialize_message(server.getPropagator().run(msg::serialize_message(input_msg)), expected);
+      // the output is in the same format as the input
+      CHECK(msg::deserialize_message(responses[100 + i].output(), output) == (i % 2 == 0 ? msg::serialization_format::JSON : msg::serialization_format::PROTOBUF));
+      REQUIRE(output.beam_widths_size() == 1);
+      CHECK(output.beam_widths(0).value() == Approx(expected.beam_widths(0).value()));
+    }
+
+    auto stats = server.getStats();
+    CHECK(stats.requests_completed == 51);
+    CHECK(stats.queue_depth == 0);
+    CHECK(stats.requests_in_progress == 0);
+    CHECK(stats.mean_latency.count() > 0);
+    CHECK(stats.max_latency >= stats.mean_latency);
+
+    requests.clear();
+    add_request(requests, 7, "stats", "");
+    responses = send_requests(socket_path, requests);
+    REQUIRE(responses.size() == 1);
+    msg::PropagatorServer_stats_Output stats_msg;
+    REQUIRE(stats_msg.ParseFromString(responses[7].output()));
+    CHECK(stats_msg.requests_completed() == 51);
+    CHECK(stats_msg.requests_in_progress() == 1);
+    // the client has already shut down its end, so the server may have dropped the connection
+    CHECK(stats_msg.connections() <= 1);
+    CHECK(stats_msg.max_latency_us() > 0);
+  }
+
+  SECTION("Sessions are shared by all connections")
+  {
+    msg::Propagator_load_Input load_msg;
+    *load_msg.mutable_beam() = input_msg.beam();
+    std::string requests;
+    add_request(requests, 1, "load", msg::serialize_message(load_msg, msg::serialization_format::PROTOBUF));
+    auto responses = send_requests(socket_path, requests);
+    REQUIRE(responses.size() == 1);
+    msg::Propagator_load_Output load_output;
+    msg::deserialize_message(responses[1].output(), load_output);
+    CHECK(!load_output.return_status().has_error_message());
+
+    msg::Propagator_query_Input query_msg;
+    query_msg.set_session_id(load_output.session_id());
+    *query_msg.add_positions() << "0 cm";
+    requests.clear();
+    add_request(requests, 2, "query", msg::serialize_message(query_msg, msg::serialization_format::PROTOBUF));
+    responses = send_requests(socket_path, requests);
+    REQUIRE(responses.size() == 1);
+    msg::Propagator_query_Output query_output;
+    msg::deserialize_message(responses[2].output(), query_output);
+    CHECK(!query_output.return_status().has_error_message());
+    REQUIRE(query_output.beam_widths_size() == 1);
+    CHECK(query_output.beam_widths(0).value() == Approx(10));
+  }
+
+  SECTION("Result cache stats")
+  {
+    server.getPropagator().setResultCacheSize(1024 * 1024);
+    *input_msg.add_positions() << "1 mm";
+    std::string requests;
+    add_request(requests, 1, "run", msg::serialize_message(input_msg, msg::serialization_format::PROTOBUF));
+    auto responses = send_requests(socket_path, requests);
+    responses      = send_requests(socket_path, requests);
+    REQUIRE(responses.size() == 1);
+
+    requests.clear();
+    add_request(requests, 2, "stats", "");
+    responses = send_requests(socket_path, requests);
+    REQUIRE(responses.size() == 1);
+    msg::PropagatorServer_stats_Output stats_msg;
+    REQUIRE(stats_msg.ParseFromString(responses[2].output()));
+    CHECK(stats_msg.result_cache_misses() == 1);
+    CHECK(stats_msg.result_cache_hits() == 1);
+    CHECK(stats_msg.result_cache_bytes() > 0);
+    CHECK(server.getStats().result_cache.hits == 1);
+  }
+
+  SECTION("Invalid requests close the connection")
+  {
+    std::string requests(12, '\xff');
+    auto        responses = send_requests(socket_path, requests);
+    CHECK(responses.size() == 0);
+    CHECK(server.isRunning());
+  }
+
+  SECTION("Requests larger than the limit close the connection")
+  {
+    CHECK(server.getMaxRequestSize() == 64 * 1024 * 1024);
+    server.setMaxRequestSize(100);
+    *input_msg.add_positions() << "1 mm";
+    std::string requests;
+    add_request(requests, 1, "run", msg::serialize_message(input_msg, msg::serialization_format::PROTOBUF));
+    add_request(requests, 2, "run", std::string(200, ' '));
+    auto responses = send_requests(socket_path, requests);
+    CHECK(responses.size() <= 1);
+    CHECK(responses.count(2) == 0);
+  }
+
+  SECTION("Clients that do not read their responses are disconnected")
+  {
+    server.setMaxPendingOutputSize(1);
+    // each response is much larger than the socket buffer
+    input_msg.mutable_positions_array()->set_unit("cm");
+    for(int i = 0; i < 100000; ++i) {
+      input_msg.mutable_positions_array()->add_values(i * 1e-3);
+    }
+    std::string requests;
+    for(int i = 0; i < 4; ++i) {
+      add_request(requests, i, "run", msg::serialize_message(input_msg, msg::serialization_format::PROTOBUF));
+    }
+    int fd = connect_to(socket_path);
+    REQUIRE(fd >= 0);
+    REQUIRE(::write(fd, requests.data(), requests.size()) == static_cast<ssize_t>(requests.size()));
+
+    // the workers finish every request without waiting for the client
+    for(int i = 0; i < 600 && server.getStats().requests_completed < 4; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    CHECK(server.getStats().requests_completed == 4);
+    for(int i = 0; i < 100 && server.getStats().connections > 0; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    CHECK(server.getStats().connections == 0);
+    ::close(fd);
+  }
+
+  SECTION("Stopping does not wait for clients that do not read their responses")
+  {
+    input_msg.mutable_positions_array()->set_unit("cm");
+    for(int i = 0; i < 100000; ++i) {
+      input_msg.mutable_positions_array()->add_values(i * 1e-3);
+    }
+    std::string requests;
+    add_request(requests, 1, "run", msg::serialize_message(input_msg, msg::serialization_format::PROTOBUF));
+    int fd = connect_to(socket_path);
+    REQUIRE(fd >= 0);
+    REQUIRE(::write(fd, requests.data(), requests.size()) == static_cast<ssize_t>(requests.size()));
+    for(int i = 0; i < 600 && server.getStats().requests_completed < 1; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    CHECK(server.getStats().requests_completed == 1);
+    CHECK(server.getStats().connections == 1);
+
+    auto start = std::chrono::steady_clock::now();
+    server.stop();
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+    ::close(fd);
+  }
+
+  server.stop();
+  CHECK(!server.isRunning());
+  CHECK(!std::filesystem::exists(socket_path));
+  CHECK(connect_to(socket_path) < 0);
+}